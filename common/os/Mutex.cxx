@@ -19,6 +19,7 @@
 #ifdef WIN32
 #include <windows.h>
 #else
+#include <errno.h>
 #include <pthread.h>
 #endif
 
@@ -67,6 +68,23 @@ void Mutex::lock()
 #endif
 }
 
+bool Mutex::tryLock()
+{
+#ifdef WIN32
+  return TryEnterCriticalSection((CRITICAL_SECTION*)systemMutex);
+#else
+  int ret;
+
+  ret = pthread_mutex_trylock((pthread_mutex_t*)systemMutex);
+  if (ret == EBUSY)
+    return false;
+  if (ret != 0)
+    throw rdr::SystemException("Failed to lock mutex", ret);
+
+  return true;
+#endif
+}
+
 void Mutex::unlock()
 {
 #ifdef WIN32
@@ -28,6 +28,7 @@ namespace os {
     ~Mutex();
 
     void lock();
+    bool tryLock();
     void unlock();
 
   private:
@@ -0,0 +1,146 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <stdlib.h>
+
+#include <os/Mutex.h>
+#include <os/Trace.h>
+
+using namespace os;
+
+FILE* Trace::file = NULL;
+Mutex* Trace::mutex = NULL;
+
+static bool firstEvent = true;
+
+static unsigned long getThreadId()
+{
+#if defined(WIN32)
+  return GetCurrentThreadId();
+#elif defined(__linux__)
+  return syscall(SYS_gettid);
+#else
+  return 0;
+#endif
+}
+
+bool Trace::open(const char* filename)
+{
+  FILE* f;
+
+  if (file != NULL)
+    return true;
+
+  f = fopen(filename, "w");
+  if (f == NULL)
+    return false;
+
+  // Events are small, so avoid a write() for every one of them
+  setvbuf(f, NULL, _IOFBF, 65536);
+
+  // The closing bracket is optional, so a truncated trace is still
+  // usable
+  fprintf(f, "[\n");
+
+  mutex = new Mutex();
+  file = f;
+
+  atexit(atExit);
+
+  return true;
+}
+
+void Trace::close()
+{
+  FILE* f;
+
+  if (file == NULL)
+    return;
+
+  mutex->lock();
+  f = file;
+  file = NULL;
+  fprintf(f, "\n]\n");
+  fclose(f);
+  mutex->unlock();
+}
+
+unsigned long long Trace::now()
+{
+#ifdef WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+
+  return count.QuadPart * 1000000ULL / freq.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+void Trace::writeSpan(const char* name, const char* detail,
+                      unsigned long long start, unsigned long long end)
+{
+  unsigned long tid;
+
+  tid = getThreadId();
+
+  mutex->lock();
+
+  if (file != NULL) {
+    if (!firstEvent)
+      fprintf(file, ",\n");
+    firstEvent = false;
+
+    fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+            "\"pid\":%lu,\"tid\":%lu",
+            name, start, end - start,
+#ifdef WIN32
+            (unsigned long)GetCurrentProcessId(),
+#else
+            (unsigned long)getpid(),
+#endif
+            tid);
+    if (detail != NULL)
+      fprintf(file, ",\"args\":{\"detail\":\"%s\"}", detail);
+    fprintf(file, "}");
+  }
+
+  mutex->unlock();
+}
+
+void Trace::atExit()
+{
+  close();
+}
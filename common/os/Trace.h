@@ -0,0 +1,88 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Trace.h - Lightweight tracing of hot code paths
+//
+// Spans are written as Chrome trace events ("complete" events) to a
+// JSON file that can be loaded in chrome://tracing or Perfetto. The
+// TRACE_SPAN() macro compiles to nothing unless ENABLE_TRACING is
+// defined, and costs a single branch when tracing is compiled in but
+// no trace file has been opened.
+//
+
+#ifndef __OS_TRACE_H__
+#define __OS_TRACE_H__
+
+#include <stdio.h>
+
+namespace os {
+
+  class Mutex;
+
+  class Trace {
+  public:
+    // Starts writing events to the given file, replacing any
+    // existing content. Returns false if the file cannot be opened.
+    static bool open(const char* filename);
+    static void close();
+
+    static bool isEnabled() { return file != NULL; }
+
+    // Monotonic time in microseconds
+    static unsigned long long now();
+
+    static void writeSpan(const char* name, const char* detail,
+                          unsigned long long start,
+                          unsigned long long end);
+
+  private:
+    static void atExit();
+
+    static FILE* file;
+    static Mutex* mutex;
+  };
+
+  class TraceSpan {
+  public:
+    TraceSpan(const char* name_, const char* detail_=NULL)
+      : name(name_), detail(detail_),
+        start(Trace::isEnabled() ? Trace::now() : 0) {}
+    ~TraceSpan() {
+      if (start != 0)
+        Trace::writeSpan(name, detail, start, Trace::now());
+    }
+
+  private:
+    const char* name;
+    const char* detail;
+    unsigned long long start;
+  };
+
+}
+
+#ifdef ENABLE_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) \
+  os::TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SPAN(...)
+#endif
+
+#endif
@@ -44,6 +44,8 @@
 #include <sys/select.h>
 #endif
 
+#include <os/Trace.h>
+
 #include <rdr/FdOutStream.h>
 #include <rdr/Exception.h>
 #include <rfb/util.h>
@@ -78,6 +80,8 @@ void FdOutStream::cork(bool enable)
 
 bool FdOutStream::flushBuffer()
 {
+  TRACE_SPAN("FdOutStream::flushBuffer");
+
   size_t n = writeFd((const void*) sentUpTo, ptr - sentUpTo);
   if (n == 0)
     return false;
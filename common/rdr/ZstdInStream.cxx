@@ -0,0 +1,102 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+
+#include <rdr/ZstdInStream.h>
+#include <rdr/Exception.h>
+
+#include <zstd.h>
+
+using namespace rdr;
+
+ZstdInStream::ZstdInStream()
+  : underlying(0), dctx(NULL), bytesIn(0)
+{
+  dctx = ZSTD_createDCtx();
+  if (dctx == NULL)
+    throw Exception("ZstdInStream: ZSTD_createDCtx failed");
+}
+
+ZstdInStream::~ZstdInStream()
+{
+  ZSTD_freeDCtx(dctx);
+}
+
+void ZstdInStream::setUnderlying(InStream* is, size_t bytesIn_)
+{
+  underlying = is;
+  bytesIn = bytesIn_;
+  skip(avail());
+}
+
+void ZstdInStream::flushUnderlying()
+{
+  while (bytesIn > 0) {
+    if (!hasData(1))
+      throw Exception("ZstdInStream: failed to flush remaining stream data");
+    skip(avail());
+  }
+
+  setUnderlying(NULL, 0);
+}
+
+void ZstdInStream::reset()
+{
+  setUnderlying(NULL, 0);
+  ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+}
+
+bool ZstdInStream::fillBuffer(size_t maxSize)
+{
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out;
+  size_t length, ret;
+
+  if (!underlying)
+    throw Exception("ZstdInStream overrun: no underlying stream");
+
+  // The decoder might still have output buffered even if all input
+  // has been consumed, so keep calling it until it is drained
+  length = 0;
+  if (bytesIn > 0) {
+    if (!underlying->hasData(1))
+      return false;
+    length = underlying->avail();
+    if (length > bytesIn)
+      length = bytesIn;
+  }
+
+  in.src = length ? underlying->getptr(length) : NULL;
+  in.size = length;
+  in.pos = 0;
+
+  out.dst = (U8*)end;
+  out.size = maxSize;
+  out.pos = 0;
+
+  ret = ZSTD_decompressStream(dctx, &out, &in);
+  if (ZSTD_isError(ret))
+    throw Exception("ZstdInStream: %s", ZSTD_getErrorName(ret));
+
+  bytesIn -= in.pos;
+  end += out.pos;
+  if (in.pos != 0)
+    underlying->setptr(in.pos);
+
+  return (in.pos != 0) || (out.pos != 0);
+}
@@ -0,0 +1,167 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+
+#include <rdr/ZstdOutStream.h>
+#include <rdr/Exception.h>
+
+#include <zstd.h>
+
+using namespace rdr;
+
+enum { DEFAULT_BUF_SIZE = 16384 };
+
+ZstdOutStream::ZstdOutStream(OutStream* os, int compressLevel)
+  : underlying(os), compressionLevel(compressLevel), newLevel(compressLevel),
+    inFrame(false), bufSize(DEFAULT_BUF_SIZE), offset(0)
+{
+  size_t ret;
+
+  cctx = ZSTD_createCCtx();
+  if (cctx == NULL)
+    throw Exception("ZstdOutStream: ZSTD_createCCtx failed");
+
+  ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                               compressionLevel);
+  if (ZSTD_isError(ret)) {
+    ZSTD_freeCCtx(cctx);
+    throw Exception("ZstdOutStream: %s", ZSTD_getErrorName(ret));
+  }
+
+  ptr = start = new U8[bufSize];
+  end = start + bufSize;
+}
+
+ZstdOutStream::~ZstdOutStream()
+{
+  try {
+    flush();
+  } catch (Exception&) {
+  }
+  delete [] start;
+  ZSTD_freeCCtx(cctx);
+}
+
+void ZstdOutStream::setUnderlying(OutStream* os)
+{
+  underlying = os;
+}
+
+void ZstdOutStream::setCompressionLevel(int level)
+{
+  if (level < ZSTD_minCLevel())
+    level = ZSTD_minCLevel();
+  if (level > ZSTD_maxCLevel())
+    level = ZSTD_maxCLevel();
+
+  newLevel = level;
+}
+
+size_t ZstdOutStream::length()
+{
+  return offset + ptr - start;
+}
+
+void ZstdOutStream::flush()
+{
+  checkCompressionLevel();
+
+  // Force out everything from the encoder unless we're corked, in
+  // which case the data is only fed to it
+  compress(start, ptr - start, corked ? ZSTD_e_continue : ZSTD_e_flush);
+
+  offset += ptr - start;
+  ptr = start;
+}
+
+void ZstdOutStream::cork(bool enable)
+{
+  OutStream::cork(enable);
+
+  underlying->cork(enable);
+}
+
+void ZstdOutStream::overrun(size_t needed)
+{
+  if (needed > bufSize)
+    throw Exception("ZstdOutStream overrun: buffer size exceeded");
+
+  checkCompressionLevel();
+
+  // Just make some room, we're not trying to end anything here
+  compress(start, ptr - start, ZSTD_e_continue);
+
+  offset += ptr - start;
+  ptr = start;
+}
+
+void ZstdOutStream::compress(const U8* data, size_t length, int mode)
+{
+  ZSTD_inBuffer in;
+  size_t ret;
+
+  if (!underlying)
+    throw Exception("ZstdOutStream: underlying OutStream has not been set");
+
+  if ((mode == ZSTD_e_continue) && (length == 0))
+    return;
+
+  in.src = data;
+  in.size = length;
+  in.pos = 0;
+
+  do {
+    ZSTD_outBuffer out;
+
+    out.dst = underlying->getptr(1);
+    out.size = underlying->avail();
+    out.pos = 0;
+
+    ret = ZSTD_compressStream2(cctx, &out, &in, (ZSTD_EndDirective)mode);
+    if (ZSTD_isError(ret))
+      throw Exception("ZstdOutStream: %s", ZSTD_getErrorName(ret));
+
+    underlying->setptr(out.pos);
+
+    // For flushes the return value is the amount of data still
+    // buffered in the encoder
+  } while ((mode == ZSTD_e_continue) ? (in.pos < in.size) : (ret != 0));
+
+  inFrame = (mode != ZSTD_e_end);
+}
+
+void ZstdOutStream::checkCompressionLevel()
+{
+  size_t ret;
+
+  if (newLevel == compressionLevel)
+    return;
+
+  // Parameters can only be changed between frames, so we need to
+  // finish the current one. The decoder will continue with the next
+  // frame transparently, but the history is lost so avoid doing this
+  // needlessly.
+  if (inFrame)
+    compress(NULL, 0, ZSTD_e_end);
+
+  ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, newLevel);
+  if (ZSTD_isError(ret))
+    throw Exception("ZstdOutStream: %s", ZSTD_getErrorName(ret));
+
+  compressionLevel = newLevel;
+}
@@ -828,6 +828,11 @@ void CConnection::updateEncodings()
     encodings.push_back(preferredEncoding);
   }
 
+  // Outside the normal range, and only an improved Tight, so always
+  // offer it when available
+  if (Decoder::supported(encodingTightZstd))
+    encodings.push_back(encodingTightZstd);
+
   encodings.push_back(encodingCopyRect);
 
   for (int i = encodingMax; i >= 0; i--) {
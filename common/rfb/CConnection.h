@@ -235,6 +235,9 @@ namespace rfb {
 
     ModifiablePixelBuffer* getFramebuffer() { return framebuffer; }
 
+    // Waits until all rects received so far have been decoded
+    void flushDecoder() { decoder.flush(); }
+
   protected:
     // Optional capabilities that a subclass is expected to set to true
     // if supported
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <vector>
+#include <os/Trace.h>
 #include <rdr/types.h>
 #include <rfb/Exception.h>
 #include <rfb/LogWriter.h>
@@ -45,10 +46,13 @@ bool ComparingUpdateTracker::compare()
 {
   std::vector<Rect> rects;
   std::vector<Rect>::iterator i;
+  Region::const_iterator ri;
 
   if (!enabled)
     return false;
 
+  TRACE_SPAN("ComparingUpdateTracker::compare");
+
   if (firstCompare) {
     // NB: We leave the change region untouched on this iteration,
     // since in effect the entire framebuffer has changed.
@@ -70,18 +74,14 @@ bool ComparingUpdateTracker::compare()
   for (i = rects.begin(); i != rects.end(); i++)
     oldFb.copyRect(*i, copy_delta);
 
-  changed.get_rects(&rects);
-
   Region newChanged;
-  for (i = rects.begin(); i != rects.end(); i++)
-    compareRect(*i, &newChanged);
+  for (ri = changed.begin(); ri != changed.end(); ++ri)
+    compareRect(*ri, &newChanged);
 
-  changed.get_rects(&rects);
-  for (i = rects.begin(); i != rects.end(); i++)
-    totalPixels += i->area();
-  newChanged.get_rects(&rects);
-  for (i = rects.begin(); i != rects.end(); i++)
-    missedPixels += i->area();
+  for (ri = changed.begin(); ri != changed.end(); ++ri)
+    totalPixels += ri->area();
+  for (ri = newChanged.begin(); ri != newChanged.end(); ++ri)
+    missedPixels += ri->area();
 
   if (changed.equals(newChanged))
     return false;
@@ -104,6 +104,14 @@ void ComparingUpdateTracker::disable()
   firstCompare = true;
 }
 
+void ComparingUpdateTracker::freeBuffers()
+{
+  oldFb.setSize(0, 0);
+
+  // Changes might be missed without a complete copy
+  firstCompare = true;
+}
+
 void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
 {
   if (!r.enclosed_by(fb->getRect())) {
@@ -260,3 +268,10 @@ void ComparingUpdateTracker::logStats()
 
   totalPixels = missedPixels = 0;
 }
+
+void ComparingUpdateTracker::getStats(unsigned long long* total,
+                                      unsigned long long* changed)
+{
+  *total = totalPixels;
+  *changed = missedPixels;
+}
@@ -41,8 +41,16 @@ namespace rfb {
     virtual void enable();
     virtual void disable();
 
+    // freeBuffers() releases the copy of the framebuffer used for
+    // comparison. It will be recreated on the next compare().
+    void freeBuffers();
+
     void logStats();
 
+    // getStats() returns the number of pixels that have been compared
+    // and how many of those had actually changed
+    void getStats(unsigned long long* total, unsigned long long* changed);
+
   private:
     void compareRect(const Rect& r, Region* newchanged);
     PixelBuffer* fb;
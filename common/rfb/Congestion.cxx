@@ -307,6 +307,19 @@ size_t Congestion::getBandwidth()
   return bandwidth;
 }
 
+unsigned Congestion::getRoundTripTime()
+{
+  if (safeBaseRTT == (unsigned)-1)
+    return 0;
+
+  return safeBaseRTT;
+}
+
+unsigned Congestion::getCongestionWindow()
+{
+  return congWindow;
+}
+
 void Congestion::debugTrace(const char* filename, int fd)
 {
 #ifdef CONGESTION_TRACE
@@ -51,6 +51,14 @@ namespace rfb {
     // per second.
     size_t getBandwidth();
 
+    // getRoundTripTime() returns the lowest measured round trip time
+    // in milliseconds, or 0 if nothing has been measured yet.
+    unsigned getRoundTripTime();
+
+    // getCongestionWindow() returns the current congestion window in
+    // bytes.
+    unsigned getCongestionWindow();
+
     // debugTrace() writes the current congestion window, as well as the
     // congestion window of the underlying TCP layer, to the specified
     // file
@@ -320,3 +320,8 @@ void RenderedCursor::update(PixelBuffer* framebuffer,
     }
   }
 }
+
+void RenderedCursor::freeBuffers()
+{
+  buffer.setSize(0, 0);
+}
@@ -64,6 +64,9 @@ namespace rfb {
 
     void update(PixelBuffer* framebuffer, Cursor* cursor, const Point& pos);
 
+    // Releases the memory until the next update()
+    void freeBuffers();
+
   protected:
     ManagedPixelBuffer buffer;
     Point offset;
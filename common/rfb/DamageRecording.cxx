@@ -0,0 +1,330 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- DamageRecording.cxx - Recording and replay of desktop changes
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/FileInStream.h>
+
+#include <rfb/DamageRecording.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/Region.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+static const char signature[8] = { 'T', 'V', 'N', 'C', 'D', 'M', 'G', '\n' };
+static const rdr::U32 version = 1;
+
+enum {
+  recordSize = 1,
+  recordDamage,
+  recordCursor,
+  recordCursorPos
+};
+
+// Streams only fetch more data when asked to, so this has to be
+// called before reading anything
+static void checkData(rdr::InStream* is, size_t length)
+{
+  if (!is->hasData(length))
+    throw rdr::Exception("Truncated damage recording");
+}
+
+DamageRecorder::DamageRecorder(const char* filename)
+  : recordType(-1), zos(NULL, 1)
+{
+  file = fopen(filename, "wb");
+  if (file == NULL)
+    throw rdr::SystemException("fopen", errno);
+
+  gettimeofday(&startTime, NULL);
+
+  zos.setUnderlying(&payload);
+
+  record.writeBytes(signature, sizeof(signature));
+  record.writeU32(version);
+
+  if (fwrite(record.data(), record.length(), 1, file) != 1) {
+    int err = errno;
+    fclose(file);
+    throw rdr::SystemException("fwrite", err);
+  }
+
+  record.clear();
+}
+
+DamageRecorder::~DamageRecorder()
+{
+  fclose(file);
+}
+
+void DamageRecorder::writeSize(int width, int height,
+                               const PixelFormat& pf)
+{
+  startRecord(recordSize);
+  zos.writeU16(width);
+  zos.writeU16(height);
+  pf.write(&zos);
+  endRecord();
+}
+
+void DamageRecorder::writeDamage(const Region& changed,
+                                 const PixelBuffer* pb)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  int bpp;
+
+  changed.get_rects(&rects);
+  if (rects.empty())
+    return;
+
+  bpp = pb->getPF().bpp / 8;
+
+  startRecord(recordDamage);
+
+  zos.writeU32(rects.size());
+  for (i = rects.begin(); i != rects.end(); ++i) {
+    const rdr::U8* data;
+    int stride;
+
+    zos.writeU16(i->tl.x);
+    zos.writeU16(i->tl.y);
+    zos.writeU16(i->width());
+    zos.writeU16(i->height());
+
+    data = pb->getBuffer(*i, &stride);
+    for (int y = 0;y < i->height();y++) {
+      zos.writeBytes(data, i->width() * bpp);
+      data += stride * bpp;
+    }
+  }
+
+  endRecord();
+}
+
+void DamageRecorder::writeCursor(int width, int height,
+                                 const Point& hotspot,
+                                 const rdr::U8* data)
+{
+  startRecord(recordCursor);
+  zos.writeU16(width);
+  zos.writeU16(height);
+  zos.writeU16(hotspot.x);
+  zos.writeU16(hotspot.y);
+  zos.writeBytes(data, width * height * 4);
+  endRecord();
+}
+
+void DamageRecorder::writeCursorPos(const Point& pos)
+{
+  startRecord(recordCursorPos);
+  zos.writeU16(pos.x);
+  zos.writeU16(pos.y);
+  endRecord();
+}
+
+void DamageRecorder::startRecord(int type)
+{
+  assert(recordType == -1);
+  recordType = type;
+}
+
+void DamageRecorder::endRecord()
+{
+  // Each record must be decodable on its own, so end it with a sync
+  // flush
+  zos.flush();
+
+  record.writeU8(recordType);
+  record.writeU32(msSince(&startTime));
+  record.writeU32(payload.length());
+  record.writeBytes(payload.data(), payload.length());
+
+  recordType = -1;
+  payload.clear();
+
+  if (fwrite(record.data(), record.length(), 1, file) != 1) {
+    record.clear();
+    throw rdr::SystemException("fwrite", errno);
+  }
+
+  record.clear();
+}
+
+DamagePlayer::DamagePlayer(const char* filename, DamageHandler* handler_)
+  : handler(handler_), recordType(-1), recordTime(0), recordLength(0)
+{
+  char sig[sizeof(signature)];
+  rdr::U32 ver;
+
+  is = new rdr::FileInStream(filename);
+
+  try {
+    checkData(is, sizeof(sig) + 4);
+    is->readBytes(sig, sizeof(sig));
+    if (memcmp(sig, signature, sizeof(signature)) != 0)
+      throw rdr::Exception("Not a damage recording");
+
+    ver = is->readU32();
+    if (ver != version)
+      throw rdr::Exception("Unsupported damage recording version %u",
+                           (unsigned)ver);
+  } catch (rdr::Exception&) {
+    delete is;
+    throw;
+  }
+}
+
+DamagePlayer::~DamagePlayer()
+{
+  delete is;
+}
+
+bool DamagePlayer::nextRecord()
+{
+  try {
+    checkData(is, 1 + 4 + 4);
+  } catch (rdr::EndOfStream&) {
+    // A partial header just means the recording was cut short
+    return false;
+  }
+
+  recordType = is->readU8();
+  recordTime = is->readU32();
+  recordLength = is->readU32();
+
+  return true;
+}
+
+void DamagePlayer::processRecord()
+{
+  zis.setUnderlying(is, recordLength);
+
+  switch (recordType) {
+  case recordSize:
+    readSize();
+    break;
+  case recordDamage:
+    readDamage();
+    break;
+  case recordCursor:
+    readCursor();
+    break;
+  case recordCursorPos:
+    readCursorPos();
+    break;
+  default:
+    throw rdr::Exception("Unknown damage record type %d", recordType);
+  }
+
+  zis.flushUnderlying();
+}
+
+void DamagePlayer::readSize()
+{
+  int width, height;
+  PixelFormat pf;
+
+  checkData(&zis, 2 + 2 + 16);
+  width = zis.readU16();
+  height = zis.readU16();
+  pf.read(&zis);
+
+  handler->setSize(width, height, pf);
+}
+
+void DamagePlayer::readDamage()
+{
+  ModifiablePixelBuffer* pb;
+  Region changed;
+  rdr::U32 count;
+  int bpp;
+
+  pb = handler->getFramebuffer();
+  if (pb == NULL)
+    throw rdr::Exception("Damage record before size record");
+
+  bpp = pb->getPF().bpp / 8;
+
+  checkData(&zis, 4);
+  count = zis.readU32();
+  while (count--) {
+    Rect r;
+    rdr::U8* data;
+    int stride;
+
+    checkData(&zis, 8);
+    r.tl.x = zis.readU16();
+    r.tl.y = zis.readU16();
+    r.br.x = r.tl.x + zis.readU16();
+    r.br.y = r.tl.y + zis.readU16();
+
+    if (!r.enclosed_by(pb->getRect()))
+      throw rdr::Exception("Damage outside of frame buffer");
+
+    data = pb->getBufferRW(r, &stride);
+    for (int y = 0;y < r.height();y++) {
+      checkData(&zis, r.width() * bpp);
+      zis.readBytes(data, r.width() * bpp);
+      data += stride * bpp;
+    }
+    pb->commitBufferRW(r);
+
+    changed.assign_union(Region(r));
+  }
+
+  handler->damage(changed);
+}
+
+void DamagePlayer::readCursor()
+{
+  int width, height;
+  Point hotspot;
+  std::vector<rdr::U8> data;
+
+  checkData(&zis, 8);
+  width = zis.readU16();
+  height = zis.readU16();
+  hotspot.x = zis.readU16();
+  hotspot.y = zis.readU16();
+
+  data.resize(width * height * 4 + 1);
+  checkData(&zis, width * height * 4);
+  zis.readBytes(&data[0], width * height * 4);
+
+  handler->setCursor(width, height, hotspot, &data[0]);
+}
+
+void DamagePlayer::readCursorPos()
+{
+  Point pos;
+
+  checkData(&zis, 4);
+  pos.x = zis.readU16();
+  pos.y = zis.readU16();
+
+  handler->setCursorPos(pos);
+}
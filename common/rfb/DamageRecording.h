@@ -0,0 +1,137 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- DamageRecording.h - Recording and replay of desktop changes
+//
+// A damage recording captures everything a desktop feeds to a
+// VNCServer: the changed areas together with their new pixel data,
+// and cursor changes. Replaying it gives a repeatable workload for
+// benchmarking the server side without access to the original
+// desktop.
+//
+// The file starts with a signature and a version, followed by
+// records. Each record has a type, a timestamp in milliseconds and
+// the length of its payload, which is a chunk of a single zlib
+// stream.
+
+#ifndef __RFB_DAMAGERECORDING_H__
+#define __RFB_DAMAGERECORDING_H__
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <rdr/MemOutStream.h>
+#include <rdr/ZlibInStream.h>
+#include <rdr/ZlibOutStream.h>
+
+#include <rfb/PixelFormat.h>
+#include <rfb/Rect.h>
+
+namespace rdr { class FileInStream; }
+
+namespace rfb {
+
+  class Region;
+  class PixelBuffer;
+  class ModifiablePixelBuffer;
+
+  class DamageRecorder {
+  public:
+    DamageRecorder(const char* filename);
+    ~DamageRecorder();
+
+    // Must be called before any damage is written, and again
+    // whenever the frame buffer changes size or format
+    void writeSize(int width, int height, const PixelFormat& pf);
+
+    // Records the contents of the changed area from the given
+    // buffer, which must match the last size and format written
+    void writeDamage(const Region& changed, const PixelBuffer* pb);
+
+    // Cursor data is in RGBA format, just like VNCServer::setCursor()
+    void writeCursor(int width, int height, const Point& hotspot,
+                     const rdr::U8* data);
+    void writeCursorPos(const Point& pos);
+
+  private:
+    void startRecord(int type);
+    void endRecord();
+
+  private:
+    FILE* file;
+    struct timeval startTime;
+
+    int recordType;
+    rdr::MemOutStream payload;
+    rdr::ZlibOutStream zos;
+    rdr::MemOutStream record;
+  };
+
+  class DamageHandler {
+  public:
+    virtual ~DamageHandler() {}
+
+    // The handler should make sure that getFramebuffer() returns a
+    // buffer with this size and format
+    virtual void setSize(int width, int height, const PixelFormat& pf) = 0;
+    virtual ModifiablePixelBuffer* getFramebuffer() = 0;
+
+    // Called once the new pixel data has been written to the frame
+    // buffer
+    virtual void damage(const Region& changed) = 0;
+
+    virtual void setCursor(int width, int height, const Point& hotspot,
+                           const rdr::U8* data) = 0;
+    virtual void setCursorPos(const Point& pos) = 0;
+  };
+
+  class DamagePlayer {
+  public:
+    DamagePlayer(const char* filename, DamageHandler* handler);
+    ~DamagePlayer();
+
+    // Reads the header of the next record. Returns false once the
+    // end of the recording has been reached.
+    bool nextRecord();
+    // Time of the current record, relative to the start of the
+    // recording
+    unsigned timestamp() const { return recordTime; }
+    // Reads the payload of the current record and passes it on to
+    // the handler
+    void processRecord();
+
+  private:
+    void readSize();
+    void readDamage();
+    void readCursor();
+    void readCursorPos();
+
+  private:
+    DamageHandler* handler;
+
+    rdr::FileInStream* is;
+    rdr::ZlibInStream zis;
+
+    int recordType;
+    unsigned recordTime;
+    size_t recordLength;
+  };
+
+}
+
+#endif
@@ -19,6 +19,8 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <rfb/CConnection.h>
 #include <rfb/DecodeManager.h>
 #include <rfb/Decoder.h>
@@ -39,7 +41,7 @@ static LogWriter vlog("DecodeManager");
 DecodeManager::DecodeManager(CConnection *conn) :
   conn(conn), threadException(NULL)
 {
-  size_t cpuCount;
+  size_t cpuCount, entryCount;
 
   memset(decoders, 0, sizeof(decoders));
 
@@ -54,9 +56,9 @@ DecodeManager::DecodeManager(CConnection *conn) :
   } else {
     vlog.info("Detected %d CPU core(s)", (int)cpuCount);
     // No point creating more threads than this, they'll just end up
-    // wasting CPU fighting for locks
-    if (cpuCount > 4)
-      cpuCount = 4;
+    // waiting for the main thread to feed them rects
+    if (cpuCount > 8)
+      cpuCount = 8;
     // The overhead of threading is small, but not small enough to
     // ignore on single CPU systems
     if (cpuCount == 1)
@@ -65,20 +67,33 @@ DecodeManager::DecodeManager(CConnection *conn) :
       vlog.info("Creating %d decoder thread(s)", (int)cpuCount);
   }
 
-  if (cpuCount == 1) {
-    // Threads are not used on single CPU machines
-    freeBuffers.push_back(new rdr::MemOutStream());
-    return;
+  // Threads are not used on single CPU machines, otherwise we want
+  // twice as many possible entries in the queue as there are worker
+  // threads to make sure they don't stall
+  if (cpuCount == 1)
+    entryCount = 1;
+  else
+    entryCount = cpuCount * 2;
+
+  allEntries.reserve(entryCount);
+  freeEntries.reserve(entryCount);
+  workQueue.reserve(entryCount);
+
+  while (entryCount--) {
+    QueueEntry *entry;
+
+    entry = new QueueEntry;
+    entry->bufferStream = new rdr::MemOutStream();
+
+    allEntries.push_back(entry);
+    freeEntries.push_back(entry);
   }
 
-  while (cpuCount--) {
-    // Twice as many possible entries in the queue as there
-    // are worker threads to make sure they don't stall
-    freeBuffers.push_back(new rdr::MemOutStream());
-    freeBuffers.push_back(new rdr::MemOutStream());
+  if (cpuCount == 1)
+    return;
 
+  while (cpuCount--)
     threads.push_back(new DecodeThread(this));
-  }
 }
 
 DecodeManager::~DecodeManager()
@@ -90,9 +105,10 @@ DecodeManager::~DecodeManager()
 
   delete threadException;
 
-  while (!freeBuffers.empty()) {
-    delete freeBuffers.back();
-    freeBuffers.pop_back();
+  while (!allEntries.empty()) {
+    delete allEntries.back()->bufferStream;
+    delete allEntries.back();
+    allEntries.pop_back();
   }
 
   delete consumerCond;
@@ -131,7 +147,7 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   // Fast path for single CPU machines to avoid the context
   // switching overhead
   if (threads.empty()) {
-    bufferStream = freeBuffers.front();
+    bufferStream = freeEntries.front()->bufferStream;
     bufferStream->clear();
     if (!decoder->readRect(r, conn->getInStream(), conn->server, bufferStream))
       return false;
@@ -144,16 +160,16 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
     return true;
   }
 
-  // Wait for an available memory buffer
+  // Wait for an available queue entry
   queueMutex->lock();
 
   // FIXME: Should we return and let other things run here?
-  while (freeBuffers.empty())
+  while (freeEntries.empty())
     producerCond->wait();
 
-  // Don't pop the buffer in case we throw an exception
+  // Don't pop the entry in case we throw an exception
   // whilst reading
-  bufferStream = freeBuffers.front();
+  entry = freeEntries.back();
 
   queueMutex->unlock();
 
@@ -161,30 +177,29 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   throwThreadException();
 
   // Read the rect
+  bufferStream = entry->bufferStream;
   bufferStream->clear();
   if (!decoder->readRect(r, conn->getInStream(), conn->server, bufferStream))
     return false;
 
   // Then try to put it on the queue
-  entry = new QueueEntry;
-
   entry->active = false;
   entry->rect = r;
   entry->encoding = encoding;
   entry->decoder = decoder;
   entry->server = &conn->server;
   entry->pb = pb;
-  entry->bufferStream = bufferStream;
 
   decoder->getAffectedRegion(r, bufferStream->data(),
                              bufferStream->length(), conn->server,
                              &entry->affectedRegion);
+  entry->affectedBounds = entry->affectedRegion.get_bounding_rect();
 
   queueMutex->lock();
 
-  // The workers add buffers to the end so it's safe to assume
-  // the front is still the same buffer
-  freeBuffers.pop_front();
+  // The workers add entries to the end, so ours might have moved
+  freeEntries.erase(std::find(freeEntries.begin(), freeEntries.end(),
+                              entry));
 
   workQueue.push_back(entry);
 
@@ -295,12 +310,13 @@ void DecodeManager::DecodeThread::worker()
 
     manager->queueMutex->lock();
 
-    // Remove the entry from the queue and give back the memory buffer
-    manager->freeBuffers.push_back(entry->bufferStream);
-    manager->workQueue.remove(entry);
-    delete entry;
+    // Remove the entry from the queue and make it available again
+    manager->workQueue.erase(std::find(manager->workQueue.begin(),
+                                       manager->workQueue.end(),
+                                       entry));
+    manager->freeEntries.push_back(entry);
 
-    // Wake the main thread in case it is waiting for a memory buffer
+    // Wake the main thread in case it is waiting for a queue entry
     manager->producerCond->signal();
     // This rect might have been blocking multiple other rects, so
     // wake up every worker thread
@@ -313,8 +329,7 @@ void DecodeManager::DecodeThread::worker()
 
 DecodeManager::QueueEntry* DecodeManager::DecodeThread::findEntry()
 {
-  std::list<DecodeManager::QueueEntry*>::iterator iter;
-  Region lockedRegion;
+  std::vector<DecodeManager::QueueEntry*>::iterator iter;
 
   if (manager->workQueue.empty())
     return NULL;
@@ -327,49 +342,59 @@ DecodeManager::QueueEntry* DecodeManager::DecodeThread::findEntry()
        ++iter) {
     DecodeManager::QueueEntry* entry;
 
-    std::list<DecodeManager::QueueEntry*>::iterator iter2;
+    std::vector<DecodeManager::QueueEntry*>::iterator iter2;
 
     entry = *iter;
 
     // Another thread working on this?
     if (entry->active)
-      goto next;
+      continue;
+
+    // Every earlier rectangle must be finished first if it affects
+    // this one
+    for (iter2 = manager->workQueue.begin(); iter2 != iter; ++iter2) {
+      if (isBlocked(entry, *iter2))
+        break;
+    }
+
+    if (iter2 == iter)
+      return entry;
+  }
+
+  return NULL;
+}
 
+bool DecodeManager::DecodeThread::isBlocked(const DecodeManager::QueueEntry* entry,
+                                            const DecodeManager::QueueEntry* earlier)
+{
+  if (entry->encoding == earlier->encoding) {
     // If this is an ordered decoder then make sure this is the first
     // rectangle in the queue for that decoder
-    if (entry->decoder->flags & DecoderOrdered) {
-      for (iter2 = manager->workQueue.begin(); iter2 != iter; ++iter2) {
-        if (entry->encoding == (*iter2)->encoding)
-          goto next;
-      }
-    }
+    if (entry->decoder->flags & DecoderOrdered)
+      return true;
 
     // For a partially ordered decoder we must ask the decoder for each
     // pair of rectangles.
-    if (entry->decoder->flags & DecoderPartiallyOrdered) {
-      for (iter2 = manager->workQueue.begin(); iter2 != iter; ++iter2) {
-        if (entry->encoding != (*iter2)->encoding)
-          continue;
-        if (entry->decoder->doRectsConflict(entry->rect,
-                                            entry->bufferStream->data(),
-                                            entry->bufferStream->length(),
-                                            (*iter2)->rect,
-                                            (*iter2)->bufferStream->data(),
-                                            (*iter2)->bufferStream->length(),
-                                            *entry->server))
-          goto next;
-      }
-    }
-
-    // Check overlap with earlier rectangles
-    if (!lockedRegion.intersect(entry->affectedRegion).is_empty())
-      goto next;
+    if ((entry->decoder->flags & DecoderPartiallyOrdered) &&
+        entry->decoder->doRectsConflict(entry->rect,
+                                        entry->bufferStream->data(),
+                                        entry->bufferStream->length(),
+                                        earlier->rect,
+                                        earlier->bufferStream->data(),
+                                        earlier->bufferStream->length(),
+                                        *entry->server))
+      return true;
+  }
 
-    return entry;
+  // Check overlap with the earlier rectangle. Affected regions are
+  // nearly always a single rectangle, in which case the bounding
+  // boxes tell us everything without touching the regions.
+  if (!entry->affectedBounds.overlaps(earlier->affectedBounds))
+    return false;
 
-next:
-    lockedRegion.assign_union(entry->affectedRegion);
-  }
+  if ((entry->affectedRegion.numRects() == 1) &&
+      (earlier->affectedRegion.numRects() == 1))
+    return true;
 
-  return NULL;
+  return !entry->affectedRegion.intersect(earlier->affectedRegion).is_empty();
 }
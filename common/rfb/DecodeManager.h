@@ -20,6 +20,7 @@
 #define __RFB_DECODEMANAGER_H__
 
 #include <list>
+#include <vector>
 
 #include <os/Thread.h>
 
@@ -69,10 +70,14 @@ namespace rfb {
       ModifiablePixelBuffer* pb;
       rdr::MemOutStream* bufferStream;
       Region affectedRegion;
+      Rect affectedBounds;
     };
 
-    std::list<rdr::MemOutStream*> freeBuffers;
-    std::list<QueueEntry*> workQueue;
+    // Entries are allocated up front and recycled, so these never
+    // need to grow once constructed
+    std::vector<QueueEntry*> allEntries;
+    std::vector<QueueEntry*> freeEntries;
+    std::vector<QueueEntry*> workQueue;
 
     os::Mutex* queueMutex;
     os::Condition* producerCond;
@@ -89,6 +94,8 @@ namespace rfb {
     protected:
       void worker();
       DecodeManager::QueueEntry* findEntry();
+      bool isBlocked(const DecodeManager::QueueEntry* entry,
+                     const DecodeManager::QueueEntry* earlier);
 
     private:
       DecodeManager* manager;
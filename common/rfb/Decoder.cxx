@@ -61,6 +61,9 @@ bool Decoder::supported(int encoding)
   case encodingHextile:
   case encodingZRLE:
   case encodingTight:
+#ifdef HAVE_ZSTD
+  case encodingTightZstd:
+#endif
     return true;
   default:
     return false;
@@ -82,6 +85,10 @@ Decoder* Decoder::createDecoder(int encoding)
     return new ZRLEDecoder();
   case encodingTight:
     return new TightDecoder();
+#ifdef HAVE_ZSTD
+  case encodingTightZstd:
+    return new TightDecoder(true);
+#endif
   default:
     return NULL;
   }
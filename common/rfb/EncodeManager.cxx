@@ -21,6 +21,10 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+
+#include <os/Trace.h>
+
 #include <rfb/EncodeManager.h>
 #include <rfb/Encoder.h>
 #include <rfb/Palette.h>
@@ -29,6 +33,8 @@
 #include <rfb/UpdateTracker.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Exception.h>
+#include <rfb/Metrics.h>
+#include <rfb/ServerCore.h>
 
 #include <rfb/RawEncoder.h>
 #include <rfb/RREEncoder.h>
@@ -55,6 +61,16 @@ static const int SolidBlockMinArea = 2048;
 // How long we consider a region recently changed (in ms)
 static const int RecentChangeTimeout = 50;
 
+// Measurements needed before the cost of an encoder is trusted
+static const unsigned EncoderMinSamples = 4;
+// How often (in rects of the same type) another encoder is tried
+static const unsigned EncoderProbeInterval = 64;
+// Rects larger than this are never used to try another encoder, as a
+// bad choice could be expensive
+static const int EncoderProbeMaxArea = 16384;
+// Weight of each new measurement in the moving averages
+static const double EncoderCostWeight = 1.0 / 16;
+
 namespace rfb {
 
 enum EncoderClass {
@@ -63,6 +79,7 @@ enum EncoderClass {
   encoderHextile,
   encoderTight,
   encoderTightJPEG,
+  encoderTightZstd,
   encoderZRLE,
   encoderClassMax,
 };
@@ -84,7 +101,7 @@ struct RectInfo {
 
 };
 
-static const char *encoderClassName(EncoderClass klass)
+const char *EncodeManager::encoderClassName(int klass)
 {
   switch (klass) {
   case encoderRaw:
@@ -97,6 +114,8 @@ static const char *encoderClassName(EncoderClass klass)
     return "Tight";
   case encoderTightJPEG:
     return "Tight (JPEG)";
+  case encoderTightZstd:
+    return "Tight (Zstd)";
   case encoderZRLE:
     return "ZRLE";
   case encoderClassMax:
@@ -106,7 +125,7 @@ static const char *encoderClassName(EncoderClass klass)
   return "Unknown Encoder Class";
 }
 
-static const char *encoderTypeName(EncoderType type)
+const char *EncodeManager::encoderTypeName(int type)
 {
   switch (type) {
   case encoderSolid:
@@ -129,9 +148,11 @@ static const char *encoderTypeName(EncoderType type)
 }
 
 EncodeManager::EncodeManager(SConnection* conn_)
-  : conn(conn_), recentChangeTimer(this)
+  : conn(conn_), recentChangeTimer(this), bandwidth(0),
+    stageTiming(false)
 {
   StatsVector::iterator iter;
+  CostVector::iterator citer;
 
   encoders.resize(encoderClassMax, NULL);
   activeEncoders.resize(encoderTypeMax, encoderRaw);
@@ -141,10 +162,12 @@ EncodeManager::EncodeManager(SConnection* conn_)
   encoders[encoderHextile] = new HextileEncoder(conn);
   encoders[encoderTight] = new TightEncoder(conn);
   encoders[encoderTightJPEG] = new TightJPEGEncoder(conn);
+  encoders[encoderTightZstd] = new TightEncoder(conn, encodingTightZstd);
   encoders[encoderZRLE] = new ZRLEEncoder(conn);
 
   updates = 0;
   memset(&copyStats, 0, sizeof(copyStats));
+  memset(&stageStats, 0, sizeof(stageStats));
   stats.resize(encoderClassMax);
   for (iter = stats.begin();iter != stats.end();++iter) {
     StatsVector::value_type::iterator iter2;
@@ -152,6 +175,16 @@ EncodeManager::EncodeManager(SConnection* conn_)
     for (iter2 = iter->begin();iter2 != iter->end();++iter2)
       memset(&*iter2, 0, sizeof(EncoderStats));
   }
+
+  costs.resize(encoderClassMax);
+  for (citer = costs.begin();citer != costs.end();++citer) {
+    CostVector::value_type::iterator citer2;
+    citer->resize(encoderTypeMax);
+    for (citer2 = citer->begin();citer2 != citer->end();++citer2)
+      memset(&*citer2, 0, sizeof(EncoderCost));
+  }
+  candidates.resize(encoderTypeMax);
+  typeRects.resize(encoderTypeMax, 0);
 }
 
 EncodeManager::~EncodeManager()
@@ -240,6 +273,53 @@ void EncodeManager::logStats()
   vlog.info("         %s (1:%g ratio)", a, ratio);
 }
 
+void EncodeManager::getMetrics(Metrics* metrics, const char* connection,
+                               const char* client)
+{
+  size_t i, j;
+
+  const char* labels[] = { "connection", connection,
+                           "client", client, NULL };
+  const char* encLabels[] = { "connection", connection, "client", client,
+                              "encoder", NULL, "type", NULL, NULL };
+
+  metrics->describe("vnc_updates_total", "counter",
+                    "Framebuffer updates sent");
+  metrics->add("vnc_updates_total", labels, (unsigned long long)updates);
+
+  metrics->describe("vnc_encoder_rects_total", "counter",
+                    "Rectangles sent per encoder");
+  metrics->describe("vnc_encoder_pixels_total", "counter",
+                    "Pixels sent per encoder");
+  metrics->describe("vnc_encoder_bytes_total", "counter",
+                    "Bytes sent per encoder");
+
+  if (copyStats.rects != 0) {
+    encLabels[5] = "CopyRect";
+    encLabels[7] = "Copies";
+    metrics->add("vnc_encoder_rects_total", encLabels,
+                 (unsigned long long)copyStats.rects);
+    metrics->add("vnc_encoder_pixels_total", encLabels, copyStats.pixels);
+    metrics->add("vnc_encoder_bytes_total", encLabels, copyStats.bytes);
+  }
+
+  for (i = 0;i < stats.size();i++) {
+    for (j = 0;j < stats[i].size();j++) {
+      if (stats[i][j].rects == 0)
+        continue;
+
+      encLabels[5] = encoderClassName((EncoderClass)i);
+      encLabels[7] = encoderTypeName((EncoderType)j);
+      metrics->add("vnc_encoder_rects_total", encLabels,
+                   (unsigned long long)stats[i][j].rects);
+      metrics->add("vnc_encoder_pixels_total", encLabels,
+                   stats[i][j].pixels);
+      metrics->add("vnc_encoder_bytes_total", encLabels,
+                   stats[i][j].bytes);
+    }
+  }
+}
+
 bool EncodeManager::supported(int encoding)
 {
   switch (encoding) {
@@ -248,6 +328,9 @@ bool EncodeManager::supported(int encoding)
   case encodingHextile:
   case encodingZRLE:
   case encodingTight:
+#ifdef HAVE_ZSTD
+  case encodingTightZstd:
+#endif
     return true;
   default:
     return false;
@@ -277,6 +360,11 @@ void EncodeManager::pruneLosslessRefresh(const Region& limits)
   pendingRefreshRegion.assign_intersect(limits);
 }
 
+void EncodeManager::setBandwidth(size_t bandwidth_)
+{
+  bandwidth = bandwidth_;
+}
+
 void EncodeManager::writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                                 const RenderedCursor* renderedCursor)
 {
@@ -357,9 +445,23 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
      * We start by searching for solid rects, which are then removed
      * from the changed region.
      */
-    if (conn->client.supportsEncoding(pseudoEncodingLastRect))
+    if (conn->client.supportsEncoding(pseudoEncodingLastRect)) {
+      unsigned long long start, encoding;
+
+      start = encoding = 0;
+      if (stageTiming) {
+        start = os::Trace::now();
+        encoding = stageStats.encoding;
+      }
+
       writeSolidRects(&changed, pb);
 
+      // Don't count the time spent writing the found rects
+      if (stageTiming)
+        stageStats.solidSearch += os::Trace::now() - start -
+                                  (stageStats.encoding - encoding);
+    }
+
     writeRects(changed, pb);
     writeRects(cursorRegion, renderedCursor);
 
@@ -376,6 +478,8 @@ void EncodeManager::prepareEncoders(bool allowLossy)
   rdr::S32 preferred;
 
   std::vector<int>::iterator iter;
+  std::vector<int>::const_iterator citer;
+  int type;
 
   solid = bitmap = bitmapRLE = encoderRaw;
   indexed = indexedRLE = fullColour = encoderRaw;
@@ -398,6 +502,7 @@ void EncodeManager::prepareEncoders(bool allowLossy)
     bitmapRLE = indexedRLE = fullColour = encoderHextile;
     break;
   case encodingTight:
+  case encodingTightZstd:
     if (encoders[encoderTightJPEG]->isSupported() && allowJPEG)
       fullColour = encoderTightJPEG;
     else
@@ -468,21 +573,79 @@ void EncodeManager::prepareEncoders(bool allowLossy)
   activeEncoders[encoderFullColour] = fullColour;
 
   for (iter = activeEncoders.begin(); iter != activeEncoders.end(); ++iter) {
-    Encoder *encoder;
+    // Identical to Tight except for the compression, so always prefer
+    // it when the client can handle it
+    if ((*iter == encoderTight) &&
+        encoders[encoderTightZstd]->isSupported())
+      *iter = encoderTightZstd;
+  }
+
+  for (type = 0; type < encoderTypeMax; type++) {
+    candidates[type].clear();
+    candidates[type].push_back(activeEncoders[type]);
+  }
+
+  // Which of the lossless encoders is cheapest depends a lot on the
+  // content and on the client's connection, so measure them rather
+  // than trusting the rules above. Lossy encoders are never added, as
+  // the client might not want any loss. Where the rules picked JPEG,
+  // the content is left to it, as comparing it with lossless encoders
+  // would switch between lossy and lossless output rect by rect.
+  if (rfb::Server::adaptiveEncoding &&
+      !((conn->client.subsampling == subsampleGray) && allowLossy)) {
+    static const EncoderClass lossless[] = {
+      encoderTight, encoderZRLE, encoderHextile
+    };
+
+    for (type = 0; type < encoderTypeMax; type++) {
+      size_t i;
+
+      // Nothing to gain for a single colour
+      if (type == encoderSolid)
+        continue;
+
+      if (activeEncoders[type] == encoderTightJPEG)
+        continue;
 
-    encoder = encoders[*iter];
+      for (i = 0; i < sizeof(lossless) / sizeof(lossless[0]); i++) {
+        EncoderClass klass;
 
-    encoder->setCompressLevel(conn->client.compressLevel);
+        klass = lossless[i];
+        if ((klass == encoderTight) &&
+            encoders[encoderTightZstd]->isSupported())
+          klass = encoderTightZstd;
 
-    if (allowLossy) {
-      encoder->setQualityLevel(conn->client.qualityLevel);
-      encoder->setFineQualityLevel(conn->client.fineQualityLevel,
-                                   conn->client.subsampling);
-    } else {
-      int level = __rfbmax(conn->client.qualityLevel,
-                           encoder->losslessQuality);
-      encoder->setQualityLevel(level);
-      encoder->setFineQualityLevel(-1, subsampleUndefined);
+        if (!encoders[klass]->isSupported())
+          continue;
+
+        if (std::find(candidates[type].begin(), candidates[type].end(),
+                      klass) != candidates[type].end())
+          continue;
+
+        candidates[type].push_back(klass);
+      }
+    }
+  }
+
+  for (type = 0; type < encoderTypeMax; type++) {
+    for (citer = candidates[type].begin();
+         citer != candidates[type].end(); ++citer) {
+      Encoder *encoder;
+
+      encoder = encoders[*citer];
+
+      encoder->setCompressLevel(conn->client.compressLevel);
+
+      if (allowLossy) {
+        encoder->setQualityLevel(conn->client.qualityLevel);
+        encoder->setFineQualityLevel(conn->client.fineQualityLevel,
+                                     conn->client.subsampling);
+      } else {
+        int level = __rfbmax(conn->client.qualityLevel,
+                             encoder->losslessQuality);
+        encoder->setQualityLevel(level);
+        encoder->setFineQualityLevel(-1, subsampleUndefined);
+      }
     }
   }
 }
@@ -539,12 +702,10 @@ Region EncodeManager::getLosslessRefresh(const Region& req,
 int EncodeManager::computeNumRects(const Region& changed)
 {
   int numRects;
-  std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator rect;
+  Region::const_iterator rect;
 
   numRects = 0;
-  changed.get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+  for (rect = changed.begin(); rect != changed.end(); ++rect) {
     int w, h, sw, sh;
 
     w = rect->width();
@@ -571,12 +732,18 @@ int EncodeManager::computeNumRects(const Region& changed)
 }
 
 Encoder *EncodeManager::startRect(const Rect& rect, int type)
+{
+  return startRect(rect, type, activeEncoders[type]);
+}
+
+Encoder *EncodeManager::startRect(const Rect& rect, int type, int klass)
 {
   Encoder *encoder;
-  int klass, equiv;
+  int equiv;
 
   activeType = type;
-  klass = activeEncoders[activeType];
+  activeClass = klass;
+  activeArea = rect.area();
 
   beforeLength = conn->getOutStream()->length();
 
@@ -588,6 +755,8 @@ Encoder *EncodeManager::startRect(const Rect& rect, int type)
   encoder = encoders[klass];
   conn->writer()->startRect(rect, encoder->encoding);
 
+  rectStart = os::Trace::now();
+
   if ((encoder->flags & EncoderLossy) &&
       ((encoder->losslessQuality == -1) ||
        (encoder->getQualityLevel() < encoder->losslessQuality)))
@@ -606,13 +775,22 @@ void EncodeManager::endRect()
 {
   int klass;
   int length;
+  unsigned long long elapsed;
 
   conn->writer()->endRect();
 
   length = conn->getOutStream()->length() - beforeLength;
+  elapsed = os::Trace::now() - rectStart;
 
-  klass = activeEncoders[activeType];
+  klass = activeClass;
   stats[klass][activeType].bytes += length;
+
+  if (stageTiming) {
+    stats[klass][activeType].time += elapsed;
+    stageStats.encoding += elapsed;
+  }
+
+  updateCost(klass, activeType, activeArea, length, elapsed);
 }
 
 void EncodeManager::writeCopyRects(const Region& copied, const Point& delta)
@@ -758,11 +936,9 @@ void EncodeManager::findSolidRect(const Rect& rect, Region *changed,
 
 void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb)
 {
-  std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator rect;
+  Region::const_iterator rect;
 
-  changed.get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+  for (rect = changed.begin(); rect != changed.end(); ++rect) {
     int w, h, sw, sh;
     Rect sr;
 
@@ -809,6 +985,9 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
 
   bool useRLE;
   EncoderType type;
+  int klass;
+
+  unsigned long long start, now;
 
   // FIXME: This is roughly the algorithm previously used by the Tight
   //        encoder. It seems a bit backwards though, that higher
@@ -842,11 +1021,24 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
   if (maxColours > encoder->maxPaletteSize)
     maxColours = encoder->maxPaletteSize;
 
+  start = 0;
+  if (stageTiming)
+    start = os::Trace::now();
+
   ppb = preparePixelBuffer(rect, pb, true);
 
+  if (stageTiming) {
+    now = os::Trace::now();
+    stageStats.conversion += now - start;
+    start = now;
+  }
+
   if (!analyseRect(ppb, &info, maxColours))
     info.palette.clear();
 
+  if (stageTiming)
+    stageStats.analysis += os::Trace::now() - start;
+
   // Different encoders might have different RLE overhead, but
   // here we do a guess at RLE being the better choice if reduces
   // the pixel count by 50%.
@@ -872,16 +1064,104 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
       type = encoderIndexed;
   }
 
-  encoder = startRect(rect, type);
+  klass = selectEncoder(type, rect, info.palette);
+
+  encoder = startRect(rect, type, klass);
 
   if (encoder->flags & EncoderUseNativePF)
     ppb = preparePixelBuffer(rect, pb, false);
 
-  encoder->writeRect(ppb, info.palette);
+  {
+    TRACE_SPAN("Encoder::writeRect", encoderClassName(klass));
+    encoder->writeRect(ppb, info.palette);
+  }
 
   endRect();
 }
 
+int EncodeManager::selectEncoder(int type, const Rect& rect,
+                                 const Palette& palette)
+{
+  const std::vector<int>& klasses = candidates[type];
+  std::vector<int>::const_iterator iter;
+
+  int best;
+  double bestCost;
+
+  if ((klasses.size() <= 1) || (bandwidth == 0))
+    return activeEncoders[type];
+
+  typeRects[type]++;
+
+  // Measure the other encoders, but only on rects small enough that
+  // a bad choice doesn't hurt much
+  if (rect.area() <= EncoderProbeMaxArea) {
+    int klass;
+
+    for (iter = klasses.begin(); iter != klasses.end(); ++iter) {
+      if ((unsigned)palette.size() > encoders[*iter]->maxPaletteSize)
+        continue;
+      if (costs[*iter][type].samples < EncoderMinSamples)
+        return *iter;
+    }
+
+    if ((typeRects[type] % EncoderProbeInterval) == 0) {
+      klass = klasses[(typeRects[type] / EncoderProbeInterval) %
+                      klasses.size()];
+      if ((unsigned)palette.size() <= encoders[klass]->maxPaletteSize)
+        return klass;
+    }
+  }
+
+  // The cost is how long it takes until the client has the pixels,
+  // i.e. the time to encode them plus the time to send them
+  best = activeEncoders[type];
+  bestCost = -1;
+  for (iter = klasses.begin(); iter != klasses.end(); ++iter) {
+    const EncoderCost* cost;
+    double perPixel;
+
+    if ((unsigned)palette.size() > encoders[*iter]->maxPaletteSize)
+      continue;
+
+    cost = &costs[*iter][type];
+    if (cost->samples < EncoderMinSamples)
+      continue;
+
+    perPixel = (cost->time + cost->bytes * 1000000.0 / bandwidth) /
+               cost->pixels;
+    if ((bestCost < 0) || (perPixel < bestCost)) {
+      best = *iter;
+      bestCost = perPixel;
+    }
+  }
+
+  return best;
+}
+
+void EncodeManager::updateCost(int klass, int type, size_t pixels,
+                               size_t bytes, unsigned long long time)
+{
+  EncoderCost* cost;
+
+  if (pixels == 0)
+    return;
+
+  cost = &costs[klass][type];
+
+  if (cost->samples == 0) {
+    cost->pixels = pixels;
+    cost->bytes = bytes;
+    cost->time = time;
+  } else {
+    cost->pixels += (pixels - cost->pixels) * EncoderCostWeight;
+    cost->bytes += (bytes - cost->bytes) * EncoderCostWeight;
+    cost->time += (time - cost->time) * EncoderCostWeight;
+  }
+
+  cost->samples++;
+}
+
 bool EncodeManager::checkSolidTile(const Rect& r, const rdr::U8* colourValue,
                                    const PixelBuffer *pb)
 {
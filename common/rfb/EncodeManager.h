@@ -30,6 +30,8 @@
 namespace rfb {
   class SConnection;
   class Encoder;
+  class Metrics;
+  class Palette;
   class UpdateInfo;
   class PixelBuffer;
   class RenderedCursor;
@@ -43,15 +45,27 @@ namespace rfb {
     ~EncodeManager();
 
     void logStats();
+    // Adds the statistics to metrics, labelled with the client name
+    void getMetrics(Metrics* metrics, const char* connection,
+                    const char* client);
 
     // Hack to let ConnParams calculate the client's preferred encoding
     static bool supported(int encoding);
 
+    // Names of the indices used for the statistics
+    static const char* encoderClassName(int klass);
+    static const char* encoderTypeName(int type);
+
     bool needsLosslessRefresh(const Region& req);
     int getNextLosslessRefresh(const Region& req);
 
     void pruneLosslessRefresh(const Region& limits);
 
+    // Speed of the client's connection in bytes per second, or zero
+    // if unknown. Used to weigh size against CPU time when picking
+    // encoders.
+    void setBandwidth(size_t bandwidth);
+
     void writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                      const RenderedCursor* renderedCursor);
 
@@ -73,6 +87,7 @@ namespace rfb {
     int computeNumRects(const Region& changed);
 
     Encoder *startRect(const Rect& rect, int type);
+    Encoder *startRect(const Rect& rect, int type, int klass);
     void endRect();
 
     void writeCopyRects(const Region& copied, const Point& delta);
@@ -82,6 +97,10 @@ namespace rfb {
 
     void writeSubRect(const Rect& rect, const PixelBuffer *pb);
 
+    int selectEncoder(int type, const Rect& rect, const Palette& palette);
+    void updateCost(int klass, int type, size_t pixels, size_t bytes,
+                    unsigned long long time);
+
     bool checkSolidTile(const Rect& r, const rdr::U8* colourValue,
                         const PixelBuffer *pb);
     void extendSolidAreaByBlock(const Rect& r, const rdr::U8* colourValue,
@@ -132,6 +151,7 @@ namespace rfb {
       unsigned long long bytes;
       unsigned long long pixels;
       unsigned long long equivalent;
+      unsigned long long time;
     };
     typedef std::vector< std::vector<struct EncoderStats> > StatsVector;
 
@@ -139,8 +159,42 @@ namespace rfb {
     EncoderStats copyStats;
     StatsVector stats;
     int activeType;
+    int activeClass;
+    int activeArea;
     int beforeLength;
 
+    // Recent cost of each encoder for each type of content, as
+    // moving averages. Encoders other than the cheapest one are still
+    // tried now and then, so that the costs stay current.
+    struct EncoderCost {
+      unsigned samples;
+      double pixels;
+      double bytes;
+      double time;
+    };
+    typedef std::vector< std::vector<struct EncoderCost> > CostVector;
+
+    CostVector costs;
+    // Encoders that may be used for each type of content, the first
+    // one being the one picked by the fixed rules
+    std::vector< std::vector<int> > candidates;
+    std::vector<unsigned> typeRects;
+    size_t bandwidth;
+
+    // Time (in microseconds) spent in each stage of the encoding. Only
+    // collected, together with EncoderStats::time, if stageTiming is
+    // set as it is mostly of interest for benchmarks.
+    struct StageStats {
+      unsigned long long solidSearch;
+      unsigned long long conversion;
+      unsigned long long analysis;
+      unsigned long long encoding;
+    };
+
+    bool stageTiming;
+    StageStats stageStats;
+    unsigned long long rectStart;
+
     class OffsetPixelBuffer : public FullFramePixelBuffer {
     public:
       OffsetPixelBuffer() {}
@@ -0,0 +1,241 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- LogQueue.cxx - Background output of log messages
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <os/Mutex.h>
+
+#include <rfb/Logger.h>
+#include <rfb/LogQueue.h>
+#include <rfb/LogWriter.h>
+
+using namespace rfb;
+
+LogQueue* LogQueue::queue = NULL;
+
+// Guards the creation and destruction of the process wide queue, as
+// any thread might be the first to log something. Never freed, since
+// static destructors may log after atExit() has run. The pointer
+// itself is also accessed atomically, so that it can be checked
+// without the lock.
+static os::Mutex* queueMutex = new os::Mutex();
+
+// Copies a line into an entry, making it clear if it didn't fit
+static void copyText(char* dst, const char* src, size_t size)
+{
+  size_t len;
+
+  len = strlen(src);
+  if (len < size) {
+    memcpy(dst, src, len + 1);
+    return;
+  }
+
+  memcpy(dst, src, size - 4);
+  strcpy(dst + size - 4, "...");
+}
+
+LogQueue::LogQueue()
+  : stopRequested(false), head(0), tail(0), dropped(0), repeats(0)
+{
+  mutex = new os::Mutex();
+  notEmpty = new os::Condition(mutex);
+  drained = new os::Condition(mutex);
+
+  entries = new Entry[MaxEntries];
+
+  memset(&last, 0, sizeof(last));
+}
+
+LogQueue::~LogQueue()
+{
+  stop();
+  wait();
+
+  delete [] entries;
+
+  delete drained;
+  delete notEmpty;
+  delete mutex;
+}
+
+void LogQueue::write(Logger* logger, int level, const char* logname,
+                     const char* text)
+{
+  os::AutoMutex a(mutex);
+
+  // Lines that had to be cut short can't be compared reliably
+  if ((logger == last.logger) && (level == last.level) &&
+      (logname == last.logname) &&
+      (strlen(text) < MaxLength) && (strcmp(text, last.text) == 0)) {
+    repeats++;
+    return;
+  }
+
+  flushNotes();
+
+  if ((dropped != 0) || (tail - head >= MaxEntries)) {
+    dropped++;
+    return;
+  }
+
+  push(logger, level, logname, text);
+
+  last.logger = logger;
+  last.level = level;
+  last.logname = logname;
+  copyText(last.text, text, MaxLength);
+}
+
+void LogQueue::flush()
+{
+  os::AutoMutex a(mutex);
+
+  flushNotes();
+
+  while ((head != tail) && isRunning()) {
+    drained->wait();
+    flushNotes();
+  }
+}
+
+void LogQueue::stop()
+{
+  os::AutoMutex a(mutex);
+
+  flushNotes();
+
+  stopRequested = true;
+  notEmpty->signal();
+}
+
+LogQueue* LogQueue::getQueue()
+{
+  os::AutoMutex a(queueMutex);
+
+  if (queue == NULL) {
+    LogQueue* q;
+
+    q = new LogQueue();
+    q->start();
+    __atomic_store_n(&queue, q, __ATOMIC_RELEASE);
+    // Registered after all static loggers have been constructed, so
+    // this will run before they are destroyed
+    atexit(atExit);
+  }
+
+  return queue;
+}
+
+LogQueue* LogQueue::peekQueue()
+{
+  return __atomic_load_n(&queue, __ATOMIC_ACQUIRE);
+}
+
+void LogQueue::worker()
+{
+  unsigned end;
+
+  mutex->lock();
+
+  while (true) {
+    while ((head == tail) && !stopRequested)
+      notEmpty->wait();
+
+    if (head == tail)
+      break;
+
+    // Producers never touch entries between head and tail, so the
+    // actual output can be done without holding the lock
+    end = tail;
+
+    mutex->unlock();
+
+    for (unsigned i = head; i != end; i++) {
+      Entry* entry = &entries[i % MaxEntries];
+      entry->logger->write(entry->level, entry->logname, entry->text);
+    }
+
+    mutex->lock();
+
+    head = end;
+    drained->broadcast();
+  }
+
+  drained->broadcast();
+
+  mutex->unlock();
+}
+
+void LogQueue::push(Logger* logger, int level, const char* logname,
+                    const char* text)
+{
+  Entry* entry;
+
+  entry = &entries[tail % MaxEntries];
+
+  entry->logger = logger;
+  entry->level = level;
+  entry->logname = logname;
+  copyText(entry->text, text, MaxLength);
+
+  tail++;
+
+  notEmpty->signal();
+}
+
+void LogQueue::flushNotes()
+{
+  char buf[64];
+
+  if (repeats != 0) {
+    if (tail - head >= MaxEntries) {
+      dropped++;
+    } else {
+      snprintf(buf, sizeof(buf), "Last message repeated %u times",
+               repeats);
+      push(last.logger, last.level, last.logname, buf);
+    }
+    repeats = 0;
+  }
+
+  if (dropped != 0) {
+    if (tail - head >= MaxEntries)
+      return;
+
+    snprintf(buf, sizeof(buf), "%u log messages dropped", dropped);
+    push(last.logger, LogWriter::LEVEL_ERROR, last.logname, buf);
+    dropped = 0;
+  }
+}
+
+void LogQueue::atExit()
+{
+  LogQueue* q;
+
+  queueMutex->lock();
+  q = queue;
+  __atomic_store_n(&queue, (LogQueue*)NULL, __ATOMIC_RELEASE);
+  queueMutex->unlock();
+
+  delete q;
+}
@@ -0,0 +1,107 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- LogQueue.h - Background output of log messages
+//
+// Moves the actual output of log messages (file and console I/O,
+// syslog calls) to a separate thread so that the threads producing
+// the messages only pay for the formatting. Memory usage is bounded
+// by a fixed number of entries, and consecutive duplicate messages
+// are collapsed.
+
+#ifndef __RFB_LOGQUEUE_H__
+#define __RFB_LOGQUEUE_H__
+
+#include <os/Thread.h>
+
+namespace os {
+  class Mutex;
+  class Condition;
+}
+
+namespace rfb {
+
+  class Logger;
+
+  class LogQueue : public os::Thread {
+  public:
+    LogQueue();
+    virtual ~LogQueue();
+
+    // Queues a single line of text. The log name must remain valid
+    // for the lifetime of the process. The message is dropped if the
+    // queue is full.
+    void write(Logger* logger, int level, const char* logname,
+               const char* text);
+
+    // Blocks until everything queued so far has been written
+    void flush();
+
+    void stop();
+
+    // Returns the process wide queue, starting it if needed. Safe to
+    // call from any thread.
+    static LogQueue* getQueue();
+    // Returns the process wide queue if it has been started. Doesn't
+    // lock, so it is cheap enough to call for every message.
+    static LogQueue* peekQueue();
+
+  protected:
+    virtual void worker();
+
+  private:
+    void push(Logger* logger, int level, const char* logname,
+              const char* text);
+    // Queues notes about collapsed or dropped messages, if possible
+    void flushNotes();
+
+    static void atExit();
+
+  private:
+    static const unsigned MaxEntries = 2048;
+    // Longer lines are cut short, ending with "..."
+    static const unsigned MaxLength = 256;
+
+    struct Entry {
+      Logger* logger;
+      int level;
+      const char* logname;
+      char text[MaxLength];
+    };
+
+    os::Mutex* mutex;
+    os::Condition* notEmpty;
+    os::Condition* drained;
+
+    bool stopRequested;
+
+    Entry* entries;
+    // Only the worker moves head, and only producers move tail
+    unsigned head, tail;
+
+    unsigned dropped;
+
+    Entry last;
+    unsigned repeats;
+
+    static LogQueue* queue;
+  };
+
+};
+
+#endif
@@ -22,12 +22,19 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <rfb/Configuration.h>
 #include <rfb/Logger.h>
+#include <rfb/LogQueue.h>
 #include <rfb/LogWriter.h>
 #include <rfb/util.h>
 
 using namespace rfb;
 
+static BoolParameter asyncLog("AsyncLog",
+                              "Write log messages from a background thread "
+                              "rather than the thread generating them",
+                              false);
+
 Logger* Logger::loggers = 0;
 
 Logger::Logger(const char* name) : registered(false), m_name(name), m_next(0) {
@@ -48,11 +55,25 @@ void Logger::write(int level, const char *logname, const char* format,
   vsnprintf(buf1, sizeof(buf1)-1, format, ap);
   buf1[sizeof(buf1)-1] = 0;
   char *buf = buf1;
+
+  // Messages must not overtake the ones already queued
+  LogQueue *queue = NULL;
+  if (asyncLog) {
+    queue = LogQueue::getQueue();
+  } else {
+    LogQueue *pending = LogQueue::peekQueue();
+    if (pending)
+      pending->flush();
+  }
+
   while (true) {
     char *end = strchr(buf, '\n');
     if (end)
       *end = '\0';
-    write(level, logname, buf);
+    if (queue)
+      queue->write(this, level, logname, buf);
+    else
+      write(level, logname, buf);
     if (!end)
       break;
     buf = end + 1;
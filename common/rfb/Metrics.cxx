@@ -0,0 +1,124 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+
+#include <rfb/Metrics.h>
+
+using namespace rfb;
+
+Metrics::Metrics()
+{
+}
+
+Metrics::~Metrics()
+{
+}
+
+void Metrics::describe(const char* name, const char* type,
+                       const char* help)
+{
+  Family* family;
+
+  if (families.find(name) == families.end())
+    names.push_back(name);
+
+  family = &families[name];
+  if (family->type.empty()) {
+    family->type = type;
+    family->help = help;
+  }
+}
+
+void Metrics::add(const char* name, const char** labels,
+                  unsigned long long value)
+{
+  char buf[32];
+
+  snprintf(buf, sizeof(buf), "%llu", value);
+  addSample(name, labels, buf);
+}
+
+void Metrics::add(const char* name, const char** labels, double value)
+{
+  char buf[32];
+
+  snprintf(buf, sizeof(buf), "%.6g", value);
+  addSample(name, labels, buf);
+}
+
+const char* Metrics::str()
+{
+  std::vector<std::string>::const_iterator iter;
+
+  text.clear();
+
+  for (iter = names.begin(); iter != names.end(); ++iter) {
+    const Family& family = families[*iter];
+
+    if (!family.help.empty())
+      text += "# HELP " + *iter + " " + family.help + "\n";
+    if (!family.type.empty())
+      text += "# TYPE " + *iter + " " + family.type + "\n";
+    text += family.samples;
+  }
+
+  return text.c_str();
+}
+
+void Metrics::addSample(const char* name, const char** labels,
+                        const char* value)
+{
+  std::string* samples;
+
+  if (families.find(name) == families.end())
+    names.push_back(name);
+
+  samples = &families[name].samples;
+
+  *samples += name;
+
+  if ((labels != NULL) && (labels[0] != NULL)) {
+    *samples += "{";
+    for (int i = 0; labels[i] != NULL && labels[i+1] != NULL; i += 2) {
+      const char* c;
+
+      if (i != 0)
+        *samples += ",";
+      *samples += labels[i];
+      *samples += "=\"";
+      // Label values may come from the network, e.g. peer names
+      for (c = labels[i+1]; *c != '\0'; c++) {
+        if (*c == '\\')
+          *samples += "\\\\";
+        else if (*c == '"')
+          *samples += "\\\"";
+        else if (*c == '\n')
+          *samples += "\\n";
+        else
+          *samples += *c;
+      }
+      *samples += "\"";
+    }
+    *samples += "}";
+  }
+
+  *samples += " ";
+  *samples += value;
+  *samples += "\n";
+}
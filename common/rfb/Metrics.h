@@ -0,0 +1,69 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- Metrics.h - Collection of counters in Prometheus text format
+//
+// Samples can be added in any order, e.g. one client at a time. They
+// are grouped by metric name when the text is generated, as required
+// by the format.
+
+#ifndef __RFB_METRICS_H__
+#define __RFB_METRICS_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace rfb {
+
+  class Metrics {
+  public:
+    Metrics();
+    ~Metrics();
+
+    // Declares the type ("counter" or "gauge") and help text of a
+    // metric. Only the first declaration of each name is used.
+    void describe(const char* name, const char* type, const char* help);
+
+    // Adds a sample. Labels are given as name/value pairs, e.g.
+    // { "client", "10.0.0.1::5900", NULL }, and may be NULL.
+    void add(const char* name, const char** labels,
+             unsigned long long value);
+    void add(const char* name, const char** labels, double value);
+
+    // Returns the complete text, valid until the object is changed
+    const char* str();
+
+  private:
+    void addSample(const char* name, const char** labels,
+                   const char* value);
+
+    struct Family {
+      std::string type;
+      std::string help;
+      std::string samples;
+    };
+
+    std::vector<std::string> names;
+    std::map<std::string, Family> families;
+    std::string text;
+  };
+
+}
+
+#endif
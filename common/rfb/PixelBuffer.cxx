@@ -404,7 +404,9 @@ void ManagedPixelBuffer::setSize(int w, int h)
   unsigned long new_datasize = w * h * (format.bpp/8);
 
   new_datasize = w * h * (format.bpp/8);
-  if (datasize < new_datasize) {
+  // An empty buffer gives back its memory, but otherwise it is kept
+  // around to avoid reallocations
+  if ((datasize < new_datasize) || (new_datasize == 0)) {
     if (data_) {
       delete [] data_;
       data_ = NULL;
@@ -26,83 +26,88 @@ extern "C" {
 
 static rfb::LogWriter vlog("Region");
 
+// pixman wants non-const pointers even for functions that only read
+// the region, so this casts away the const
+pixman_region16* rfb::Region::region() const {
+  // Fails to compile if the storage doesn't fit a pixman_region16
+  typedef char storageCheck[(sizeof(rgn) == sizeof(pixman_region16)) ? 1 : -1];
+  (void)sizeof(storageCheck);
+  return (pixman_region16*)&rgn;
+}
+
 rfb::Region::Region() {
-  rgn = new struct pixman_region16;
-  pixman_region_init(rgn);
+  pixman_region_init(region());
 }
 
 rfb::Region::Region(const Rect& r) {
-  rgn = new struct pixman_region16;
-  pixman_region_init_rect(rgn, r.tl.x, r.tl.y, r.width(), r.height());
+  pixman_region_init_rect(region(), r.tl.x, r.tl.y, r.width(), r.height());
 }
 
 rfb::Region::Region(const rfb::Region& r) {
-  rgn = new struct pixman_region16;
-  pixman_region_init(rgn);
-  pixman_region_copy(rgn, r.rgn);
+  pixman_region_init(region());
+  pixman_region_copy(region(), r.region());
 }
 
 rfb::Region::~Region() {
-  pixman_region_fini(rgn);
-  delete rgn;
+  pixman_region_fini(region());
 }
 
 rfb::Region& rfb::Region::operator=(const rfb::Region& r) {
-  pixman_region_copy(rgn, r.rgn);
+  pixman_region_copy(region(), r.region());
   return *this;
 }
 
 void rfb::Region::clear() {
   // pixman_region_clear() isn't available on some older systems
-  pixman_region_fini(rgn);
-  pixman_region_init(rgn);
+  pixman_region_fini(region());
+  pixman_region_init(region());
 }
 
 void rfb::Region::reset(const Rect& r) {
-  pixman_region_fini(rgn);
-  pixman_region_init_rect(rgn, r.tl.x, r.tl.y, r.width(), r.height());
+  pixman_region_fini(region());
+  pixman_region_init_rect(region(), r.tl.x, r.tl.y, r.width(), r.height());
 }
 
 void rfb::Region::translate(const Point& delta) {
-  pixman_region_translate(rgn, delta.x, delta.y);
+  pixman_region_translate(region(), delta.x, delta.y);
 }
 
 void rfb::Region::assign_intersect(const rfb::Region& r) {
-  pixman_region_intersect(rgn, rgn, r.rgn);
+  pixman_region_intersect(region(), region(), r.region());
 }
 
 void rfb::Region::assign_union(const rfb::Region& r) {
-  pixman_region_union(rgn, rgn, r.rgn);
+  pixman_region_union(region(), region(), r.region());
 }
 
 void rfb::Region::assign_subtract(const rfb::Region& r) {
-  pixman_region_subtract(rgn, rgn, r.rgn);
+  pixman_region_subtract(region(), region(), r.region());
 }
 
 rfb::Region rfb::Region::intersect(const rfb::Region& r) const {
   rfb::Region ret;
-  pixman_region_intersect(ret.rgn, rgn, r.rgn);
+  pixman_region_intersect(ret.region(), region(), r.region());
   return ret;
 }
 
 rfb::Region rfb::Region::union_(const rfb::Region& r) const {
   rfb::Region ret;
-  pixman_region_union(ret.rgn, rgn, r.rgn);
+  pixman_region_union(ret.region(), region(), r.region());
   return ret;
 }
 
 rfb::Region rfb::Region::subtract(const rfb::Region& r) const {
   rfb::Region ret;
-  pixman_region_subtract(ret.rgn, rgn, r.rgn);
+  pixman_region_subtract(ret.region(), region(), r.region());
   return ret;
 }
 
 bool rfb::Region::equals(const rfb::Region& r) const {
-  return pixman_region_equal(rgn, r.rgn);
+  return pixman_region_equal(region(), r.region());
 }
 
 int rfb::Region::numRects() const {
-  return pixman_region_n_rects(rgn);
+  return pixman_region_n_rects(region());
 }
 
 bool rfb::Region::get_rects(std::vector<Rect>* rects,
@@ -112,7 +117,7 @@ bool rfb::Region::get_rects(std::vector<Rect>* rects,
   const pixman_box16_t* boxes;
   int xInc, yInc, i;
 
-  boxes = pixman_region_rectangles(rgn, &nRects);
+  boxes = pixman_region_rectangles(region(), &nRects);
 
   rects->clear();
   rects->reserve(nRects);
@@ -148,9 +153,25 @@ bool rfb::Region::get_rects(std::vector<Rect>* rects,
   return !rects->empty();
 }
 
+rfb::Region::const_iterator rfb::Region::begin() const {
+  const pixman_box16_t* boxes;
+  int nRects;
+
+  boxes = pixman_region_rectangles(region(), &nRects);
+  return const_iterator((const short*)boxes);
+}
+
+rfb::Region::const_iterator rfb::Region::end() const {
+  const pixman_box16_t* boxes;
+  int nRects;
+
+  boxes = pixman_region_rectangles(region(), &nRects);
+  return const_iterator((const short*)(boxes + nRects));
+}
+
 rfb::Rect rfb::Region::get_bounding_rect() const {
   const pixman_box16_t* extents;
-  extents = pixman_region_extents(rgn);
+  extents = pixman_region_extents(region());
   return Rect(extents->x1, extents->y1, extents->x2, extents->y2);
 }
 
@@ -31,6 +31,33 @@ namespace rfb {
 
   class Region {
   public:
+    // Iterates over the rects of a region without copying them, in
+    // the same order as get_rects() with the default arguments. Any
+    // change to the region invalidates the iterator.
+    class const_iterator {
+    public:
+      const_iterator() : box(0) {}
+
+      const Rect& operator*() const {
+        rect.setXYWH(box[0], box[1], box[2] - box[0], box[3] - box[1]);
+        return rect;
+      }
+      const Rect* operator->() const { return &**this; }
+
+      const_iterator& operator++() { box += 4; return *this; }
+
+      bool operator==(const const_iterator& i) const { return box == i.box; }
+      bool operator!=(const const_iterator& i) const { return box != i.box; }
+
+    private:
+      friend class Region;
+      const_iterator(const short* box_) : box(box_) {}
+
+      // Points into pixman's array of boxes (x1, y1, x2, y2)
+      const short* box;
+      mutable Rect rect;
+    };
+
     // Create an empty region
     Region();
     // Create a rectangular region
@@ -63,13 +90,24 @@ namespace rfb {
 
     bool get_rects(std::vector<Rect>* rects, bool left2right=true,
                    bool topdown=true) const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
     Rect get_bounding_rect() const;
 
     void debug_print(const char *prefix) const;
 
   protected:
+    struct pixman_region16* region() const;
 
-    struct pixman_region16* rgn;
+  protected:
+    // Space for a pixman_region16, which is kept here rather than on
+    // the heap. An empty region or a single rect then needs no
+    // allocations at all, as pixman only allocates for more rects.
+    struct {
+      short extents[4];
+      void* data;
+    } rgn;
   };
 
 };
@@ -0,0 +1,254 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <assert.h>
+
+#include <os/Trace.h>
+#include <rfb/ScaledPixelBuffer.h>
+
+using namespace rfb;
+
+// Scaling is done in bands of this many rows, to keep the temporary
+// buffer small
+static const int bandHeight = 16;
+
+ScaledPixelBuffer::ScaledPixelBuffer(const PixelBuffer* src_,
+                                     int width, int height,
+                                     unsigned int filter)
+  : ManagedPixelBuffer(src_->getPF(), width, height), src(src_),
+    xWeights(NULL), yWeights(NULL), tmp(NULL), tmpSize(0)
+{
+  ScaleFilters filters;
+
+  assert(supportsFormat(src->getPF()));
+
+  filters.makeWeightTabs(filter, src->width(), width, &xWeights);
+  filters.makeWeightTabs(filter, src->height(), height, &yWeights);
+}
+
+ScaledPixelBuffer::~ScaledPixelBuffer()
+{
+  int i;
+
+  for (i = 0; i < width(); i++)
+    delete [] xWeights[i].weight;
+  delete [] xWeights;
+
+  for (i = 0; i < height(); i++)
+    delete [] yWeights[i].weight;
+  delete [] yWeights;
+
+  delete [] tmp;
+}
+
+bool ScaledPixelBuffer::supportsFormat(const PixelFormat& pf)
+{
+  // Every byte can then be filtered on its own
+  return pf.is888();
+}
+
+Region ScaledPixelBuffer::update(const Region& changed)
+{
+  Region affected;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+
+  TRACE_SPAN("ScaledPixelBuffer::update");
+
+  // Nearby source rectangles often affect the same pixels here, so
+  // work out the whole area first to only calculate each pixel once
+  affected = scaleRegion(changed);
+
+  affected.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    scaleArea(*i);
+
+  return affected;
+}
+
+Region ScaledPixelBuffer::scaleRegion(const Region& region) const
+{
+  Region scaled;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+
+  region.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++)
+    scaled.assign_union(scaleRect(*i));
+
+  return scaled;
+}
+
+// Finds the range of positions [first, last) whose filter interval
+// overlaps [lo, hi) in the source. The intervals never move backwards,
+// so a binary search can be used.
+static void findRange(const SFilterWeightTab* tabs, int count,
+                      int lo, int hi, int* first, int* last)
+{
+  int a, b, m;
+
+  a = 0;
+  b = count;
+  while (a < b) {
+    m = (a + b) / 2;
+    if (tabs[m].i1 > lo)
+      b = m;
+    else
+      a = m + 1;
+  }
+  *first = a;
+
+  b = count;
+  while (a < b) {
+    m = (a + b) / 2;
+    if (tabs[m].i0 >= hi)
+      b = m;
+    else
+      a = m + 1;
+  }
+  *last = a;
+}
+
+Rect ScaledPixelBuffer::scaleRect(const Rect& r) const
+{
+  Rect scaled;
+
+  if (r.is_empty())
+    return Rect();
+
+  findRange(xWeights, width(), r.tl.x, r.br.x, &scaled.tl.x, &scaled.br.x);
+  findRange(yWeights, height(), r.tl.y, r.br.y, &scaled.tl.y, &scaled.br.y);
+
+  if (scaled.is_empty())
+    return Rect();
+
+  return scaled;
+}
+
+Point ScaledPixelBuffer::scalePoint(const Point& p) const
+{
+  return Point(p.x * width() / src->width(),
+               p.y * height() / src->height());
+}
+
+Point ScaledPixelBuffer::unscalePoint(const Point& p) const
+{
+  // Use the middle of the area the pixel covers
+  return Point((2 * p.x + 1) * src->width() / (2 * width()),
+               (2 * p.y + 1) * src->height() / (2 * height()));
+}
+
+void ScaledPixelBuffer::scaleArea(const Rect& r)
+{
+  int lanes;
+  int y;
+
+  // Each byte of a pixel is filtered separately, so the inner loops
+  // simply run over bytes which lets the compiler vectorise them
+  lanes = r.width() * 4;
+
+  for (y = r.tl.y; y < r.br.y; y += bandHeight) {
+    Rect band, srcRect;
+    const rdr::U8* srcData;
+    rdr::U8* dstData;
+    int srcStride, dstStride;
+    int* acc;
+    size_t needed;
+    int sy, dy, x, i;
+
+    band.setXYWH(r.tl.x, y, r.width(), __rfbmin(bandHeight, r.br.y - y));
+
+    srcRect = Rect(xWeights[band.tl.x].i0, yWeights[band.tl.y].i0,
+                   xWeights[band.br.x - 1].i1, yWeights[band.br.y - 1].i1);
+
+    // Filtered rows plus one for the accumulator
+    needed = (size_t)(srcRect.height() + 1) * lanes;
+    if (needed > tmpSize) {
+      delete [] tmp;
+      tmp = new int[needed];
+      tmpSize = needed;
+    }
+    acc = tmp + (size_t)srcRect.height() * lanes;
+
+    // Horizontal pass, keeping BITS_OF_WEIGHT - BITS_OF_CHANEL bits
+    // of fraction
+    srcData = src->getBuffer(srcRect, &srcStride);
+    for (sy = 0; sy < srcRect.height(); sy++) {
+      const rdr::U8* row;
+      int* out;
+
+      row = srcData + sy * srcStride * 4;
+      out = tmp + sy * lanes;
+
+      for (x = band.tl.x; x < band.br.x; x++) {
+        const SFilterWeightTab* tab;
+        const rdr::U8* in;
+        int c0, c1, c2, c3;
+
+        tab = &xWeights[x];
+        in = row + (tab->i0 - srcRect.tl.x) * 4;
+
+        c0 = c1 = c2 = c3 = 0;
+        for (i = 0; i < tab->i1 - tab->i0; i++) {
+          int w = tab->weight[i];
+          c0 += w * in[0];
+          c1 += w * in[1];
+          c2 += w * in[2];
+          c3 += w * in[3];
+          in += 4;
+        }
+
+        out[0] = (c0 + (1 << (BITS_OF_CHANEL - 1))) >> BITS_OF_CHANEL;
+        out[1] = (c1 + (1 << (BITS_OF_CHANEL - 1))) >> BITS_OF_CHANEL;
+        out[2] = (c2 + (1 << (BITS_OF_CHANEL - 1))) >> BITS_OF_CHANEL;
+        out[3] = (c3 + (1 << (BITS_OF_CHANEL - 1))) >> BITS_OF_CHANEL;
+        out += 4;
+      }
+    }
+
+    // Vertical pass, one whole row at a time
+    dstData = getBufferRW(band, &dstStride);
+    for (dy = band.tl.y; dy < band.br.y; dy++) {
+      const SFilterWeightTab* tab;
+      rdr::U8* out;
+
+      tab = &yWeights[dy];
+
+      for (x = 0; x < lanes; x++)
+        acc[x] = 1 << (FINALSHIFT - 1);
+
+      for (i = 0; i < tab->i1 - tab->i0; i++) {
+        const int* in;
+        int w;
+
+        in = tmp + (tab->i0 - srcRect.tl.y + i) * lanes;
+        w = tab->weight[i];
+
+        for (x = 0; x < lanes; x++)
+          acc[x] += w * in[x];
+      }
+
+      out = dstData + (dy - band.tl.y) * dstStride * 4;
+      for (x = 0; x < lanes; x++) {
+        int c = acc[x] >> FINALSHIFT;
+        out[x] = c < 0 ? 0 : (c > 255 ? 255 : c);
+      }
+    }
+    commitBufferRW(band);
+  }
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- ScaledPixelBuffer.h
+//
+// A smaller copy of another pixel buffer. Only the parts that depend
+// on areas of the source that have changed are recalculated.
+
+#ifndef __RFB_SCALEDPIXELBUFFER_H__
+#define __RFB_SCALEDPIXELBUFFER_H__
+
+#include <rfb/PixelBuffer.h>
+#include <rfb/Region.h>
+#include <rfb/ScaleFilters.h>
+
+namespace rfb {
+
+  class ScaledPixelBuffer : public ManagedPixelBuffer {
+  public:
+    // The contents are undefined until update() has been called
+    ScaledPixelBuffer(const PixelBuffer* src, int width, int height,
+                      unsigned int filter=defaultScaleFilter);
+    virtual ~ScaledPixelBuffer();
+
+    // Only formats with 8 bits per channel can be scaled
+    static bool supportsFormat(const PixelFormat& pf);
+
+    // Recalculates everything that depends on the given region of the
+    // source, and returns the affected region of this buffer
+    Region update(const Region& changed);
+
+    // Returns the region of this buffer that depends on the given
+    // region of the source
+    Region scaleRegion(const Region& region) const;
+    Rect scaleRect(const Rect& r) const;
+
+    // Maps between positions in the source and this buffer
+    Point scalePoint(const Point& p) const;
+    Point unscalePoint(const Point& p) const;
+
+  private:
+    void scaleArea(const Rect& r);
+
+    const PixelBuffer* src;
+
+    SFilterWeightTab* xWeights;
+    SFilterWeightTab* yWeights;
+
+    // Horizontally filtered source rows, reused between calls
+    int* tmp;
+    size_t tmpSize;
+  };
+
+};
+
+#endif
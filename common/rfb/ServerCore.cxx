@@ -42,6 +42,11 @@ rfb::IntParameter rfb::Server::maxIdleTime
 ("MaxIdleTime",
  "Terminate after s seconds of user inactivity", 
  0, 0);
+rfb::IntParameter rfb::Server::reclaimTime
+("ReclaimTime",
+ "Release memory only needed when clients are connected after s seconds "
+ "without any clients (zero means never)",
+ 60, 0);
 rfb::IntParameter rfb::Server::compareFB
 ("CompareFB",
  "Perform pixel comparison on framebuffer to reduce unnecessary updates "
@@ -51,6 +56,25 @@ rfb::IntParameter rfb::Server::frameRate
 ("FrameRate",
  "The maximum number of updates per second sent to each client",
  60);
+rfb::IntParameter rfb::Server::maxViewWidth
+("MaxViewWidth",
+ "Scale down the screen sent to clients to at most this width "
+ "(zero means no limit)",
+ 0, 0);
+rfb::IntParameter rfb::Server::maxViewHeight
+("MaxViewHeight",
+ "Scale down the screen sent to clients to at most this height "
+ "(zero means no limit)",
+ 0, 0);
+rfb::BoolParameter rfb::Server::prioritizeInput
+("PrioritizeInput",
+ "Send changes near the pointer and text cursor first when the "
+ "connection cannot keep up",
+ false);
+rfb::BoolParameter rfb::Server::adaptiveEncoding
+("AdaptiveEncoding",
+ "Pick encoders based on their measured size and speed for each client",
+ false);
 rfb::BoolParameter rfb::Server::protocol3_3
 ("Protocol3.3",
  "Always use protocol version 3.3 for backwards compatibility with "
@@ -96,3 +120,13 @@ rfb::BoolParameter rfb::Server::queryConnect
 ("QueryConnect",
  "Prompt the local user to accept or reject incoming connections.",
  false);
+rfb::StringParameter rfb::Server::traceFile
+("TraceFile",
+ "Write timing of internal operations to this file in Chrome's trace "
+ "event format (requires a build with ENABLE_TRACING)",
+ "");
+rfb::StringParameter rfb::Server::recordSession
+("RecordSession",
+ "Record the updates sent to the first connected client to this file, "
+ "%p is replaced by the process id",
+ "");
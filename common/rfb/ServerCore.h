@@ -36,8 +36,13 @@ namespace rfb {
     static IntParameter maxDisconnectionTime;
     static IntParameter maxConnectionTime;
     static IntParameter maxIdleTime;
+    static IntParameter reclaimTime;
     static IntParameter compareFB;
     static IntParameter frameRate;
+    static IntParameter maxViewWidth;
+    static IntParameter maxViewHeight;
+    static BoolParameter prioritizeInput;
+    static BoolParameter adaptiveEncoding;
     static BoolParameter protocol3_3;
     static BoolParameter alwaysShared;
     static BoolParameter neverShared;
@@ -48,6 +53,8 @@ namespace rfb {
     static BoolParameter sendCutText;
     static BoolParameter acceptSetDesktopSize;
     static BoolParameter queryConnect;
+    static StringParameter traceFile;
+    static StringParameter recordSession;
 
   };
 
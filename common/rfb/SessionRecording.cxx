@@ -0,0 +1,337 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SessionRecording.cxx - Recording and playback of a client's updates
+
+#include <errno.h>
+#include <string.h>
+
+#include <os/Mutex.h>
+
+#include <rdr/Exception.h>
+#include <rdr/FileInStream.h>
+#include <rdr/MemOutStream.h>
+
+#include <rfb/LogWriter.h>
+#include <rfb/PixelFormat.h>
+#include <rfb/SessionRecording.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+static LogWriter vlog("SessionRecording");
+
+static const char signature[8] = { 'T', 'V', 'N', 'C', 'S', 'E', 'S', '\n' };
+static const rdr::U32 version = 1;
+
+//
+// SessionRecorder
+//
+
+SessionRecorder::SessionRecorder(const char* filename)
+  : stopRequested(false), discarding(false)
+{
+  file = fopen(filename, "wb");
+  if (file == NULL)
+    throw rdr::SystemException("fopen", errno);
+
+  gettimeofday(&startTime, NULL);
+
+  mutex = new os::Mutex();
+  notEmpty = new os::Condition(mutex);
+
+  pending = new rdr::MemOutStream();
+  writing = new rdr::MemOutStream();
+
+  pending->writeBytes(signature, sizeof(signature));
+  pending->writeU32(version);
+
+  start();
+}
+
+SessionRecorder::~SessionRecorder()
+{
+  mutex->lock();
+  stopRequested = true;
+  notEmpty->signal();
+  mutex->unlock();
+
+  wait();
+
+  fclose(file);
+
+  delete writing;
+  delete pending;
+
+  delete notEmpty;
+  delete mutex;
+}
+
+void SessionRecorder::startStream()
+{
+  os::AutoMutex a(mutex);
+
+  discarding = false;
+  addRecord(sessionRecordStream, NULL, 0);
+}
+
+void SessionRecorder::writePixelFormat(const PixelFormat& pf)
+{
+  rdr::MemOutStream payload(16);
+
+  pf.write(&payload);
+
+  os::AutoMutex a(mutex);
+  addRecord(sessionRecordPixelFormat, payload.data(), payload.length());
+}
+
+void SessionRecorder::writeData(const void* data, size_t length)
+{
+  os::AutoMutex a(mutex);
+  addRecord(sessionRecordData, data, length);
+}
+
+void SessionRecorder::worker()
+{
+  rdr::MemOutStream* tmp;
+  bool failed;
+
+  failed = false;
+
+  mutex->lock();
+
+  while (true) {
+    if (pending->length() == 0) {
+      if (stopRequested)
+        break;
+      notEmpty->wait();
+      continue;
+    }
+
+    tmp = writing;
+    writing = pending;
+    pending = tmp;
+
+    mutex->unlock();
+
+    if (!failed) {
+      if ((fwrite(writing->data(), writing->length(), 1, file) != 1) ||
+          (fflush(file) != 0)) {
+        vlog.error("Failed to write session recording: %s",
+                   strerror(errno));
+        failed = true;
+      }
+    }
+
+    writing->clear();
+
+    mutex->lock();
+  }
+
+  mutex->unlock();
+}
+
+void SessionRecorder::addRecord(int type, const void* data,
+                                size_t length)
+{
+  if (discarding)
+    return;
+
+  if (pending->length() + length > MaxPending) {
+    vlog.error("Session recording is falling behind, dropping the rest "
+               "of the current stream");
+    discarding = true;
+    return;
+  }
+
+  pending->writeU8(type);
+  pending->writeU32(msSince(&startTime));
+  pending->writeU32(length);
+  if (length != 0)
+    pending->writeBytes(data, length);
+
+  notEmpty->signal();
+}
+
+//
+// RecordingOutStream
+//
+
+RecordingOutStream::RecordingOutStream(rdr::OutStream* out_,
+                                       SessionRecorder* recorder_)
+  : out(out_), recorder(recorder_)
+{
+}
+
+RecordingOutStream::~RecordingOutStream()
+{
+}
+
+void RecordingOutStream::cork(bool enable)
+{
+  BufferedOutStream::cork(enable);
+  out->cork(enable);
+}
+
+void RecordingOutStream::writePixelFormat(const PixelFormat& pf)
+{
+  flush();
+  recorder->writePixelFormat(pf);
+}
+
+bool RecordingOutStream::flushBuffer()
+{
+  size_t len;
+
+  len = ptr - sentUpTo;
+
+  recorder->writeData(sentUpTo, len);
+
+  // The real stream does its own buffering, so everything can be
+  // handed over right away
+  out->writeBytes(sentUpTo, len);
+  out->flush();
+
+  sentUpTo = ptr;
+
+  return true;
+}
+
+//
+// SessionPlayer
+//
+
+SessionPlayer::SessionPlayer(const char* filename)
+  : type(-1), time(0), length(0), dataLeft(0), formatLeft(0)
+{
+  char sig[sizeof(signature)];
+  rdr::U32 ver;
+
+  file = new rdr::FileInStream(filename);
+
+  try {
+    if (!file->hasData(sizeof(sig) + 4))
+      throw rdr::Exception("Not a session recording");
+
+    file->readBytes(sig, sizeof(sig));
+    if (memcmp(sig, signature, sizeof(signature)) != 0)
+      throw rdr::Exception("Not a session recording");
+
+    ver = file->readU32();
+    if (ver != version)
+      throw rdr::Exception("Unsupported session recording version %u",
+                           (unsigned)ver);
+  } catch (rdr::Exception&) {
+    delete file;
+    throw;
+  }
+}
+
+SessionPlayer::~SessionPlayer()
+{
+  delete file;
+}
+
+bool SessionPlayer::nextRecord()
+{
+  skipFile(dataLeft + formatLeft);
+  dataLeft = 0;
+  formatLeft = 0;
+
+  // A recording that was cut short just ends with the last complete
+  // record header
+  try {
+    if (!file->hasData(1 + 4 + 4))
+      return false;
+  } catch (rdr::EndOfStream&) {
+    return false;
+  }
+
+  type = file->readU8();
+  time = file->readU32();
+  length = file->readU32();
+
+  switch (type) {
+  case sessionRecordStream:
+    skipFile(length);
+    break;
+  case sessionRecordPixelFormat:
+    if (length != 16)
+      throw rdr::Exception("Invalid pixel format record");
+    formatLeft = length;
+    break;
+  case sessionRecordData:
+    dataLeft = length;
+    break;
+  default:
+    throw rdr::Exception("Unknown session record type %d", type);
+  }
+
+  return true;
+}
+
+void SessionPlayer::readPixelFormat(PixelFormat* pf)
+{
+  if ((type != sessionRecordPixelFormat) || (formatLeft == 0))
+    throw rdr::Exception("Not a pixel format record");
+
+  if (!file->hasData(16))
+    throw rdr::EndOfStream();
+  pf->read(file);
+  formatLeft = 0;
+}
+
+void SessionPlayer::skipFile(size_t bytes)
+{
+  while (bytes > 0) {
+    size_t n;
+
+    if (!file->hasData(1))
+      throw rdr::EndOfStream();
+
+    n = file->avail();
+    if (n > bytes)
+      n = bytes;
+
+    file->skip(n);
+    bytes -= n;
+  }
+}
+
+bool SessionPlayer::fillBuffer(size_t maxSize)
+{
+  size_t n;
+
+  if (dataLeft == 0)
+    return false;
+
+  if (!file->hasData(1))
+    return false;
+
+  n = dataLeft;
+  if (n > maxSize)
+    n = maxSize;
+  if (n > file->avail())
+    n = file->avail();
+
+  file->readBytes((rdr::U8*)end, n);
+  end += n;
+  dataLeft -= n;
+
+  return true;
+}
@@ -0,0 +1,162 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SessionRecording.h - Recording and playback of a client's updates
+//
+// A session recording is a copy of everything a server sent to one of
+// its clients, from the ServerInit message and forward. The bytes are
+// captured as they are written to the client, so recording costs no
+// extra encoding. The client's pixel format is recorded separately as
+// it is needed to decode the stream.
+//
+// The file starts with a signature and a version, followed by
+// records. Each record has a type, a timestamp in milliseconds and the
+// length of its payload. A recording can hold several streams, e.g.
+// if the recorded client reconnects.
+
+#ifndef __RFB_SESSIONRECORDING_H__
+#define __RFB_SESSIONRECORDING_H__
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <rdr/BufferedInStream.h>
+#include <rdr/BufferedOutStream.h>
+
+#include <os/Thread.h>
+
+namespace os {
+  class Mutex;
+  class Condition;
+}
+
+namespace rdr {
+  class FileInStream;
+  class MemOutStream;
+}
+
+namespace rfb {
+
+  class PixelFormat;
+
+  enum SessionRecordType {
+    sessionRecordStream = 1,
+    sessionRecordPixelFormat,
+    sessionRecordData
+  };
+
+  // SessionRecorder writes the recording from a separate thread, so
+  // that a slow disk never holds up the clients. Its methods may be
+  // called from any thread.
+  class SessionRecorder : public os::Thread {
+  public:
+    SessionRecorder(const char* filename);
+    virtual ~SessionRecorder();
+
+    // Marks the start of a new stream
+    void startStream();
+
+    void writePixelFormat(const PixelFormat& pf);
+    void writeData(const void* data, size_t length);
+
+  protected:
+    virtual void worker();
+
+  private:
+    void addRecord(int type, const void* data, size_t length);
+
+  private:
+    // Limit for data not yet written to disk. A stream that exceeds
+    // it cannot be decoded, so the rest of it is dropped.
+    static const size_t MaxPending = 64 * 1024 * 1024;
+
+    FILE* file;
+    struct timeval startTime;
+
+    os::Mutex* mutex;
+    os::Condition* notEmpty;
+
+    bool stopRequested;
+    bool discarding;
+
+    // Only the worker touches writing
+    rdr::MemOutStream* pending;
+    rdr::MemOutStream* writing;
+  };
+
+  // RecordingOutStream passes everything on to another stream, and
+  // also hands a copy to a SessionRecorder
+  class RecordingOutStream : public rdr::BufferedOutStream {
+  public:
+    RecordingOutStream(rdr::OutStream* out, SessionRecorder* recorder);
+    virtual ~RecordingOutStream();
+
+    virtual void cork(bool enable);
+
+    // Records a change of the client's pixel format, at the current
+    // position in the stream
+    void writePixelFormat(const PixelFormat& pf);
+
+  private:
+    virtual bool flushBuffer();
+
+  private:
+    rdr::OutStream* out;
+    SessionRecorder* recorder;
+  };
+
+  // SessionPlayer reads a recording. The recorded data is made
+  // available through the stream itself, one data record at a time.
+  class SessionPlayer : public rdr::BufferedInStream {
+  public:
+    SessionPlayer(const char* filename);
+    virtual ~SessionPlayer();
+
+    // Reads the header of the next record. Returns false once the end
+    // of the recording has been reached. Any part of the current
+    // record that has not been read is skipped, except for data that
+    // is already buffered in the stream.
+    bool nextRecord();
+
+    int recordType() const { return type; }
+    // Time of the current record, relative to the start of the
+    // recording
+    unsigned timestamp() const { return time; }
+
+    // Reads the payload of a pixel format record
+    void readPixelFormat(PixelFormat* pf);
+
+  private:
+    virtual bool fillBuffer(size_t maxSize);
+
+    void skipFile(size_t bytes);
+
+  private:
+    rdr::FileInStream* file;
+
+    int type;
+    unsigned time;
+    size_t length;
+    size_t dataLeft;
+    // Unread payload of a pixel format record
+    size_t formatLeft;
+  };
+
+}
+
+#endif
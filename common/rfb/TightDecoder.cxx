@@ -46,7 +46,22 @@ static const int TIGHT_MIN_TO_COMPRESS = 12;
 #include <rfb/tightDecode.h>
 #undef BPP
 
-TightDecoder::TightDecoder() : Decoder(DecoderPartiallyOrdered)
+template<class T>
+static void decompress(T* zis, rdr::InStream* is, size_t len,
+                       rdr::U8* buf, size_t dataSize)
+{
+  zis->setUnderlying(is, len);
+
+  if (!zis->hasData(dataSize))
+    throw Exception("Tight decode error");
+  zis->readBytes(buf, dataSize);
+
+  zis->flushUnderlying();
+  zis->setUnderlying(NULL, 0);
+}
+
+TightDecoder::TightDecoder(bool useZstd_)
+  : Decoder(DecoderPartiallyOrdered), useZstd(useZstd_)
 {
 }
 
@@ -243,7 +258,12 @@ void TightDecoder::decodeRect(const Rect& r, const void* buffer,
   // Reset zlib streams if we are told by the server to do so.
   for (int i = 0; i < 4; i++) {
     if (comp_ctl & 1) {
-      zis[i].reset();
+#ifdef HAVE_ZSTD
+      if (useZstd)
+        zstdis[i].reset();
+      else
+#endif
+        zis[i].reset();
     }
     comp_ctl >>= 1;
   }
@@ -381,17 +401,17 @@ void TightDecoder::decodeRect(const Rect& r, const void* buffer,
 
     streamId = comp_ctl & 0x03;
     ms = new rdr::MemInStream(bufptr, len);
-    zis[streamId].setUnderlying(ms, len);
 
     // Allocate buffer and decompress the data
     netbuf = new rdr::U8[dataSize];
 
-    if (!zis[streamId].hasData(dataSize))
-      throw Exception("Tight decode error");
-    zis[streamId].readBytes(netbuf, dataSize);
+#ifdef HAVE_ZSTD
+    if (useZstd)
+      decompress(&zstdis[streamId], ms, len, netbuf, dataSize);
+    else
+#endif
+      decompress(&zis[streamId], ms, len, netbuf, dataSize);
 
-    zis[streamId].flushUnderlying();
-    zis[streamId].setUnderlying(NULL, 0);
     delete ms;
 
     bufptr = netbuf;
@@ -21,6 +21,9 @@
 #define __RFB_TIGHTDECODER_H__
 
 #include <rdr/ZlibInStream.h>
+#ifdef HAVE_ZSTD
+#include <rdr/ZstdInStream.h>
+#endif
 #include <rfb/Decoder.h>
 #include <rfb/JpegDecompressor.h>
 
@@ -29,7 +32,7 @@ namespace rfb {
   class TightDecoder : public Decoder {
 
   public:
-    TightDecoder();
+    TightDecoder(bool useZstd=false);
     virtual ~TightDecoder();
     virtual bool readRect(const Rect& r, rdr::InStream* is,
                           const ServerParams& server, rdr::OutStream* os);
@@ -66,7 +69,12 @@ namespace rfb {
                        int stride, const Rect& r);
 
   private:
+    bool useZstd;
+
     rdr::ZlibInStream zis[4];
+#ifdef HAVE_ZSTD
+    rdr::ZstdInStream zstdis[4];
+#endif
   };
 }
 
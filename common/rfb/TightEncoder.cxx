@@ -55,8 +55,8 @@ static const TightConf conf[10] = {
   { 9, 9, 9 }  // 9
 };
 
-TightEncoder::TightEncoder(SConnection* conn) :
-  Encoder(conn, encodingTight, EncoderPlain, 256)
+TightEncoder::TightEncoder(SConnection* conn, int encoding) :
+  Encoder(conn, encoding, EncoderPlain, 256)
 {
   setCompressLevel(-1);
 }
@@ -67,7 +67,11 @@ TightEncoder::~TightEncoder()
 
 bool TightEncoder::isSupported()
 {
-  return conn->client.supportsEncoding(encodingTight);
+#ifndef HAVE_ZSTD
+  if (encoding == encodingTightZstd)
+    return false;
+#endif
+  return conn->client.supportsEncoding(encoding);
 }
 
 void TightEncoder::setCompressLevel(int level)
@@ -242,6 +246,18 @@ rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t l
   assert(streamId >= 0);
   assert(streamId < 4);
 
+#ifdef HAVE_ZSTD
+  if (encoding == encodingTightZstd) {
+    // Zstandard's fast levels are a better match for zlib's "store"
+    // level than its default
+    zstdStreams[streamId].setUnderlying(&memStream);
+    zstdStreams[streamId].setCompressionLevel(level == 0 ? -1 : level);
+    zstdStreams[streamId].cork(true);
+
+    return &zstdStreams[streamId];
+  }
+#endif
+
   zlibStreams[streamId].setUnderlying(&memStream);
   zlibStreams[streamId].setCompressionLevel(level);
   zlibStreams[streamId].cork(true);
@@ -253,14 +269,25 @@ void TightEncoder::flushZlibOutStream(rdr::OutStream* os_)
 {
   rdr::OutStream* os;
   rdr::ZlibOutStream* zos;
-
-  zos = dynamic_cast<rdr::ZlibOutStream*>(os_);
-  if (zos == NULL)
-    return;
-
-  zos->cork(false);
-  zos->flush();
-  zos->setUnderlying(NULL);
+#ifdef HAVE_ZSTD
+  rdr::ZstdOutStream* zstdos;
+
+  zstdos = dynamic_cast<rdr::ZstdOutStream*>(os_);
+  if (zstdos != NULL) {
+    zstdos->cork(false);
+    zstdos->flush();
+    zstdos->setUnderlying(NULL);
+  } else
+#endif
+  {
+    zos = dynamic_cast<rdr::ZlibOutStream*>(os_);
+    if (zos == NULL)
+      return;
+
+    zos->cork(false);
+    zos->flush();
+    zos->setUnderlying(NULL);
+  }
 
   os = conn->getOutStream();
 
@@ -22,13 +22,17 @@
 
 #include <rdr/MemOutStream.h>
 #include <rdr/ZlibOutStream.h>
+#ifdef HAVE_ZSTD
+#include <rdr/ZstdOutStream.h>
+#endif
+#include <rfb/encodings.h>
 #include <rfb/Encoder.h>
 
 namespace rfb {
 
   class TightEncoder : public Encoder {
   public:
-    TightEncoder(SConnection* conn);
+    TightEncoder(SConnection* conn, int encoding=encodingTight);
     virtual ~TightEncoder();
 
     virtual bool isSupported();
@@ -73,6 +77,9 @@ namespace rfb {
                           const PixelFormat& pf, const Palette& palette);
 
     rdr::ZlibOutStream zlibStreams[4];
+#ifdef HAVE_ZSTD
+    rdr::ZstdOutStream zstdStreams[4];
+#endif
     rdr::MemOutStream memStream;
 
     int idxZlibLevel, monoZlibLevel, rawZlibLevel;
@@ -18,14 +18,21 @@
  * USA.
  */
 
+#include <stdio.h>
+
 #include <network/TcpSocket.h>
 
+#include <os/Trace.h>
+
 #include <rfb/ComparingUpdateTracker.h>
 #include <rfb/Encoder.h>
 #include <rfb/KeyRemapper.h>
 #include <rfb/LogWriter.h>
+#include <rfb/Metrics.h>
 #include <rfb/Security.h>
+#include <rfb/ScaledPixelBuffer.h>
 #include <rfb/ServerCore.h>
+#include <rfb/SessionRecording.h>
 #include <rfb/SMsgWriter.h>
 #include <rfb/VNCServerST.h>
 #include <rfb/VNCSConnectionST.h>
@@ -43,6 +50,36 @@ static LogWriter vlog("VNCSConnST");
 
 static Cursor emptyCursor(0, 0, Point(0, 0), NULL);
 
+// Identifies connections in the metrics
+static unsigned nextConnectionId = 0;
+
+// How long input counts as recent when prioritizing changes (ms)
+static const int InputPriorityTimeout = 2000;
+// Margin around the pointer and text cursor that is sent first
+static const int InputPriorityMargin = 128;
+// Largest change that is considered to be the text cursor
+static const int CaretMaxSize = 64;
+
+static size_t regionArea(const Region& region)
+{
+  Region::const_iterator i;
+  size_t area;
+
+  area = 0;
+  for (i = region.begin(); i != region.end(); ++i)
+    area += i->area();
+
+  return area;
+}
+
+// Maps a rectangle between frame buffers of different sizes
+static Rect mapRect(const Rect& r, int fromWidth, int fromHeight,
+                    int toWidth, int toHeight)
+{
+  return Rect(r.tl.x * toWidth / fromWidth, r.tl.y * toHeight / fromHeight,
+              r.br.x * toWidth / fromWidth, r.br.y * toHeight / fromHeight);
+}
+
 VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
                                    bool reverse)
   : sock(s), reverseConnection(reverse),
@@ -51,11 +88,17 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
     fenceDataLen(0), fenceData(NULL), congestionTimer(this),
     losslessTimer(this), server(server_),
     updateRenderedCursor(false), removeRenderedCursor(false),
-    continuousUpdates(false), encodeManager(this), idleTimer(this),
-    pointerEventTime(0), clientHasCursor(false)
+    continuousUpdates(false), encodeManager(this), scaledPb(NULL),
+    idleTimer(this),
+    pointerEventTime(0), keyChangePending(false),
+    clientHasCursor(false), cursorUpdates(0), recordingStream(NULL)
 {
+  pointerInputTime.tv_sec = pointerInputTime.tv_usec = 0;
+  keyInputTime.tv_sec = keyInputTime.tv_usec = 0;
+
   setStreams(&sock->inStream(), &sock->outStream());
   peerEndpoint.buf = sock->getPeerEndpoint();
+  connectionId = nextConnectionId++;
 
   // Kick off the idle timer
   if (rfb::Server::idleTimeout) {
@@ -88,6 +131,8 @@ VNCSConnectionST::~VNCSConnectionST()
   }
 
   delete [] fenceData;
+  delete scaledPb;
+  delete recordingStream;
 }
 
 
@@ -133,6 +178,29 @@ void VNCSConnectionST::close(const char* reason)
 
 // Methods called from VNCServerST
 
+void VNCSConnectionST::add_changed(const Region& region)
+{
+  // Scaling is deferred until the next update, as the same area is
+  // often changed many times before that
+  if (scaledPb != NULL) {
+    unscaledChanges.assign_union(region);
+    return;
+  }
+
+  updates.add_changed(region);
+}
+
+void VNCSConnectionST::add_copied(const Region& dest, const Point& delta)
+{
+  // A copy does not line up with the scaled pixels
+  if (scaledPb != NULL) {
+    unscaledChanges.assign_union(dest);
+    return;
+  }
+
+  updates.add_copied(dest, delta);
+}
+
 bool VNCSConnectionST::init()
 {
   try {
@@ -203,9 +271,12 @@ void VNCSConnectionST::pixelBufferChange()
 {
   try {
     if (!authenticated()) return;
+
+    setupScaling();
+
     if (client.width() && client.height() &&
-        (server->getPixelBuffer()->width() != client.width() ||
-         server->getPixelBuffer()->height() != client.height()))
+        (getPixelBuffer()->width() != client.width() ||
+         getPixelBuffer()->height() != client.height()))
     {
       // We need to clip the next update to the new size, but also add any
       // extra bits if it's bigger.  If we wanted to do this exactly, something
@@ -222,11 +293,11 @@ void VNCSConnectionST::pixelBufferChange()
       //  updates.add_changed(Rect(0, client.height(), client.width(),
       //                           server->pb->height()));
 
-      damagedCursorRegion.assign_intersect(server->getPixelBuffer()->getRect());
+      damagedCursorRegion.assign_intersect(getPixelBuffer()->getRect());
 
-      client.setDimensions(server->getPixelBuffer()->width(),
-                           server->getPixelBuffer()->height(),
-                           server->getScreenLayout());
+      client.setDimensions(getPixelBuffer()->width(),
+                           getPixelBuffer()->height(),
+                           getScreenLayout());
       if (state() == RFBSTATE_NORMAL) {
         if (!client.supportsDesktopSize()) {
           close("Client does not support desktop resize");
@@ -236,12 +307,12 @@ void VNCSConnectionST::pixelBufferChange()
       }
 
       // Drop any lossy tracking that is now outside the framebuffer
-      encodeManager.pruneLosslessRefresh(Region(server->getPixelBuffer()->getRect()));
+      encodeManager.pruneLosslessRefresh(Region(getPixelBuffer()->getRect()));
     }
     // Just update the whole screen at the moment because we're too lazy to
     // work out what's actually changed.
     updates.clear();
-    updates.add_changed(server->getPixelBuffer()->getRect());
+    updates.add_changed(getPixelBuffer()->getRect());
     writeFramebufferUpdate();
   } catch(rdr::Exception &e) {
     close(e.str());
@@ -394,6 +465,11 @@ bool VNCSConnectionST::needRenderedCursor()
   if (state() != RFBSTATE_NORMAL)
     return false;
 
+  // The rendered cursor is in the server's coordinates, so it cannot
+  // be drawn on a scaled view
+  if (scaledPb != NULL)
+    return false;
+
   if (!client.supportsLocalCursor())
     return true;
   if (!server->getCursorPos().equals(pointerEventPos) &&
@@ -404,6 +480,39 @@ bool VNCSConnectionST::needRenderedCursor()
 }
 
 
+void VNCSConnectionST::getMetrics(Metrics* metrics)
+{
+  char id[16];
+
+  snprintf(id, sizeof(id), "%u", connectionId);
+
+  const char* labels[] = { "connection", id,
+                           "client", peerEndpoint.buf, NULL };
+
+  encodeManager.getMetrics(metrics, id, peerEndpoint.buf);
+
+  metrics->describe("vnc_cursor_updates_total", "counter",
+                    "Cursor shape updates sent");
+  metrics->add("vnc_cursor_updates_total", labels,
+               (unsigned long long)cursorUpdates);
+
+  metrics->describe("vnc_rtt_seconds", "gauge",
+                    "Lowest measured round trip time");
+  metrics->add("vnc_rtt_seconds", labels,
+               congestion.getRoundTripTime() / 1000.0);
+
+  metrics->describe("vnc_congestion_window_bytes", "gauge",
+                    "Current congestion window");
+  metrics->add("vnc_congestion_window_bytes", labels,
+               (unsigned long long)congestion.getCongestionWindow());
+
+  metrics->describe("vnc_bandwidth_bytes_per_second", "gauge",
+                    "Estimated bandwidth");
+  metrics->add("vnc_bandwidth_bytes_per_second", labels,
+               (unsigned long long)congestion.getBandwidth());
+}
+
+
 void VNCSConnectionST::approveConnectionOrClose(bool accept,
                                                 const char* reason)
 {
@@ -423,10 +532,12 @@ void VNCSConnectionST::authSuccess()
   if (rfb::Server::idleTimeout)
     idleTimer.start(secsToMillis(rfb::Server::idleTimeout));
 
+  setupScaling();
+
   // - Set the connection parameters appropriately
-  client.setDimensions(server->getPixelBuffer()->width(),
-                       server->getPixelBuffer()->height(),
-                       server->getScreenLayout());
+  client.setDimensions(getPixelBuffer()->width(),
+                       getPixelBuffer()->height(),
+                       getScreenLayout());
   client.setName(server->getName());
   client.setLEDState(server->getLEDState());
   
@@ -437,7 +548,7 @@ void VNCSConnectionST::authSuccess()
   vlog.info("Server default pixel format %s", buffer);
 
   // - Mark the entire display as "dirty"
-  updates.add_changed(server->getPixelBuffer()->getRect());
+  updates.add_changed(getPixelBuffer()->getRect());
 }
 
 void VNCSConnectionST::queryConnection(const char* userName)
@@ -452,12 +563,27 @@ void VNCSConnectionST::clientInit(bool shared)
   if (rfb::Server::alwaysShared || reverseConnection) shared = true;
   if (!accessCheck(AccessNonShared)) shared = true;
   if (rfb::Server::neverShared) shared = false;
+
+  // The recording has to start with the ServerInit message, and with
+  // any security layer already removed
+  SessionRecorder* recorder = server->startRecording(this);
+  if (recorder != NULL) {
+    recordingStream = new RecordingOutStream(getOutStream(), recorder);
+    setStreams(getInStream(), recordingStream);
+    // Nothing has been written yet, so a fresh writer is equivalent
+    delete writer();
+    setWriter(new SMsgWriter(&client, recordingStream));
+  }
+
   SConnection::clientInit(shared);
   server->clientReady(this, shared);
 }
 
 void VNCSConnectionST::setPixelFormat(const PixelFormat& pf)
 {
+  // Must be recorded before anything is sent in the new format
+  if (recordingStream != NULL)
+    recordingStream->writePixelFormat(pf);
   SConnection::setPixelFormat(pf);
   char buffer[256];
   pf.print(buffer, 256);
@@ -472,7 +598,12 @@ void VNCSConnectionST::pointerEvent(const Point& pos, int buttonMask)
   pointerEventTime = time(0);
   if (!accessCheck(AccessPtrEvents)) return;
   if (!rfb::Server::acceptPointerEvents) return;
-  pointerEventPos = pos;
+  gettimeofday(&pointerInputTime, NULL);
+  inputPointerPos = pos;
+  if (scaledPb != NULL)
+    pointerEventPos = scaledPb->unscalePoint(pos);
+  else
+    pointerEventPos = pos;
   server->pointerEvent(this, pointerEventPos, buttonMask);
 }
 
@@ -506,6 +637,11 @@ void VNCSConnectionST::keyEvent(rdr::U32 keysym, rdr::U32 keycode, bool down) {
   if (!accessCheck(AccessKeyEvents)) return;
   if (!rfb::Server::acceptKeyEvents) return;
 
+  if (down) {
+    gettimeofday(&keyInputTime, NULL);
+    keyChangePending = true;
+  }
+
   if (down)
     vlog.debug("Key pressed: 0x%x / 0x%x", keysym, keycode);
   else
@@ -650,7 +786,25 @@ void VNCSConnectionST::setDesktopSize(int fb_width, int fb_height,
 
   if (!accessCheck(AccessSetDesktopSize) || !rfb::Server::acceptSetDesktopSize)
     result = resultProhibited;
-  else
+  else if (scaledPb != NULL) {
+    const PixelBuffer* pb;
+    ScreenSet unscaled;
+    ScreenSet::iterator iter;
+
+    // Ask for the size that the client's request corresponds to on
+    // the real screen
+    pb = server->getPixelBuffer();
+    unscaled = layout;
+    for (iter = unscaled.begin(); iter != unscaled.end(); ++iter)
+      iter->dimensions = mapRect(iter->dimensions,
+                                 scaledPb->width(), scaledPb->height(),
+                                 pb->width(), pb->height());
+
+    result = server->setDesktopSize(this,
+                                    fb_width * pb->width() / scaledPb->width(),
+                                    fb_height * pb->height() / scaledPb->height(),
+                                    unscaled);
+  } else
     result = server->setDesktopSize(this, fb_width, fb_height, layout);
 
   writer()->writeDesktopSize(reasonClient, result);
@@ -879,6 +1033,8 @@ void VNCSConnectionST::writeFramebufferUpdate()
   if (isCongested())
     return;
 
+  encodeManager.setBandwidth(congestion.getBandwidth());
+
   // Updates often consists of many small writes, and in continuous
   // mode, we will also have small fence messages around the update. We
   // need to aggregate these in order to not clog up TCP's congestion
@@ -910,11 +1066,13 @@ void VNCSConnectionST::writeNoDataUpdate()
 
 void VNCSConnectionST::writeDataUpdate()
 {
-  Region req;
+  Region req, deferred;
   UpdateInfo ui;
   bool needNewUpdateInfo;
   const RenderedCursor *cursor;
 
+  TRACE_SPAN("VNCSConnectionST::writeDataUpdate");
+
   // See what the client has requested (if anything)
   if (continuousUpdates)
     req = cuRegion.union_(requested);
@@ -924,6 +1082,8 @@ void VNCSConnectionST::writeDataUpdate()
   if (req.is_empty())
     return;
 
+  scaleChanges();
+
   // Get the lists of updates. Prior to exporting the data to the `ui' object,
   // getUpdateInfo() will normalize the `updates' object such way that its
   // `changed' and `copied' regions would not intersect.
@@ -939,7 +1099,7 @@ void VNCSConnectionST::writeDataUpdate()
 
     bogusCopiedCursor = damagedCursorRegion;
     bogusCopiedCursor.translate(ui.copy_delta);
-    bogusCopiedCursor.assign_intersect(server->getPixelBuffer()->getRect());
+    bogusCopiedCursor.assign_intersect(getPixelBuffer()->getRect());
     if (!ui.copied.intersect(bogusCopiedCursor).is_empty()) {
       updates.add_changed(bogusCopiedCursor);
       needNewUpdateInfo = true;
@@ -972,12 +1132,15 @@ void VNCSConnectionST::writeDataUpdate()
 
   // If there are queued updates then we cannot safely send an update
   // without risking a partially updated screen
-  if (!server->getPendingRegion().is_empty()) {
+  if (!getPendingRegion().is_empty()) {
     req.clear();
     ui.changed.clear();
     ui.copied.clear();
   }
 
+  // Changes far from recent input might have to wait for later
+  deferred = deferDistantChanges(&ui);
+
   // Does the client need a server-side rendered cursor?
 
   cursor = NULL;
@@ -1009,17 +1172,104 @@ void VNCSConnectionST::writeDataUpdate()
 
   writeRTTPing();
 
-  encodeManager.writeUpdate(ui, server->getPixelBuffer(), cursor);
+  encodeManager.writeUpdate(ui, getPixelBuffer(), cursor);
 
   writeRTTPing();
 
   // The request might be for just part of the screen, so we cannot
   // just clear the entire update tracker.
-  updates.subtract(req);
+  updates.subtract(req.subtract(deferred));
 
   requested.clear();
 }
 
+Region VNCSConnectionST::deferDistantChanges(UpdateInfo* ui)
+{
+  Region focus, nearby, distant, deferred;
+  Region::const_iterator i;
+  size_t maxArea, area;
+
+  if (!rfb::Server::prioritizeInput)
+    return deferred;
+
+  // The first change after a key press is most likely the text
+  // cursor moving, if it is small enough
+  if (keyChangePending && !ui->changed.is_empty()) {
+    Rect caret;
+
+    for (i = ui->changed.begin(); i != ui->changed.end(); ++i) {
+      if ((i->width() > CaretMaxSize) || (i->height() > CaretMaxSize))
+        continue;
+      caret = caret.union_boundary(*i);
+    }
+
+    if (!caret.is_empty() &&
+        (caret.width() <= InputPriorityMargin) &&
+        (caret.height() <= InputPriorityMargin))
+      caretRect = caret;
+
+    keyChangePending = false;
+  }
+
+  if (msSince(&pointerInputTime) < (unsigned)InputPriorityTimeout) {
+    focus.assign_union(Rect(inputPointerPos.x - InputPriorityMargin,
+                            inputPointerPos.y - InputPriorityMargin,
+                            inputPointerPos.x + InputPriorityMargin,
+                            inputPointerPos.y + InputPriorityMargin));
+  }
+
+  if (!caretRect.is_empty() &&
+      (msSince(&keyInputTime) < (unsigned)InputPriorityTimeout)) {
+    focus.assign_union(Rect(caretRect.tl.x - InputPriorityMargin,
+                            caretRect.tl.y - InputPriorityMargin,
+                            caretRect.br.x + InputPriorityMargin,
+                            caretRect.br.y + InputPriorityMargin));
+  }
+
+  nearby = ui->changed.intersect(focus);
+  if (nearby.is_empty())
+    return deferred;
+
+  // Only hold anything back if the update is unlikely to get through
+  // before the next one is due. Same conservative guess as for
+  // lossless refreshes: 2:1 compression of 32 bpp pixels.
+  maxArea = congestion.getBandwidth() / rfb::Server::frameRate / 2;
+  if (regionArea(ui->changed) <= maxArea)
+    return deferred;
+
+  // Fill up whatever is left with other changes, so that they still
+  // make progress while there is input
+  area = regionArea(nearby);
+  distant = ui->changed.subtract(nearby);
+  deferred = distant;
+
+  for (i = distant.begin(); i != distant.end(); ++i) {
+    Rect rect;
+
+    if (area >= maxArea)
+      break;
+
+    rect = *i;
+    if ((area + rect.area()) > maxArea) {
+      // Use the narrowest axis to avoid getting to thin rects
+      if (rect.width() > rect.height()) {
+        int width = (maxArea - area) / rect.height();
+        rect.br.x = rect.tl.x + __rfbmax(1, width);
+      } else {
+        int height = (maxArea - area) / rect.width();
+        rect.br.y = rect.tl.y + __rfbmax(1, height);
+      }
+    }
+
+    area += rect.area();
+    deferred.assign_subtract(Region(rect));
+  }
+
+  ui->changed.assign_subtract(deferred);
+
+  return deferred;
+}
+
 void VNCSConnectionST::writeLosslessRefresh()
 {
   Region req, pending;
@@ -1036,7 +1286,7 @@ void VNCSConnectionST::writeLosslessRefresh()
   // If there are queued updates then we could not safely send an
   // update without risking a partially updated screen, however we
   // might still be able to send a lossless refresh
-  pending = server->getPendingRegion();
+  pending = getPendingRegion();
   if (!pending.is_empty()) {
     UpdateInfo ui;
 
@@ -1086,7 +1336,7 @@ void VNCSConnectionST::writeLosslessRefresh()
 
   writeRTTPing();
 
-  encodeManager.writeLosslessRefresh(req, server->getPixelBuffer(),
+  encodeManager.writeLosslessRefresh(req, getPixelBuffer(),
                                      cursor, maxUpdateSize);
 
   writeRTTPing();
@@ -1101,7 +1351,7 @@ void VNCSConnectionST::screenLayoutChange(rdr::U16 reason)
     return;
 
   client.setDimensions(client.width(), client.height(),
-                       server->getScreenLayout());
+                       getScreenLayout());
 
   if (state() != RFBSTATE_NORMAL)
     return;
@@ -1128,8 +1378,10 @@ void VNCSConnectionST::setCursor()
     clientHasCursor = true;
   }
 
-  if (client.supportsLocalCursor())
+  if (client.supportsLocalCursor()) {
     writer()->writeCursor();
+    cursorUpdates++;
+  }
 }
 
 // setCursorPos() is called whenever the cursor has changed position by the
@@ -1142,7 +1394,10 @@ void VNCSConnectionST::setCursorPos()
     return;
 
   if (client.supportsCursorPosition()) {
-    client.setCursorPos(server->getCursorPos());
+    if (scaledPb != NULL)
+      client.setCursorPos(scaledPb->scalePoint(server->getCursorPos()));
+    else
+      client.setCursorPos(server->getCursorPos());
     writer()->writeCursorPos();
   }
 }
@@ -1168,3 +1423,92 @@ void VNCSConnectionST::setLEDState(unsigned int ledstate)
   if (client.supportsLEDState())
     writer()->writeLEDState();
 }
+
+void VNCSConnectionST::setupScaling()
+{
+  const PixelBuffer* pb;
+  int width, height;
+
+  delete scaledPb;
+  scaledPb = NULL;
+  unscaledChanges.clear();
+
+  // Anything tracked so far might be in the wrong coordinates, so the
+  // callers mark everything as changed
+  updates.clear();
+
+  pb = server->getPixelBuffer();
+  width = pb->width();
+  height = pb->height();
+
+  // Keep the aspect ratio, and never scale up
+  if (rfb::Server::maxViewWidth && (width > rfb::Server::maxViewWidth)) {
+    height = height * rfb::Server::maxViewWidth / width;
+    width = rfb::Server::maxViewWidth;
+  }
+  if (rfb::Server::maxViewHeight && (height > rfb::Server::maxViewHeight)) {
+    width = width * rfb::Server::maxViewHeight / height;
+    height = rfb::Server::maxViewHeight;
+  }
+
+  if ((width == pb->width()) && (height == pb->height()))
+    return;
+
+  if (width < 1)
+    width = 1;
+  if (height < 1)
+    height = 1;
+
+  if (!ScaledPixelBuffer::supportsFormat(pb->getPF())) {
+    vlog.error("Cannot scale the screen for %s: unsupported pixel format",
+               peerEndpoint.buf);
+    return;
+  }
+
+  vlog.info("Scaling %dx%d screen to %dx%d for %s", pb->width(),
+            pb->height(), width, height, peerEndpoint.buf);
+
+  scaledPb = new ScaledPixelBuffer(pb, width, height);
+  unscaledChanges = pb->getRect();
+}
+
+void VNCSConnectionST::scaleChanges()
+{
+  if ((scaledPb == NULL) || unscaledChanges.is_empty())
+    return;
+
+  updates.add_changed(scaledPb->update(unscaledChanges));
+  unscaledChanges.clear();
+}
+
+const PixelBuffer* VNCSConnectionST::getPixelBuffer()
+{
+  if (scaledPb != NULL)
+    return scaledPb;
+  return server->getPixelBuffer();
+}
+
+ScreenSet VNCSConnectionST::getScreenLayout()
+{
+  const PixelBuffer* pb;
+  ScreenSet layout;
+  ScreenSet::iterator iter;
+
+  layout = server->getScreenLayout();
+  if (scaledPb == NULL)
+    return layout;
+
+  pb = server->getPixelBuffer();
+  for (iter = layout.begin(); iter != layout.end(); ++iter)
+    iter->dimensions = mapRect(iter->dimensions, pb->width(), pb->height(),
+                               scaledPb->width(), scaledPb->height());
+
+  return layout;
+}
+
+Region VNCSConnectionST::getPendingRegion()
+{
+  if (scaledPb != NULL)
+    return scaledPb->scaleRegion(server->getPendingRegion());
+  return server->getPendingRegion();
+}
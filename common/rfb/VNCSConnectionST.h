@@ -29,12 +29,17 @@
 
 #include <map>
 
+#include <sys/time.h>
+
 #include <rfb/Congestion.h>
 #include <rfb/EncodeManager.h>
 #include <rfb/SConnection.h>
 #include <rfb/Timer.h>
 
 namespace rfb {
+  class Metrics;
+  class RecordingOutStream;
+  class ScaledPixelBuffer;
   class VNCServerST;
 
   class VNCSConnectionST : private SConnection,
@@ -107,13 +112,15 @@ namespace rfb {
 
     // Change tracking
 
-    void add_changed(const Region& region) { updates.add_changed(region); }
-    void add_copied(const Region& dest, const Point& delta) {
-      updates.add_copied(dest, delta);
-    }
+    // The regions are in the server's frame buffer coordinates
+    void add_changed(const Region& region);
+    void add_copied(const Region& dest, const Point& delta);
 
     const char* getPeerEndpoint() const {return peerEndpoint.buf;}
 
+    // getMetrics() adds the statistics for this client to metrics
+    void getMetrics(Metrics* metrics);
+
   private:
     // SConnection callbacks
 
@@ -156,6 +163,7 @@ namespace rfb {
     void writeFramebufferUpdate();
     void writeNoDataUpdate();
     void writeDataUpdate();
+    Region deferDistantChanges(UpdateInfo* ui);
     void writeLosslessRefresh();
 
     void screenLayoutChange(rdr::U16 reason);
@@ -164,9 +172,19 @@ namespace rfb {
     void setDesktopName(const char *name);
     void setLEDState(unsigned int state);
 
+    // Scaled view of the frame buffer, for when it is larger than
+    // MaxViewWidth x MaxViewHeight. These return what the client sees.
+    void setupScaling();
+    void scaleChanges();
+    const PixelBuffer* getPixelBuffer();
+    ScreenSet getScreenLayout();
+    Region getPendingRegion();
+
   private:
     network::Socket* sock;
     CharArray peerEndpoint;
+    // Unique per connection, as the peer endpoint need not be
+    unsigned connectionId;
     bool reverseConnection;
 
     bool inProcessMessages;
@@ -189,14 +207,30 @@ namespace rfb {
     Region cuRegion;
     EncodeManager encodeManager;
 
+    ScaledPixelBuffer* scaledPb;
+    // Changes not yet applied to scaledPb
+    Region unscaledChanges;
+
     std::map<rdr::U32, rdr::U32> pressedKeys;
 
     Timer idleTimer;
 
     time_t pointerEventTime;
     Point pointerEventPos;
+
+    // Recent input, in the client's coordinates, so that changes near
+    // it can be sent first
+    struct timeval pointerInputTime, keyInputTime;
+    Point inputPointerPos;
+    bool keyChangePending;
+    Rect caretRect;
     bool clientHasCursor;
 
+    unsigned cursorUpdates;
+
+    // Set if everything sent to this client is also being recorded
+    RecordingOutStream* recordingStream;
+
     CharArray closeReason;
   };
 }
@@ -49,13 +49,23 @@
 
 
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <string>
 
 #include <rfb/ComparingUpdateTracker.h>
 #include <rfb/KeyRemapper.h>
 #include <rfb/LogWriter.h>
+#include <rfb/Metrics.h>
 #include <rfb/Security.h>
 #include <rfb/ServerCore.h>
+#include <rfb/SessionRecording.h>
 #include <rfb/VNCServerST.h>
 #include <rfb/VNCSConnectionST.h>
 #include <rfb/util.h>
@@ -63,6 +73,8 @@
 
 #include <rdr/types.h>
 
+#include <os/Trace.h>
+
 using namespace rfb;
 
 static LogWriter slog("VNCServerST");
@@ -78,14 +90,51 @@ VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_)
   : blHosts(&blacklist), desktop(desktop_), desktopStarted(false),
     blockCounter(0), pb(0), ledState(ledUnknown),
     name(strDup(name_)), pointerClient(0), clipboardClient(0),
-    comparer(0), cursor(new Cursor(0, 0, Point(), NULL)),
+    comparer(0), recorder(0), recordedClient(0),
+    cursor(new Cursor(0, 0, Point(), NULL)),
     renderedCursorInvalid(false),
     keyRemapper(&KeyRemapper::defInstance),
     idleTimer(this), disconnectTimer(this), connectTimer(this),
-    frameTimer(this)
+    reclaimTimer(this), frameTimer(this)
 {
   slog.debug("creating single-threaded server %s", name.buf);
 
+  CharArray traceFile(rfb::Server::traceFile.getData());
+  if (traceFile.buf[0] != '\0') {
+#ifdef ENABLE_TRACING
+    if (!os::Trace::open(traceFile.buf))
+      slog.error("Unable to open trace file %s", traceFile.buf);
+#else
+    slog.error("Tracing support has not been compiled in");
+#endif
+  }
+
+  CharArray recordFile(rfb::Server::recordSession.getData());
+  if (recordFile.buf[0] != '\0') {
+    // Lets several servers, e.g. pooled rdp2vnc sessions, share the
+    // same configuration
+    std::string filename(recordFile.buf);
+    size_t pos = filename.find("%p");
+    if (pos != std::string::npos) {
+      char pid[16];
+#ifdef WIN32
+      snprintf(pid, sizeof(pid), "%lu",
+               (unsigned long)GetCurrentProcessId());
+#else
+      snprintf(pid, sizeof(pid), "%lu", (unsigned long)getpid());
+#endif
+      filename.replace(pos, 2, pid);
+    }
+
+    try {
+      recorder = new SessionRecorder(filename.c_str());
+      slog.info("Recording session to %s", filename.c_str());
+    } catch (rdr::Exception& e) {
+      slog.error("Unable to record session to %s: %s",
+                 filename.c_str(), e.str());
+    }
+  }
+
   // FIXME: Do we really want to kick off these right away?
   if (rfb::Server::maxIdleTime)
     idleTimer.start(secsToMillis(rfb::Server::maxIdleTime));
@@ -118,6 +167,9 @@ VNCServerST::~VNCServerST()
     comparer->logStats();
   delete comparer;
 
+  recordedClient = NULL;
+  delete recorder;
+
   delete cursor;
 }
 
@@ -173,6 +225,10 @@ void VNCServerST::removeSocket(network::Socket* sock) {
       if (clipboardClient == *ci)
         handleClipboardAnnounce(*ci, false);
       clipboardRequestors.remove(*ci);
+      if (recordedClient == *ci) {
+        slog.info("Stopped recording session");
+        recordedClient = NULL;
+      }
 
       CharArray name(strDup((*ci)->getPeerEndpoint()));
 
@@ -636,6 +692,12 @@ bool VNCServerST::handleTimeout(Timer* t)
   } else if (t == &connectTimer) {
     slog.info("MaxConnectionTime reached, exiting");
     desktop->terminate();
+  } else if (t == &reclaimTimer) {
+    slog.debug("No clients for a while, releasing memory");
+    if (comparer)
+      comparer->freeBuffers();
+    renderedCursor.freeBuffers();
+    renderedCursorInvalid = true;
   }
 
   return false;
@@ -704,6 +766,7 @@ void VNCServerST::startDesktop()
 {
   if (!desktopStarted) {
     slog.debug("starting desktop");
+    reclaimTimer.stop();
     desktop->start(this);
     if (!pb)
       throw Exception("SDesktop::start() did not set a valid PixelBuffer");
@@ -722,6 +785,8 @@ void VNCServerST::stopDesktop()
     desktopStarted = false;
     desktop->stop();
     stopFrameClock();
+    if (rfb::Server::reclaimTime)
+      reclaimTimer.start(secsToMillis(rfb::Server::reclaimTime));
   }
 }
 
@@ -853,6 +918,46 @@ const RenderedCursor* VNCServerST::getRenderedCursor()
   return &renderedCursor;
 }
 
+SessionRecorder* VNCServerST::startRecording(VNCSConnectionST* client)
+{
+  // Only one client at a time, as each of them gets its own encoding
+  if ((recorder == NULL) || (recordedClient != NULL))
+    return NULL;
+
+  slog.info("Recording session as seen by %s", client->getPeerEndpoint());
+
+  recordedClient = client;
+  recorder->startStream();
+
+  return recorder;
+}
+
+void VNCServerST::getMetrics(Metrics* metrics)
+{
+  std::list<VNCSConnectionST*>::iterator ci;
+
+  metrics->describe("vnc_clients", "gauge", "Connected clients");
+  metrics->add("vnc_clients", NULL, (unsigned long long)clients.size());
+
+  // The comparer and its statistics are reset whenever the frame
+  // buffer is replaced
+  if (comparer != NULL) {
+    unsigned long long total, changed;
+
+    comparer->getStats(&total, &changed);
+
+    metrics->describe("vnc_comparer_pixels_total", "counter",
+                      "Pixels checked for changes");
+    metrics->add("vnc_comparer_pixels_total", NULL, total);
+    metrics->describe("vnc_comparer_changed_pixels_total", "counter",
+                      "Pixels checked for changes that had changed");
+    metrics->add("vnc_comparer_changed_pixels_total", NULL, changed);
+  }
+
+  for (ci = clients.begin(); ci != clients.end(); ++ci)
+    (*ci)->getMetrics(metrics);
+}
+
 bool VNCServerST::getComparerState()
 {
   if (rfb::Server::compareFB == 0)
@@ -40,6 +40,8 @@ namespace rfb {
   class ListConnInfo;
   class PixelBuffer;
   class KeyRemapper;
+  class Metrics;
+  class SessionRecorder;
 
   class VNCServerST : public VNCServer,
                       public Timer::Callback {
@@ -152,6 +154,16 @@ namespace rfb {
     // side rendered cursor buffer
     const RenderedCursor* getRenderedCursor();
 
+    // getMetrics() adds the statistics for the server and all of its
+    // clients to metrics
+    void getMetrics(Metrics* metrics);
+
+    // startRecording() is called by a VNCSConnectionST instance just
+    // before it sends the ServerInit message. It returns the recorder
+    // the client should copy its output to, or NULL if the client
+    // should not be recorded.
+    SessionRecorder* startRecording(VNCSConnectionST* client);
+
   protected:
 
     // Timer callbacks
@@ -193,6 +205,9 @@ namespace rfb {
 
     ComparingUpdateTracker* comparer;
 
+    SessionRecorder* recorder;
+    VNCSConnectionST* recordedClient;
+
     Point cursorPos;
     Cursor* cursor;
     RenderedCursor renderedCursor;
@@ -203,6 +218,7 @@ namespace rfb {
     Timer idleTimer;
     Timer disconnectTimer;
     Timer connectTimer;
+    Timer reclaimTimer;
 
     Timer frameTimer;
   };
@@ -67,6 +67,10 @@ namespace rfb {
   // UltraVNC-specific
   const int pseudoEncodingExtendedClipboard = 0xC0A1E5CE;
 
+  // TigerVNC-specific (unregistered)
+  // Tight with Zstandard instead of zlib for the compressed streams
+  const int encodingTightZstd = 0x5A535444;
+
   int encodingNum(const char* name);
   const char* encodingName(int num);
 }
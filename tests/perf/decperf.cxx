@@ -69,12 +69,14 @@ public:
   virtual void setCursorPos(const rfb::Point&);
   virtual void framebufferUpdateStart();
   virtual void framebufferUpdateEnd();
+  virtual bool dataRect(const rfb::Rect&, int);
   virtual void setColourMapEntries(int, int, rdr::U16*);
   virtual void bell();
   virtual void serverCutText(const char*);
 
 public:
   double cpuTime;
+  unsigned long long rectCount;
 
 protected:
   rdr::FileInStream *in;
@@ -110,6 +112,7 @@ void DummyOutStream::overrun(size_t needed)
 CConn::CConn(const char *filename)
 {
   cpuTime = 0.0;
+  rectCount = 0;
 
   in = new rdr::FileInStream(filename);
   out = new DummyOutStream;
@@ -165,6 +168,16 @@ void CConn::framebufferUpdateEnd()
   cpuTime += getCpuCounter();
 }
 
+bool CConn::dataRect(const rfb::Rect& r, int encoding)
+{
+  if (!CConnection::dataRect(r, encoding))
+    return false;
+
+  rectCount++;
+
+  return true;
+}
+
 void CConn::setColourMapEntries(int, int, rdr::U16*)
 {
 }
@@ -181,6 +194,7 @@ struct stats
 {
   double decodeTime;
   double realTime;
+  unsigned long long rectCount;
 };
 
 static struct stats runTest(const char *fn)
@@ -210,6 +224,7 @@ static struct stats runTest(const char *fn)
   gettimeofday(&stop, NULL);
 
   s.decodeTime = cc->cpuTime;
+  s.rectCount = cc->rectCount;
   s.realTime = (double)stop.tv_sec - start.tv_sec;
   s.realTime += ((double)stop.tv_usec - start.tv_usec)/1000000.0;
 
@@ -287,5 +302,21 @@ int main(int argc, char **argv)
 
   printf("Core usage: %g (+/- %g %%)\n", median, meddev);
 
+  // And for rect throughput, which is mostly interesting for streams
+  // with many small rects
+  for (i = 0;i < runCount;i++)
+    values[i] = runs[i].rectCount / runs[i].realTime;
+
+  sort(values, runCount);
+  median = values[runCount/2];
+
+  for (i = 0;i < runCount;i++)
+    dev[i] = fabs((values[i] - median) / median) * 100;
+
+  sort(dev, runCount);
+  meddev = dev[runCount/2];
+
+  printf("Rects: %g rects/s (+/- %g %%)\n", median, meddev);
+
   return 0;
 }
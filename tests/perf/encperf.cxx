@@ -30,8 +30,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#ifndef WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include <vector>
 
 #include <rdr/Exception.h>
 #include <rdr/OutStream.h>
@@ -60,6 +66,17 @@ static rfb::BoolParameter translate("translate",
                                     "Translate 8-bit and 16-bit datasets into 24-bit",
                                     true);
 
+static rfb::BoolParameter zstd("zstd",
+                               "Use Zstandard instead of zlib for Tight",
+                               false);
+
+static rfb::IntParameter concurrency("concurrency",
+                                     "Number of encoder instances to run in "
+                                     "parallel (as separate processes)", 1);
+
+static rfb::BoolParameter json("json",
+                               "Print the results as JSON", false);
+
 // The frame buffer (and output) is always this format
 static const rfb::PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
 
@@ -70,6 +87,38 @@ static const rdr::S32 encodings[] = {
   rfb::pseudoEncodingQualityLevel0 + 8,
   rfb::pseudoEncodingCompressLevel0 + 2};
 
+// Limits for the per encoder breakdown
+static const int MaxEncoderClasses = 16;
+static const int MaxEncoderTypes = 8;
+
+struct encoderStats
+{
+  unsigned rects;
+  unsigned long long pixels;
+  unsigned long long bytes;
+  double time;
+};
+
+// Plain data, as it is passed between processes
+struct stats
+{
+  double decodeTime;
+  double encodeTime;
+  double realTime;
+  int instances;
+
+  double solidSearchTime;
+  double conversionTime;
+  double analysisTime;
+  double encodingTime;
+
+  double ratio;
+  unsigned long long bytes;
+  unsigned long long rawEquivalent;
+
+  struct encoderStats encoders[MaxEncoderClasses][MaxEncoderTypes];
+};
+
 class DummyOutStream : public rdr::OutStream {
 public:
   DummyOutStream();
@@ -89,8 +138,7 @@ public:
   CConn(const char *filename);
   ~CConn();
 
-  void getStats(double& ratio, unsigned long long& bytes,
-                unsigned long long& rawEquivalent);
+  void getStats(struct stats* s);
 
   virtual void initDone() {};
   virtual void resizeFramebuffer();
@@ -118,7 +166,7 @@ class Manager : public rfb::EncodeManager {
 public:
   Manager(class rfb::SConnection *conn);
 
-  void getStats(double&, unsigned long long&, unsigned long long&);
+  void getStats(struct stats* s);
 };
 
 class SConn : public rfb::SConnection {
@@ -128,7 +176,7 @@ public:
 
   void writeUpdate(const rfb::UpdateInfo& ui, const rfb::PixelBuffer* pb);
 
-  void getStats(double&, unsigned long long&, unsigned long long&);
+  void getStats(struct stats* s);
 
   virtual void setAccessRights(AccessRights ar);
 
@@ -188,7 +236,11 @@ CConn::CConn(const char *filename)
 
   sc = new SConn();
   sc->client.setPF((bool)translate ? fbPF : pf);
-  sc->setEncodings(sizeof(encodings) / sizeof(*encodings), encodings);
+  std::vector<rdr::S32> encs(encodings, encodings +
+                             sizeof(encodings) / sizeof(*encodings));
+  if (zstd)
+    encs.push_back(rfb::encodingTightZstd);
+  sc->setEncodings(encs.size(), &encs[0]);
 }
 
 CConn::~CConn()
@@ -198,10 +250,9 @@ CConn::~CConn()
   delete out;
 }
 
-void CConn::getStats(double& ratio, unsigned long long& bytes,
-                     unsigned long long& rawEquivalent)
+void CConn::getStats(struct stats* s)
 {
-  sc->getStats(ratio, bytes, rawEquivalent);
+  sc->getStats(s);
 }
 
 void CConn::resizeFramebuffer()
@@ -276,26 +327,39 @@ void CConn::serverCutText(const char*)
 Manager::Manager(class rfb::SConnection *conn) :
   EncodeManager(conn)
 {
+  stageTiming = true;
 }
 
-void Manager::getStats(double& ratio, unsigned long long& encodedBytes,
-                       unsigned long long& rawEquivalent)
+void Manager::getStats(struct stats* s)
 {
-  StatsVector::iterator iter;
   unsigned long long bytes, equivalent;
 
+  memset(s->encoders, 0, sizeof(s->encoders));
+
   bytes = equivalent = 0;
-  for (iter = stats.begin(); iter != stats.end(); ++iter) {
-    StatsVector::value_type::iterator iter2;
-    for (iter2 = iter->begin(); iter2 != iter->end(); ++iter2) {
-      bytes += iter2->bytes;
-      equivalent += iter2->equivalent;
+  for (size_t i = 0; i < stats.size(); i++) {
+    for (size_t j = 0; j < stats[i].size(); j++) {
+      bytes += stats[i][j].bytes;
+      equivalent += stats[i][j].equivalent;
+
+      if ((i >= MaxEncoderClasses) || (j >= MaxEncoderTypes))
+        continue;
+
+      s->encoders[i][j].rects = stats[i][j].rects;
+      s->encoders[i][j].pixels = stats[i][j].pixels;
+      s->encoders[i][j].bytes = stats[i][j].bytes;
+      s->encoders[i][j].time = stats[i][j].time / 1000000.0;
     }
   }
 
-  ratio = (double)equivalent / bytes;
-  encodedBytes = bytes;
-  rawEquivalent = equivalent;
+  s->ratio = (double)equivalent / bytes;
+  s->bytes = bytes;
+  s->rawEquivalent = equivalent;
+
+  s->solidSearchTime = stageStats.solidSearch / 1000000.0;
+  s->conversionTime = stageStats.conversion / 1000000.0;
+  s->analysisTime = stageStats.analysis / 1000000.0;
+  s->encodingTime = stageStats.encoding / 1000000.0;
 }
 
 SConn::SConn()
@@ -319,10 +383,9 @@ void SConn::writeUpdate(const rfb::UpdateInfo& ui, const rfb::PixelBuffer* pb)
   manager->writeUpdate(ui, pb, NULL);
 }
 
-void SConn::getStats(double& ratio, unsigned long long& bytes,
-                     unsigned long long& rawEquivalent)
+void SConn::getStats(struct stats* s)
 {
-  manager->getStats(ratio, bytes, rawEquivalent);
+  manager->getStats(s);
 }
 
 void SConn::setAccessRights(AccessRights ar)
@@ -334,17 +397,6 @@ void SConn::setDesktopSize(int fb_width, int fb_height,
 {
 }
 
-struct stats
-{
-  double decodeTime;
-  double encodeTime;
-  double realTime;
-
-  double ratio;
-  unsigned long long bytes;
-  unsigned long long rawEquivalent;
-};
-
 static struct stats runTest(const char *fn)
 {
   CConn *cc;
@@ -375,13 +427,110 @@ static struct stats runTest(const char *fn)
   s.encodeTime = cc->encodeTime;
   s.realTime = (double)stop.tv_sec - start.tv_sec;
   s.realTime += ((double)stop.tv_usec - start.tv_usec)/1000000.0;
-  cc->getStats(s.ratio, s.bytes, s.rawEquivalent);
+  s.instances = 1;
+  cc->getStats(&s);
 
   delete cc;
 
   return s;
 }
 
+#ifndef WIN32
+static struct stats runConcurrentTest(const char *fn, int instances)
+{
+  std::vector<pid_t> pids(instances);
+  std::vector<int> fds(instances);
+  struct stats s, total;
+  struct timeval start, stop;
+
+  gettimeofday(&start, NULL);
+
+  for (int i = 0; i < instances; i++) {
+    int pipefds[2];
+
+    if (pipe(pipefds) < 0) {
+      perror("Failed to create pipe");
+      exit(1);
+    }
+
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      perror("Failed to create process");
+      exit(1);
+    }
+
+    if (pids[i] == 0) {
+      close(pipefds[0]);
+      s = runTest(fn);
+      if (write(pipefds[1], &s, sizeof(s)) != sizeof(s))
+        _exit(1);
+      _exit(0);
+    }
+
+    close(pipefds[1]);
+    fds[i] = pipefds[0];
+  }
+
+  memset(&total, 0, sizeof(total));
+
+  for (int i = 0; i < instances; i++) {
+    size_t len;
+    int status;
+
+    len = 0;
+    while (len < sizeof(s)) {
+      ssize_t ret;
+      ret = read(fds[i], (char*)&s + len, sizeof(s) - len);
+      if (ret <= 0) {
+        fprintf(stderr, "Encoder instance failed\n");
+        exit(1);
+      }
+      len += ret;
+    }
+
+    close(fds[i]);
+    waitpid(pids[i], &status, 0);
+
+    // CPU usage is reported per instance, which shows how much each
+    // one suffers from contention
+    total.decodeTime += s.decodeTime / instances;
+    total.encodeTime += s.encodeTime / instances;
+    total.solidSearchTime += s.solidSearchTime / instances;
+    total.conversionTime += s.conversionTime / instances;
+    total.analysisTime += s.analysisTime / instances;
+    total.encodingTime += s.encodingTime / instances;
+
+    if (i == 0) {
+      total.ratio = s.ratio;
+      total.bytes = s.bytes;
+      total.rawEquivalent = s.rawEquivalent;
+      memcpy(total.encoders, s.encoders, sizeof(s.encoders));
+    }
+  }
+
+  gettimeofday(&stop, NULL);
+
+  total.realTime = (double)stop.tv_sec - start.tv_sec;
+  total.realTime += ((double)stop.tv_usec - start.tv_usec)/1000000.0;
+  total.instances = instances;
+
+  return total;
+}
+#endif
+
+static struct stats runTests(const char *fn)
+{
+  if (concurrency <= 1)
+    return runTest(fn);
+
+#ifdef WIN32
+  fprintf(stderr, "Concurrent instances not supported on this platform\n");
+  exit(1);
+#else
+  return runConcurrentTest(fn, concurrency);
+#endif
+}
+
 static void sort(double *array, int count)
 {
   bool sorted;
@@ -400,6 +549,27 @@ static void sort(double *array, int count)
   } while (!sorted);
 }
 
+static void calcMedian(double *values, int count,
+                       double *median, double *meddev)
+{
+  double *dev = new double[count];
+
+  sort(values, count);
+  *median = values[count/2];
+
+  for (int i = 0;i < count;i++) {
+    if (*median == 0.0)
+      dev[i] = 0.0;
+    else
+      dev[i] = fabs((values[i] - *median) / *median) * 100;
+  }
+
+  sort(dev, count);
+  *meddev = dev[count/2];
+
+  delete [] dev;
+}
+
 static void usage(const char *argv0)
 {
   fprintf(stderr, "Syntax: %s [options] <rfb file>\n", argv0);
@@ -438,8 +608,16 @@ int main(int argc, char **argv)
   int runCount = count;
   struct stats *runs = new struct stats[runCount];
   double *values = new double[runCount];
-  double *dev = new double[runCount];
-  double median, meddev;
+  double decodeMedian, decodeDev, encodeMedian, encodeDev;
+  double coreMedian, coreDev;
+  double stageMedian[4], stageDev[4];
+
+  static const char *stageNames[4] = {
+    "solidSearch", "conversion", "analysis", "encoding"
+  };
+  static const char *stageTitles[4] = {
+    "solid search", "conversion", "analysis", "encoding"
+  };
 
   if (fn == NULL) {
     fprintf(stderr, "No file specified!\n\n");
@@ -457,60 +635,122 @@ int main(int argc, char **argv)
   }
 
   // Warmup
-  runTest(fn);
+  runTests(fn);
 
   // Multiple runs to get a good average
   for (i = 0; i < runCount; i++)
-    runs[i] = runTest(fn);
+    runs[i] = runTests(fn);
 
   // Calculate median and median deviation for CPU usage decoding
   for (i = 0;i < runCount;i++)
     values[i] = runs[i].decodeTime;
-
-  sort(values, runCount);
-  median = values[runCount/2];
-
-  for (i = 0;i < runCount;i++)
-    dev[i] = fabs((values[i] - median) / median) * 100;
-
-  sort(dev, runCount);
-  meddev = dev[runCount/2];
-
-  printf("CPU time (decoding): %g s (+/- %g %%)\n", median, meddev);
+  calcMedian(values, runCount, &decodeMedian, &decodeDev);
 
   // And for CPU usage encoding
   for (i = 0;i < runCount;i++)
     values[i] = runs[i].encodeTime;
+  calcMedian(values, runCount, &encodeMedian, &encodeDev);
 
-  sort(values, runCount);
-  median = values[runCount/2];
-
+  // And for CPU core usage (for all instances)
   for (i = 0;i < runCount;i++)
-    dev[i] = fabs((values[i] - median) / median) * 100;
-
-  sort(dev, runCount);
-  meddev = dev[runCount/2];
-
-  printf("CPU time (encoding): %g s (+/- %g %%)\n", median, meddev);
+    values[i] = (runs[i].decodeTime + runs[i].encodeTime) *
+                runs[i].instances / runs[i].realTime;
+  calcMedian(values, runCount, &coreMedian, &coreDev);
+
+  // And for each stage of the encoding
+  for (int stage = 0;stage < 4;stage++) {
+    for (i = 0;i < runCount;i++) {
+      switch (stage) {
+      case 0:
+        values[i] = runs[i].solidSearchTime;
+        break;
+      case 1:
+        values[i] = runs[i].conversionTime;
+        break;
+      case 2:
+        values[i] = runs[i].analysisTime;
+        break;
+      case 3:
+        values[i] = runs[i].encodingTime;
+        break;
+      }
+    }
+    calcMedian(values, runCount, &stageMedian[stage], &stageDev[stage]);
+  }
 
-  // And for CPU core usage encoding
-  for (i = 0;i < runCount;i++)
-    values[i] = (runs[i].decodeTime + runs[i].encodeTime) / runs[i].realTime;
+  if (json) {
+    bool first;
+
+    printf("{\n");
+    printf("  \"instances\": %d,\n", (int)concurrency);
+    printf("  \"runs\": %d,\n", runCount);
+    printf("  \"decodeCpu\": { \"median\": %g, \"deviation\": %g },\n",
+           decodeMedian, decodeDev);
+    printf("  \"encodeCpu\": { \"median\": %g, \"deviation\": %g },\n",
+           encodeMedian, encodeDev);
+    printf("  \"coreUsage\": { \"median\": %g, \"deviation\": %g },\n",
+           coreMedian, coreDev);
+    printf("  \"stages\": {\n");
+    for (int stage = 0;stage < 4;stage++) {
+      printf("    \"%s\": { \"median\": %g, \"deviation\": %g }%s\n",
+             stageNames[stage], stageMedian[stage], stageDev[stage],
+             stage == 3 ? "" : ",");
+    }
+    printf("  },\n");
+    printf("  \"encodedBytes\": %llu,\n", runs[0].bytes);
+    printf("  \"rawEquivalentBytes\": %llu,\n", runs[0].rawEquivalent);
+    printf("  \"ratio\": %g,\n", runs[0].ratio);
+    printf("  \"encoders\": [");
+    first = true;
+    for (int klass = 0;klass < MaxEncoderClasses;klass++) {
+      for (int type = 0;type < MaxEncoderTypes;type++) {
+        const struct encoderStats *e = &runs[0].encoders[klass][type];
+        if (e->rects == 0)
+          continue;
+        printf("%s\n    { \"class\": \"%s\", \"type\": \"%s\", "
+               "\"rects\": %u, \"pixels\": %llu, \"bytes\": %llu, "
+               "\"time\": %g }",
+               first ? "" : ",",
+               rfb::EncodeManager::encoderClassName(klass),
+               rfb::EncodeManager::encoderTypeName(type),
+               e->rects, e->pixels, e->bytes, e->time);
+        first = false;
+      }
+    }
+    printf("\n  ]\n");
+    printf("}\n");
 
-  sort(values, runCount);
-  median = values[runCount/2];
+    return 0;
+  }
 
-  for (i = 0;i < runCount;i++)
-    dev[i] = fabs((values[i] - median) / median) * 100;
+  if (concurrency > 1)
+    printf("Instances: %d (CPU times are per instance)\n", (int)concurrency);
 
-  sort(dev, runCount);
-  meddev = dev[runCount/2];
+  printf("CPU time (decoding): %g s (+/- %g %%)\n", decodeMedian, decodeDev);
+  printf("CPU time (encoding): %g s (+/- %g %%)\n", encodeMedian, encodeDev);
+  printf("Core usage (total): %g (+/- %g %%)\n", coreMedian, coreDev);
 
-  printf("Core usage (total): %g (+/- %g %%)\n", median, meddev);
+  for (int stage = 0;stage < 4;stage++) {
+    printf("Time (%s): %g s (+/- %g %%)\n", stageTitles[stage],
+           stageMedian[stage], stageDev[stage]);
+  }
 
   printf("Encoded bytes: %llu\n", runs[0].bytes);
   printf("Raw equivalent bytes: %llu\n", runs[0].rawEquivalent);
   printf("Ratio: %g\n", runs[0].ratio);
 
+  printf("Encoders (first run):\n");
+  for (int klass = 0;klass < MaxEncoderClasses;klass++) {
+    for (int type = 0;type < MaxEncoderTypes;type++) {
+      const struct encoderStats *e = &runs[0].encoders[klass][type];
+      if (e->rects == 0)
+        continue;
+      printf("  %s, %s: %u rects, %llu pixels, %llu bytes, %g s\n",
+             rfb::EncodeManager::encoderClassName(klass),
+             rfb::EncodeManager::encoderTypeName(type),
+             e->rects, e->pixels, e->bytes, e->time);
+    }
+  }
+
   return 0;
 }
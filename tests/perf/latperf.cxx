@@ -0,0 +1,762 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program measures the time from a viewer sending input until it
+ * has decoded the resulting change to the frame buffer. A real server
+ * (VNCServerST) and real viewers (CConnection) are run in the same
+ * process and talk over socket pairs. The synthetic desktop toggles a
+ * marker between black and white on every key press, which means the
+ * measurement survives lossy encodings. An animated area can be added
+ * to put the encoder under load, as can further viewers, and a relay
+ * can be inserted in each connection to simulate a slow or distant
+ * network.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/FdInStream.h>
+#include <rdr/FdOutStream.h>
+
+#include <network/Socket.h>
+
+#include <rfb/CConnection.h>
+#include <rfb/CMsgWriter.h>
+#include <rfb/CSecurity.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SDesktop.h>
+#include <rfb/SecurityClient.h>
+#include <rfb/SecurityServer.h>
+#include <rfb/Timer.h>
+#include <rfb/VNCServerST.h>
+#include <rfb/encodings.h>
+
+#include "util.h"
+
+static rfb::IntParameter width("width", "Frame buffer width", 1280);
+static rfb::IntParameter height("height", "Frame buffer height", 720);
+static rfb::IntParameter samples("samples",
+                                 "Number of latency samples to collect",
+                                 200);
+static rfb::IntParameter interval("interval",
+                                  "Time between input events (ms)", 20);
+
+static rfb::IntParameter animationSize("animationSize",
+                                       "Size of an animated square in the "
+                                       "middle of the screen (0 to disable)",
+                                       0);
+static rfb::IntParameter animationRate("animationRate",
+                                       "Frames per second for the animation",
+                                       60);
+
+static rfb::IntParameter viewers("viewers",
+                                 "Number of connected viewers", 1);
+
+static rfb::IntParameter bandwidth("bandwidth",
+                                   "Simulated link bandwidth in kbit/s "
+                                   "(0 for unlimited)", 0);
+static rfb::IntParameter latency("latency",
+                                 "Simulated one-way link latency (ms)", 0);
+
+static rfb::StringParameter encoding("encoding",
+                                     "Preferred encoding", "Tight");
+static rfb::IntParameter quality("quality",
+                                 "JPEG quality level (-1 for lossless)", -1);
+
+static rfb::BoolParameter json("json",
+                               "Print the results as JSON", false);
+
+// The frame buffer is always this format
+static const rfb::PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+
+// Input events that are not answered within this time are lost
+static const unsigned long long inputTimeout = 5000000;
+
+static const rfb::Rect markerRect(0, 0, 32, 32);
+
+// The input event currently being waited on
+static struct {
+  bool active;
+  bool white;
+  unsigned long long sent;
+  int pending;
+} probe;
+
+class Desktop : public rfb::SDesktop {
+public:
+  Desktop();
+  ~Desktop();
+
+  virtual void start(rfb::VNCServer* vs);
+  virtual void stop();
+  virtual void queryConnection(network::Socket* sock,
+                               const char* userName);
+  virtual void terminate();
+
+  virtual void keyEvent(rdr::U32 keysym, rdr::U32 keycode, bool down);
+
+protected:
+  bool handleAnimationTimeout(rfb::Timer* t);
+
+protected:
+  rfb::VNCServer* server;
+  rfb::ManagedPixelBuffer* pb;
+  rfb::MethodTimer<Desktop> animationTimer;
+  unsigned frame;
+};
+
+class Viewer : public HeadlessViewer {
+public:
+  Viewer(int fd);
+  ~Viewer();
+
+  network::Socket* getSocket() { return sock; }
+
+  bool isReady() { return ready; }
+
+  void sendInput(bool white);
+  void resetProbe() { seen = false; }
+
+  virtual void framebufferUpdateEnd();
+
+public:
+  std::vector<double> latencies;
+
+protected:
+  bool markerIsWhite();
+
+protected:
+  LoopbackSocket* sock;
+  bool ready;
+  bool seen;
+};
+
+// Simulates a network link by delaying and rate limiting everything
+// that passes through it in either direction
+class Link {
+public:
+  Link(int serverFd, int clientFd);
+  ~Link();
+
+  void prepare(fd_set* rfds, fd_set* wfds, int* nfds,
+               unsigned long long* deadline);
+  void process(fd_set* rfds, fd_set* wfds);
+
+protected:
+  struct Packet {
+    unsigned long long due;
+    std::vector<rdr::U8> data;
+    size_t offset;
+  };
+
+  struct Direction {
+    int from, to;
+    std::deque<Packet> queue;
+    size_t queued;
+    unsigned long long busyUntil;
+  };
+
+  void prepare(Direction* dir, fd_set* rfds, fd_set* wfds, int* nfds,
+               unsigned long long* deadline);
+  void process(Direction* dir, fd_set* rfds, fd_set* wfds);
+
+  // Roughly what a router would buffer before dropping packets
+  size_t queueLimit();
+
+protected:
+  Direction up, down;
+};
+
+Desktop::Desktop()
+  : server(NULL), animationTimer(this, &Desktop::handleAnimationTimeout),
+    frame(0)
+{
+  rdr::U8 black[4];
+
+  pb = new rfb::ManagedPixelBuffer(fbPF, width, height);
+
+  memset(black, 0, sizeof(black));
+  pb->fillRect(pb->getRect(), black);
+}
+
+Desktop::~Desktop()
+{
+  delete pb;
+}
+
+void Desktop::start(rfb::VNCServer* vs)
+{
+  server = vs;
+  server->setPixelBuffer(pb);
+
+  if ((animationSize > 0) && (animationRate > 0))
+    animationTimer.start(1000 / animationRate);
+}
+
+void Desktop::stop()
+{
+  animationTimer.stop();
+  server = NULL;
+}
+
+void Desktop::queryConnection(network::Socket* sock, const char*)
+{
+  server->approveConnection(sock, true, NULL);
+}
+
+void Desktop::terminate()
+{
+}
+
+void Desktop::keyEvent(rdr::U32 keysym, rdr::U32, bool down)
+{
+  rdr::U8 rgb[3], pix[4];
+
+  if (!down)
+    return;
+
+  memset(rgb, keysym == '1' ? 255 : 0, sizeof(rgb));
+  fbPF.bufferFromRGB(pix, rgb, 1);
+  pb->fillRect(markerRect, pix);
+
+  server->add_changed(markerRect);
+}
+
+bool Desktop::handleAnimationTimeout(rfb::Timer* /*t*/)
+{
+  rfb::Rect r;
+  rdr::U8* buffer;
+  int stride;
+
+  r.tl.x = (pb->width() - animationSize) / 2;
+  r.tl.y = (pb->height() - animationSize) / 2;
+  r.br.x = r.tl.x + animationSize;
+  r.br.y = r.tl.y + animationSize;
+  r = r.intersect(pb->getRect());
+
+  // Moving gradients with a bit of noise, so it is neither trivial to
+  // compress nor pure noise
+  buffer = pb->getBufferRW(r, &stride);
+  for (int y = 0;y < r.height();y++) {
+    rdr::U8* pixel = buffer + y * stride * 4;
+    for (int x = 0;x < r.width();x++) {
+      rdr::U8 rgb[3];
+      rgb[0] = x + frame * 3;
+      rgb[1] = y + frame * 2;
+      rgb[2] = (x ^ y) + (rand() & 0x0f);
+      fbPF.bufferFromRGB(pixel, rgb, 1);
+      pixel += 4;
+    }
+  }
+  pb->commitBufferRW(r);
+
+  frame++;
+
+  server->add_changed(r);
+
+  return true;
+}
+
+Viewer::Viewer(int fd)
+  : ready(false), seen(false)
+{
+  sock = new LoopbackSocket(fd);
+
+  setStreams(&sock->inStream(), &sock->outStream());
+  setShared(true);
+
+  setPreferredEncoding(rfb::encodingNum(encoding));
+  setQualityLevel(quality);
+
+  initialiseProtocol();
+}
+
+Viewer::~Viewer()
+{
+  delete sock;
+}
+
+void Viewer::sendInput(bool white)
+{
+  rdr::U32 keysym;
+
+  keysym = white ? '1' : '0';
+
+  writer()->writeKeyEvent(keysym, 0, true);
+  writer()->writeKeyEvent(keysym, 0, false);
+}
+
+void Viewer::framebufferUpdateEnd()
+{
+  CConnection::framebufferUpdateEnd();
+
+  ready = true;
+
+  if (!probe.active || seen)
+    return;
+
+  if (markerIsWhite() != probe.white)
+    return;
+
+  latencies.push_back((now() - probe.sent) / 1000.0);
+  seen = true;
+  probe.pending--;
+}
+
+bool Viewer::markerIsWhite()
+{
+  const rfb::PixelBuffer* pb;
+  rfb::Rect r;
+  const rdr::U8* buffer;
+  int stride;
+  rdr::U8 rgb[3];
+
+  pb = getFramebuffer();
+
+  // Sample the centre to stay clear of any blending at the edges
+  r.tl = markerRect.tl.translate(rfb::Point(markerRect.width() / 2,
+                                            markerRect.height() / 2));
+  r.br = r.tl.translate(rfb::Point(1, 1));
+
+  buffer = pb->getBuffer(r, &stride);
+  pb->getPF().rgbFromBuffer(rgb, buffer, 1);
+
+  return (rgb[0] + rgb[1] + rgb[2]) > 3 * 128;
+}
+
+Link::Link(int serverFd, int clientFd)
+{
+  up.from = clientFd;
+  up.to = serverFd;
+  up.queued = 0;
+  up.busyUntil = 0;
+
+  down.from = serverFd;
+  down.to = clientFd;
+  down.queued = 0;
+  down.busyUntil = 0;
+}
+
+Link::~Link()
+{
+  close(up.from);
+  close(up.to);
+}
+
+void Link::prepare(fd_set* rfds, fd_set* wfds, int* nfds,
+                   unsigned long long* deadline)
+{
+  prepare(&up, rfds, wfds, nfds, deadline);
+  prepare(&down, rfds, wfds, nfds, deadline);
+}
+
+void Link::process(fd_set* rfds, fd_set* wfds)
+{
+  process(&up, rfds, wfds);
+  process(&down, rfds, wfds);
+}
+
+void Link::prepare(Direction* dir, fd_set* rfds, fd_set* wfds,
+                   int* nfds, unsigned long long* deadline)
+{
+  if (dir->queued < queueLimit()) {
+    FD_SET(dir->from, rfds);
+    *nfds = std::max(*nfds, dir->from + 1);
+  }
+
+  if (dir->queue.empty())
+    return;
+
+  if (dir->queue.front().due <= now()) {
+    FD_SET(dir->to, wfds);
+    *nfds = std::max(*nfds, dir->to + 1);
+  } else {
+    *deadline = std::min(*deadline, dir->queue.front().due);
+  }
+}
+
+void Link::process(Direction* dir, fd_set* rfds, fd_set* wfds)
+{
+  if (FD_ISSET(dir->from, rfds)) {
+    Packet packet;
+    rdr::U8 buf[16384];
+    ssize_t len;
+
+    len = recv(dir->from, buf, sizeof(buf), MSG_DONTWAIT);
+    if (len == 0)
+      throw rdr::EndOfStream();
+    if (len < 0) {
+      if ((errno != EAGAIN) && (errno != EINTR))
+        throw rdr::SystemException("recv", errno);
+    } else {
+      unsigned long long start;
+
+      // Data is serialised on the link, so it first has to wait for
+      // whatever is already being sent
+      start = std::max(now(), dir->busyUntil);
+      if (bandwidth > 0)
+        dir->busyUntil = start + len * 8000ULL / bandwidth;
+      else
+        dir->busyUntil = start;
+
+      packet.due = dir->busyUntil + latency * 1000ULL;
+      packet.data.assign(buf, buf + len);
+      packet.offset = 0;
+
+      dir->queue.push_back(packet);
+      dir->queued += len;
+    }
+  }
+
+  if (FD_ISSET(dir->to, wfds)) {
+    while (!dir->queue.empty() && (dir->queue.front().due <= now())) {
+      Packet* packet;
+      ssize_t len;
+
+      packet = &dir->queue.front();
+
+      len = send(dir->to, &packet->data[packet->offset],
+                 packet->data.size() - packet->offset, MSG_DONTWAIT);
+      if (len < 0) {
+        if ((errno != EAGAIN) && (errno != EINTR))
+          throw rdr::SystemException("send", errno);
+        break;
+      }
+
+      packet->offset += len;
+      dir->queued -= len;
+
+      if (packet->offset < packet->data.size())
+        break;
+
+      dir->queue.pop_front();
+    }
+  }
+}
+
+size_t Link::queueLimit()
+{
+  // Without a bandwidth limit there is nothing for a queue to build
+  // up behind, so only latency should be simulated
+  if (bandwidth == 0)
+    return 64 * 1024 * 1024;
+
+  // A bandwidth-delay product's worth of data, and some extra
+  return (size_t)bandwidth * 125 * (latency * 2 + 100) / 1000 + 65536;
+}
+
+static void createConnection(rfb::VNCServerST* server,
+                             std::vector<Viewer*>* viewerList,
+                             std::vector<Link*>* links)
+{
+  int fds[2];
+  LoopbackSocket* sock;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    throw rdr::SystemException("socketpair", errno);
+
+  sock = new LoopbackSocket(fds[0]);
+  server->addSocket(sock);
+
+  if ((bandwidth == 0) && (latency == 0)) {
+    viewerList->push_back(new Viewer(fds[1]));
+    return;
+  }
+
+  int relayFds[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, relayFds) < 0)
+    throw rdr::SystemException("socketpair", errno);
+
+  links->push_back(new Link(fds[1], relayFds[0]));
+  viewerList->push_back(new Viewer(relayFds[1]));
+}
+
+static void runTest(std::vector<Viewer*>* viewerList, int* lost)
+{
+  Desktop desktop;
+  rfb::VNCServerST server("latperf", &desktop);
+  std::vector<Link*> links;
+  std::list<network::Socket*> sockets;
+  std::list<network::Socket*>::iterator si;
+  std::vector<Viewer*>::iterator vi;
+  std::vector<Link*>::iterator li;
+  unsigned long long nextInput;
+  bool white;
+
+  for (int i = 0;i < viewers;i++)
+    createConnection(&server, viewerList, &links);
+
+  *lost = 0;
+  white = false;
+  nextInput = 0;
+  probe.active = false;
+
+  while ((int)(*viewerList)[0]->latencies.size() + *lost < samples) {
+    fd_set rfds, wfds;
+    int nfds, timeout;
+    unsigned long long deadline;
+    struct timeval tv;
+
+    // Time for a new input event?
+    if (probe.active) {
+      if (probe.pending == 0)
+        probe.active = false;
+      else if (now() - probe.sent > inputTimeout) {
+        probe.active = false;
+        (*lost)++;
+      }
+
+      if (!probe.active)
+        nextInput = now() + interval * 1000ULL;
+    }
+
+    if (!probe.active && (now() >= nextInput)) {
+      bool allReady;
+
+      allReady = true;
+      for (vi = viewerList->begin(); vi != viewerList->end(); ++vi)
+        allReady = allReady && (*vi)->isReady();
+
+      if (allReady) {
+        white = !white;
+
+        probe.active = true;
+        probe.white = white;
+        probe.pending = viewerList->size();
+        probe.sent = now();
+
+        for (vi = viewerList->begin(); vi != viewerList->end(); ++vi)
+          (*vi)->resetProbe();
+
+        (*viewerList)[0]->sendInput(white);
+      } else {
+        // Still setting up, so check back in a while
+        nextInput = now() + 1000;
+      }
+    }
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    nfds = 0;
+
+    if (probe.active)
+      deadline = probe.sent + inputTimeout;
+    else
+      deadline = nextInput;
+
+    server.getSockets(&sockets);
+    for (si = sockets.begin(); si != sockets.end(); ++si) {
+      if ((*si)->isShutdown())
+        throw rdr::Exception("Server closed a connection");
+      FD_SET((*si)->getFd(), &rfds);
+      if ((*si)->outStream().hasBufferedData())
+        FD_SET((*si)->getFd(), &wfds);
+      nfds = std::max(nfds, (*si)->getFd() + 1);
+    }
+
+    for (vi = viewerList->begin(); vi != viewerList->end(); ++vi) {
+      network::Socket* sock = (*vi)->getSocket();
+      FD_SET(sock->getFd(), &rfds);
+      if (sock->outStream().hasBufferedData())
+        FD_SET(sock->getFd(), &wfds);
+      nfds = std::max(nfds, sock->getFd() + 1);
+    }
+
+    for (li = links.begin(); li != links.end(); ++li)
+      (*li)->prepare(&rfds, &wfds, &nfds, &deadline);
+
+    timeout = rfb::Timer::checkTimeouts();
+
+    if (deadline > now()) {
+      unsigned long long delay;
+
+      delay = deadline - now();
+      if ((timeout > 0) && (delay > (unsigned long long)timeout * 1000))
+        delay = timeout * 1000ULL;
+
+      tv.tv_sec = delay / 1000000;
+      tv.tv_usec = delay % 1000000;
+    } else {
+      tv.tv_sec = 0;
+      tv.tv_usec = 0;
+    }
+
+    if (select(nfds, &rfds, &wfds, NULL, &tv) < 0) {
+      if (errno == EINTR)
+        continue;
+      throw rdr::SystemException("select", errno);
+    }
+
+    rfb::Timer::checkTimeouts();
+
+    for (si = sockets.begin(); si != sockets.end(); ++si) {
+      if (FD_ISSET((*si)->getFd(), &rfds))
+        server.processSocketReadEvent(*si);
+      if (FD_ISSET((*si)->getFd(), &wfds))
+        server.processSocketWriteEvent(*si);
+    }
+
+    for (li = links.begin(); li != links.end(); ++li)
+      (*li)->process(&rfds, &wfds);
+
+    for (vi = viewerList->begin(); vi != viewerList->end(); ++vi) {
+      network::Socket* sock = (*vi)->getSocket();
+      if (FD_ISSET(sock->getFd(), &rfds)) {
+        while ((*vi)->processMsg())
+          ;
+      }
+      if (FD_ISSET(sock->getFd(), &wfds))
+        sock->outStream().flush();
+    }
+  }
+
+  server.getSockets(&sockets);
+  for (si = sockets.begin(); si != sockets.end(); ++si) {
+    server.removeSocket(*si);
+    delete *si;
+  }
+
+  for (li = links.begin(); li != links.end(); ++li)
+    delete *li;
+}
+
+static void printResult(const char* name, std::vector<double> values,
+                        bool last)
+{
+  double sum;
+
+  std::sort(values.begin(), values.end());
+
+  sum = 0.0;
+  for (size_t i = 0;i < values.size();i++)
+    sum += values[i];
+
+  if (json) {
+    printf("    \"%s\": {\n", name);
+    printf("      \"samples\": %u,\n", (unsigned)values.size());
+    printf("      \"mean\": %g,\n",
+           values.empty() ? 0.0 : sum / values.size());
+    printf("      \"p50\": %g,\n", percentile(values, 50));
+    printf("      \"p90\": %g,\n", percentile(values, 90));
+    printf("      \"p99\": %g,\n", percentile(values, 99));
+    printf("      \"max\": %g\n", values.empty() ? 0.0 : values.back());
+    printf("    }%s\n", last ? "" : ",");
+  } else {
+    printf("Latency (%s): p50 %g ms, p90 %g ms, p99 %g ms, max %g ms "
+           "(mean %g ms, %u samples)\n",
+           name, percentile(values, 50), percentile(values, 90),
+           percentile(values, 99), values.empty() ? 0.0 : values.back(),
+           values.empty() ? 0.0 : sum / values.size(),
+           (unsigned)values.size());
+  }
+}
+
+static const char syntax[] = "[options]";
+
+int main(int argc, char **argv)
+{
+  int i;
+
+  if (!parseParams(argc, argv, syntax).empty())
+    showUsage(argv[0], syntax);
+
+  if ((width <= 0) || (height <= 0) || (viewers <= 0) || (samples <= 0)) {
+    fprintf(stderr, "Invalid parameters!\n\n");
+    showUsage(argv[0], syntax);
+  }
+
+  if (rfb::encodingNum(encoding) == -1) {
+    fprintf(stderr, "Unknown encoding \"%s\"!\n\n", (const char*)encoding);
+    showUsage(argv[0], syntax);
+  }
+
+  // Everything is local, so no need for any authentication
+  rfb::SecurityServer::secTypes.setParam("None");
+  rfb::SecurityClient::secTypes.setParam("None");
+  rfb::CSecurity::upg = new DummyPasswdGetter();
+
+  std::vector<Viewer*> viewerList;
+  std::vector<double> others;
+  int lost;
+
+  try {
+    runTest(&viewerList, &lost);
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Failed to run test: %s\n", e.str());
+    return 1;
+  }
+
+  for (i = 1;i < (int)viewerList.size();i++) {
+    others.insert(others.end(), viewerList[i]->latencies.begin(),
+                  viewerList[i]->latencies.end());
+  }
+
+  if (json) {
+    printf("{\n");
+    printf("  \"configuration\": {\n");
+    printf("    \"width\": %d,\n", (int)width);
+    printf("    \"height\": %d,\n", (int)height);
+    printf("    \"encoding\": \"%s\",\n", (const char*)encoding);
+    printf("    \"quality\": %d,\n", (int)quality);
+    printf("    \"animationSize\": %d,\n", (int)animationSize);
+    printf("    \"animationRate\": %d,\n", (int)animationRate);
+    printf("    \"viewers\": %d,\n", (int)viewers);
+    printf("    \"bandwidth\": %d,\n", (int)bandwidth);
+    printf("    \"latency\": %d\n", (int)latency);
+    printf("  },\n");
+    printf("  \"lost\": %d,\n", lost);
+    printf("  \"results\": {\n");
+    printResult("input", viewerList[0]->latencies, others.empty());
+    if (!others.empty())
+      printResult("others", others, true);
+    printf("  }\n");
+    printf("}\n");
+  } else {
+    printf("Frame buffer: %dx%d\n", (int)width, (int)height);
+    printf("Encoding: %s (quality %d)\n", (const char*)encoding,
+           (int)quality);
+    printf("Animation: %dx%d at %d fps\n", (int)animationSize,
+           (int)animationSize, (int)animationRate);
+    printf("Viewers: %d\n", (int)viewers);
+    printf("Link: %d kbit/s, %d ms latency\n", (int)bandwidth,
+           (int)latency);
+    printf("\n");
+    printResult("input", viewerList[0]->latencies, false);
+    if (!others.empty())
+      printResult("others", others, false);
+    printf("Lost input events: %d\n", lost);
+  }
+
+  for (i = 0;i < (int)viewerList.size();i++)
+    delete viewerList[i];
+
+  return 0;
+}
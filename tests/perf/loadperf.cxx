@@ -0,0 +1,586 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program loads a host with a number of rdp2vnc sessions and
+ * reports how well each of them keeps up. It optionally starts a
+ * local stand-in RDP server (e.g. FreeRDP's sample or shadow server),
+ * launches the rdp2vnc instances against it and connects a headless
+ * viewer to each one over a UNIX socket. The viewers use continuous
+ * updates and regularly send fences to measure how quickly each
+ * session responds. CPU usage and memory is sampled from /proc.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/FdInStream.h>
+#include <rdr/FdOutStream.h>
+
+#include <network/UnixSocket.h>
+
+#include <rfb/CConnection.h>
+#include <rfb/CMsgWriter.h>
+#include <rfb/CSecurity.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SecurityClient.h>
+#include <rfb/encodings.h>
+#include <rfb/fenceTypes.h>
+
+#include "util.h"
+
+static rfb::IntParameter sessions("sessions",
+                                  "Number of rdp2vnc sessions", 4);
+
+static rfb::StringParameter rdp2vnc("rdp2vnc",
+                                    "Path to the rdp2vnc binary", "rdp2vnc");
+static rfb::StringParameter rdpArgs("rdpArgs",
+                                    "Arguments for the RDP connection "
+                                    "(passed on after -RdpArg)",
+                                    "/v:localhost /cert:ignore");
+
+static rfb::StringParameter rdpProfile("rdpProfile",
+                                       "RDP profile for the sessions (see "
+                                       "RdpProfile in rdp2vnc)", "Default");
+
+static rfb::StringParameter rdpServer("rdpServer",
+                                      "Command that starts a local RDP "
+                                      "server (empty to use an already "
+                                      "running server)", "");
+static rfb::IntParameter rdpServerDelay("rdpServerDelay",
+                                        "Time to wait for the RDP server "
+                                        "to start (ms)", 2000);
+
+static rfb::IntParameter connectTimeout("connectTimeout",
+                                        "Time to wait for all sessions to "
+                                        "accept connections (s)", 60);
+static rfb::IntParameter warmup("warmup",
+                                "Time before measurements start (s)", 5);
+static rfb::IntParameter duration("duration",
+                                  "Length of the measurement (s)", 30);
+static rfb::IntParameter pingInterval("pingInterval",
+                                      "Time between fences (ms)", 100);
+
+static rfb::StringParameter encoding("encoding",
+                                     "Preferred encoding", "Tight");
+static rfb::IntParameter quality("quality",
+                                 "JPEG quality level (-1 for lossless)", -1);
+
+static rfb::BoolParameter json("json",
+                               "Print the results as JSON", false);
+
+static const char pingData[] = "loadperf";
+
+class Session : public HeadlessViewer {
+public:
+  Session(pid_t pid, const char* path);
+  ~Session();
+
+  pid_t getPid() { return pid; }
+  const char* getPath() { return path.c_str(); }
+
+  bool connect();
+  network::Socket* getSocket() { return sock; }
+
+  void ping();
+
+  // Resets the counters at the start of the measurement
+  void startMeasuring();
+  void stopMeasuring();
+
+  virtual void framebufferUpdateEnd();
+  virtual void fence(rdr::U32 flags, unsigned len, const char data[]);
+
+public:
+  unsigned updates;
+  unsigned long long bytes;
+  std::vector<double> latencies;
+
+  unsigned long long cpuTime;
+  unsigned long rss;
+
+protected:
+  pid_t pid;
+  std::string path;
+  network::UnixSocket* sock;
+
+  bool pingPending;
+  unsigned long long pingSent;
+
+  unsigned long long startBytes;
+  unsigned long long startCpu;
+};
+
+static bool readProcStat(pid_t pid, unsigned long long* cpuTime)
+{
+  char fn[64], buf[1024];
+  FILE* f;
+  const char* p;
+  unsigned long utime, stime;
+
+  snprintf(fn, sizeof(fn), "/proc/%d/stat", (int)pid);
+  f = fopen(fn, "r");
+  if (f == NULL)
+    return false;
+
+  if (fgets(buf, sizeof(buf), f) == NULL) {
+    fclose(f);
+    return false;
+  }
+  fclose(f);
+
+  // The command name can contain anything, so skip past it
+  p = strrchr(buf, ')');
+  if (p == NULL)
+    return false;
+
+  if (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &utime, &stime) != 2)
+    return false;
+
+  *cpuTime = (unsigned long long)(utime + stime) * 1000000 /
+             sysconf(_SC_CLK_TCK);
+
+  return true;
+}
+
+static unsigned long readRss(pid_t pid)
+{
+  char fn[64], buf[256];
+  FILE* f;
+  unsigned long rss;
+
+  snprintf(fn, sizeof(fn), "/proc/%d/status", (int)pid);
+  f = fopen(fn, "r");
+  if (f == NULL)
+    return 0;
+
+  rss = 0;
+  while (fgets(buf, sizeof(buf), f) != NULL) {
+    if (sscanf(buf, "VmRSS: %lu kB", &rss) == 1)
+      break;
+  }
+
+  fclose(f);
+
+  return rss;
+}
+
+static std::vector<std::string> splitArgs(const char* str)
+{
+  std::vector<std::string> args;
+  std::string arg;
+
+  for (; *str != '\0'; str++) {
+    if (*str == ' ') {
+      if (!arg.empty())
+        args.push_back(arg);
+      arg.clear();
+    } else {
+      arg += *str;
+    }
+  }
+
+  if (!arg.empty())
+    args.push_back(arg);
+
+  return args;
+}
+
+static pid_t spawn(const std::vector<std::string>& args)
+{
+  std::vector<char*> argv;
+  pid_t pid;
+
+  for (size_t i = 0;i < args.size();i++)
+    argv.push_back(const_cast<char*>(args[i].c_str()));
+  argv.push_back(NULL);
+
+  pid = fork();
+  if (pid < 0)
+    throw rdr::SystemException("fork", errno);
+
+  if (pid == 0) {
+    execvp(argv[0], &argv[0]);
+    fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(errno));
+    _exit(1);
+  }
+
+  return pid;
+}
+
+Session::Session(pid_t pid_, const char* path_)
+  : updates(0), bytes(0), cpuTime(0), rss(0),
+    pid(pid_), path(path_), sock(NULL),
+    pingPending(false), pingSent(0), startBytes(0), startCpu(0)
+{
+  setShared(true);
+
+  setPreferredEncoding(rfb::encodingNum(encoding));
+  setQualityLevel(quality);
+}
+
+Session::~Session()
+{
+  delete sock;
+}
+
+bool Session::connect()
+{
+  try {
+    sock = new network::UnixSocket(path.c_str());
+  } catch (rdr::Exception&) {
+    // Probably still connecting to the RDP server
+    return false;
+  }
+
+  setStreams(&sock->inStream(), &sock->outStream());
+  initialiseProtocol();
+
+  return true;
+}
+
+void Session::ping()
+{
+  if (pingPending)
+    return;
+  if (state() != RFBSTATE_NORMAL)
+    return;
+  if (!server.supportsFence)
+    return;
+
+  writer()->writeFence(rfb::fenceFlagRequest, sizeof(pingData), pingData);
+
+  pingPending = true;
+  pingSent = now();
+}
+
+void Session::startMeasuring()
+{
+  updates = 0;
+  latencies.clear();
+
+  startBytes = sock->inStream().pos();
+  readProcStat(pid, &startCpu);
+}
+
+void Session::stopMeasuring()
+{
+  unsigned long long cpu;
+
+  bytes = sock->inStream().pos() - startBytes;
+
+  if (readProcStat(pid, &cpu))
+    cpuTime = cpu - startCpu;
+
+  rss = readRss(pid);
+
+  std::sort(latencies.begin(), latencies.end());
+}
+
+void Session::framebufferUpdateEnd()
+{
+  CConnection::framebufferUpdateEnd();
+
+  updates++;
+}
+
+void Session::fence(rdr::U32 flags, unsigned len, const char data[])
+{
+  CMsgHandler::fence(flags, len, data);
+
+  if (flags & rfb::fenceFlagRequest) {
+    // No synchronisation needed, just like CConnection
+    writer()->writeFence(0, len, data);
+    return;
+  }
+
+  if ((len != sizeof(pingData)) || (memcmp(data, pingData, len) != 0))
+    return;
+
+  latencies.push_back((now() - pingSent) / 1000.0);
+  pingPending = false;
+}
+
+static void connectSessions(std::vector<Session*>* list)
+{
+  unsigned long long deadline;
+  std::vector<Session*>::iterator i;
+
+  deadline = now() + connectTimeout * 1000000ULL;
+
+  for (i = list->begin(); i != list->end(); ++i) {
+    while (!(*i)->connect()) {
+      int status;
+
+      if (waitpid((*i)->getPid(), &status, WNOHANG) == (*i)->getPid())
+        throw rdr::Exception("rdp2vnc for %s exited", (*i)->getPath());
+
+      if (now() > deadline)
+        throw rdr::Exception("Timed out waiting for %s", (*i)->getPath());
+
+      usleep(100000);
+    }
+  }
+}
+
+static void runSessions(std::vector<Session*>* list)
+{
+  std::vector<Session*>::iterator i;
+  unsigned long long start, measureStart, nextPing;
+  bool measuring;
+
+  start = now();
+  measureStart = start + warmup * 1000000ULL;
+  measuring = false;
+  nextPing = start;
+
+  while (true) {
+    fd_set rfds, wfds;
+    int nfds;
+    struct timeval tv;
+    unsigned long long deadline;
+
+    if (!measuring && (now() >= measureStart)) {
+      for (i = list->begin(); i != list->end(); ++i)
+        (*i)->startMeasuring();
+      measuring = true;
+    }
+
+    if (measuring &&
+        (now() >= measureStart + duration * 1000000ULL)) {
+      for (i = list->begin(); i != list->end(); ++i)
+        (*i)->stopMeasuring();
+      break;
+    }
+
+    if (now() >= nextPing) {
+      for (i = list->begin(); i != list->end(); ++i)
+        (*i)->ping();
+      nextPing = now() + pingInterval * 1000ULL;
+    }
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    nfds = 0;
+
+    for (i = list->begin(); i != list->end(); ++i) {
+      network::Socket* sock = (*i)->getSocket();
+      FD_SET(sock->getFd(), &rfds);
+      if (sock->outStream().hasBufferedData())
+        FD_SET(sock->getFd(), &wfds);
+      nfds = std::max(nfds, sock->getFd() + 1);
+    }
+
+    deadline = nextPing;
+    if (!measuring)
+      deadline = std::min(deadline, measureStart);
+
+    if (deadline > now()) {
+      tv.tv_sec = (deadline - now()) / 1000000;
+      tv.tv_usec = (deadline - now()) % 1000000;
+    } else {
+      tv.tv_sec = 0;
+      tv.tv_usec = 0;
+    }
+
+    if (select(nfds, &rfds, &wfds, NULL, &tv) < 0) {
+      if (errno == EINTR)
+        continue;
+      throw rdr::SystemException("select", errno);
+    }
+
+    for (i = list->begin(); i != list->end(); ++i) {
+      network::Socket* sock = (*i)->getSocket();
+      if (FD_ISSET(sock->getFd(), &rfds)) {
+        while ((*i)->processMsg())
+          ;
+      }
+      if (FD_ISSET(sock->getFd(), &wfds))
+        sock->outStream().flush();
+    }
+  }
+}
+
+static void printResults(const std::vector<Session*>& list)
+{
+  double seconds;
+  double totalFps, totalRate, totalCpu;
+  unsigned long totalRss;
+  std::vector<double> allLatencies;
+
+  seconds = duration;
+
+  totalFps = totalRate = totalCpu = 0.0;
+  totalRss = 0;
+
+  if (json) {
+    printf("{\n");
+    printf("  \"profile\": \"%s\",\n", (const char*)rdpProfile);
+    printf("  \"duration\": %d,\n", (int)duration);
+    printf("  \"sessions\": [\n");
+  } else {
+    printf("RDP profile: %s\n\n", (const char*)rdpProfile);
+    printf("Session   FPS     KiB/s    p50 ms   p99 ms   CPU %%    RSS MiB\n");
+  }
+
+  for (size_t i = 0;i < list.size();i++) {
+    Session* s = list[i];
+    double fps, rate, cpu;
+
+    fps = s->updates / seconds;
+    rate = s->bytes / 1024.0 / seconds;
+    cpu = s->cpuTime / 10000.0 / seconds;
+
+    totalFps += fps;
+    totalRate += rate;
+    totalCpu += cpu;
+    totalRss += s->rss;
+    allLatencies.insert(allLatencies.end(),
+                        s->latencies.begin(), s->latencies.end());
+
+    if (json) {
+      printf("    {\n");
+      printf("      \"fps\": %g,\n", fps);
+      printf("      \"rate\": %g,\n", rate);
+      printf("      \"latencyP50\": %g,\n", percentile(s->latencies, 50));
+      printf("      \"latencyP99\": %g,\n", percentile(s->latencies, 99));
+      printf("      \"cpu\": %g,\n", cpu);
+      printf("      \"rss\": %lu\n", s->rss);
+      printf("    }%s\n", (i + 1 < list.size()) ? "," : "");
+    } else {
+      printf("%-9u %-7.1f %-8.1f %-8.2f %-8.2f %-8.1f %.1f\n",
+             (unsigned)i, fps, rate, percentile(s->latencies, 50),
+             percentile(s->latencies, 99), cpu, s->rss / 1024.0);
+    }
+  }
+
+  std::sort(allLatencies.begin(), allLatencies.end());
+
+  if (json) {
+    printf("  ],\n");
+    printf("  \"total\": {\n");
+    printf("    \"fps\": %g,\n", totalFps);
+    printf("    \"rate\": %g,\n", totalRate);
+    printf("    \"latencyP50\": %g,\n", percentile(allLatencies, 50));
+    printf("    \"latencyP99\": %g,\n", percentile(allLatencies, 99));
+    printf("    \"cpu\": %g,\n", totalCpu);
+    printf("    \"rss\": %lu\n", totalRss);
+    printf("  }\n");
+    printf("}\n");
+  } else {
+    printf("%-9s %-7.1f %-8.1f %-8.2f %-8.2f %-8.1f %.1f\n",
+           "Total", totalFps, totalRate, percentile(allLatencies, 50),
+           percentile(allLatencies, 99), totalCpu, totalRss / 1024.0);
+  }
+}
+
+static const char syntax[] = "[options]";
+
+int main(int argc, char **argv)
+{
+  int i;
+
+  if (!parseParams(argc, argv, syntax).empty())
+    showUsage(argv[0], syntax);
+
+  if ((sessions <= 0) || (duration <= 0)) {
+    fprintf(stderr, "Invalid parameters!\n\n");
+    showUsage(argv[0], syntax);
+  }
+
+  if (rfb::encodingNum(encoding) == -1) {
+    fprintf(stderr, "Unknown encoding \"%s\"!\n\n", (const char*)encoding);
+    showUsage(argv[0], syntax);
+  }
+
+  rfb::SecurityClient::secTypes.setParam("None");
+  rfb::CSecurity::upg = new DummyPasswdGetter();
+
+  // Don't die if a session goes away mid write
+  signal(SIGPIPE, SIG_IGN);
+
+  pid_t serverPid;
+  std::vector<Session*> list;
+  int ret;
+
+  serverPid = -1;
+  ret = 0;
+
+  try {
+    if (strcmp(rdpServer, "") != 0) {
+      serverPid = spawn(splitArgs(rdpServer));
+      usleep(rdpServerDelay * 1000);
+    }
+
+    for (i = 0;i < sessions;i++) {
+      std::vector<std::string> args, extra;
+      char path[256];
+
+      snprintf(path, sizeof(path), "/tmp/loadperf-%d-%d.sock",
+               (int)getpid(), i);
+      unlink(path);
+
+      args.push_back((const char*)rdp2vnc);
+      args.push_back("-rfbport=-1");
+      args.push_back(std::string("-rfbunixpath=") + path);
+      args.push_back("-SecurityTypes=None");
+      args.push_back(std::string("-RdpProfile=") + (const char*)rdpProfile);
+      args.push_back("-RdpArg");
+      extra = splitArgs(rdpArgs);
+      args.insert(args.end(), extra.begin(), extra.end());
+
+      list.push_back(new Session(spawn(args), path));
+    }
+
+    connectSessions(&list);
+    runSessions(&list);
+
+    printResults(list);
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Load test failed: %s\n", e.str());
+    ret = 1;
+  }
+
+  for (i = 0;i < (int)list.size();i++) {
+    kill(list[i]->getPid(), SIGTERM);
+    waitpid(list[i]->getPid(), NULL, 0);
+    unlink(list[i]->getPath());
+    delete list[i];
+  }
+
+  if (serverPid != -1) {
+    kill(serverPid, SIGTERM);
+    waitpid(serverPid, NULL, 0);
+  }
+
+  return ret;
+}
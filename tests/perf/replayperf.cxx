@@ -0,0 +1,452 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program replays a damage recording (e.g. from rdp2vnc's
+ * RecordDamage parameter) through a VNCServerST with a single viewer
+ * connected over a socket pair. The recording can be played back with
+ * its original timing, or as fast as the server manages to send out
+ * the changes. In the latter case the server's FrameRate is still the
+ * limiting factor, so consider raising it.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/FdInStream.h>
+#include <rdr/FdOutStream.h>
+
+#include <network/Socket.h>
+
+#include <rfb/CConnection.h>
+#include <rfb/CSecurity.h>
+#include <rfb/DamageRecording.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SDesktop.h>
+#include <rfb/SecurityClient.h>
+#include <rfb/SecurityServer.h>
+#include <rfb/Timer.h>
+#include <rfb/VNCServerST.h>
+#include <rfb/encodings.h>
+
+#include "util.h"
+
+static rfb::BoolParameter realtime("realtime",
+                                   "Replay with the original timing", false);
+
+static rfb::StringParameter encoding("encoding",
+                                     "Preferred encoding", "Tight");
+static rfb::IntParameter quality("quality",
+                                 "JPEG quality level (-1 for lossless)", -1);
+static rfb::IntParameter compressLevel("compressLevel",
+                                       "Compression level", 2);
+
+static rfb::BoolParameter json("json",
+                               "Print the results as JSON", false);
+
+class Desktop : public rfb::SDesktop, public rfb::DamageHandler {
+public:
+  Desktop();
+  ~Desktop();
+
+  // SDesktop interface
+  virtual void start(rfb::VNCServer* vs);
+  virtual void stop();
+  virtual void queryConnection(network::Socket* sock,
+                               const char* userName);
+  virtual void terminate();
+
+  // DamageHandler interface
+  virtual void setSize(int width, int height, const rfb::PixelFormat& pf);
+  virtual rfb::ModifiablePixelBuffer* getFramebuffer() { return pb; }
+  virtual void damage(const rfb::Region& changed);
+  virtual void setCursor(int width, int height, const rfb::Point& hotspot,
+                         const rdr::U8* data);
+  virtual void setCursorPos(const rfb::Point& pos);
+
+public:
+  unsigned damageRecords;
+
+protected:
+  rfb::VNCServer* server;
+  rfb::ManagedPixelBuffer* pb;
+};
+
+class Viewer : public HeadlessViewer {
+public:
+  Viewer(int fd);
+  ~Viewer();
+
+  network::Socket* getSocket() { return sock; }
+
+  bool isReady() { return ready; }
+
+  virtual void framebufferUpdateEnd();
+
+public:
+  unsigned updates;
+
+protected:
+  LoopbackSocket* sock;
+  bool ready;
+};
+
+Desktop::Desktop()
+  : damageRecords(0), server(NULL), pb(NULL)
+{
+}
+
+Desktop::~Desktop()
+{
+  delete pb;
+}
+
+void Desktop::start(rfb::VNCServer* vs)
+{
+  server = vs;
+  server->setPixelBuffer(pb);
+}
+
+void Desktop::stop()
+{
+  server = NULL;
+}
+
+void Desktop::queryConnection(network::Socket* sock, const char*)
+{
+  server->approveConnection(sock, true, NULL);
+}
+
+void Desktop::terminate()
+{
+}
+
+void Desktop::setSize(int width, int height, const rfb::PixelFormat& pf)
+{
+  rfb::ManagedPixelBuffer* newpb;
+
+  newpb = new rfb::ManagedPixelBuffer(pf, width, height);
+
+  if (server != NULL)
+    server->setPixelBuffer(newpb);
+
+  delete pb;
+  pb = newpb;
+}
+
+void Desktop::damage(const rfb::Region& changed)
+{
+  damageRecords++;
+
+  if (server != NULL)
+    server->add_changed(changed);
+}
+
+void Desktop::setCursor(int width, int height, const rfb::Point& hotspot,
+                        const rdr::U8* data)
+{
+  if (server != NULL)
+    server->setCursor(width, height, hotspot, data);
+}
+
+void Desktop::setCursorPos(const rfb::Point& pos)
+{
+  if (server != NULL)
+    server->setCursorPos(pos, false);
+}
+
+Viewer::Viewer(int fd)
+  : updates(0), ready(false)
+{
+  sock = new LoopbackSocket(fd);
+
+  setStreams(&sock->inStream(), &sock->outStream());
+
+  setPreferredEncoding(rfb::encodingNum(encoding));
+  setQualityLevel(quality);
+  setCompressLevel(::compressLevel);
+
+  initialiseProtocol();
+}
+
+Viewer::~Viewer()
+{
+  delete sock;
+}
+
+void Viewer::framebufferUpdateEnd()
+{
+  CConnection::framebufferUpdateEnd();
+
+  ready = true;
+  updates++;
+}
+
+struct stats {
+  unsigned long long duration;
+  unsigned long long replayTime;
+  unsigned long long serverTime;
+  double cpuTime;
+  unsigned updates;
+  unsigned long long bytes;
+};
+
+static void runReplay(const char* fn, struct stats* s)
+{
+  Desktop desktop;
+  rfb::DamagePlayer player(fn, &desktop);
+  rfb::VNCServerST server("replayperf", &desktop);
+  LoopbackSocket* serverSock;
+  Viewer* viewer;
+  int fds[2];
+
+  unsigned long long start, serverStart;
+  unsigned lastUpdates;
+  bool haveRecord, finished, waiting;
+  unsigned firstTimestamp;
+  unsigned damageRecords;
+
+  // The server needs a frame buffer before anyone can connect
+  if (!player.nextRecord())
+    throw rdr::Exception("Empty recording");
+  firstTimestamp = player.timestamp();
+  player.processRecord();
+  if (desktop.getFramebuffer() == NULL)
+    throw rdr::Exception("Recording does not start with a size record");
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    throw rdr::SystemException("socketpair", errno);
+
+  serverSock = new LoopbackSocket(fds[0]);
+  server.addSocket(serverSock);
+
+  viewer = new Viewer(fds[1]);
+
+  memset(s, 0, sizeof(*s));
+
+  haveRecord = false;
+  finished = false;
+  waiting = false;
+  lastUpdates = 0;
+  start = 0;
+
+  while (true) {
+    fd_set rfds, wfds;
+    int nfds, timeout;
+    struct timeval tv;
+    unsigned long long deadline;
+    network::Socket* sock;
+
+    // Any update that completes means the server has caught up with
+    // the changes, or at least will include them in the next one
+    if (waiting && (viewer->updates != lastUpdates))
+      waiting = false;
+
+    // Feed the server as much of the recording as is due
+    while (viewer->isReady() && !finished) {
+      if (start == 0) {
+        start = now();
+        startCpuCounter();
+      }
+
+      if (!haveRecord) {
+        haveRecord = player.nextRecord();
+        if (!haveRecord) {
+          finished = true;
+          break;
+        }
+      }
+
+      if (realtime) {
+        if (now() - start < (player.timestamp() - firstTimestamp) * 1000ULL)
+          break;
+      } else {
+        // Wait for the previous changes to be sent before moving on
+        if (waiting)
+          break;
+      }
+
+      damageRecords = desktop.damageRecords;
+
+      serverStart = now();
+      player.processRecord();
+      s->serverTime += now() - serverStart;
+
+      haveRecord = false;
+
+      if (desktop.damageRecords != damageRecords) {
+        waiting = true;
+        lastUpdates = viewer->updates;
+      }
+    }
+
+    // Done once the last changes have made it over
+    if (finished && !waiting)
+      break;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+
+    if (serverSock->isShutdown())
+      throw rdr::Exception("Server closed the connection");
+
+    sock = viewer->getSocket();
+
+    FD_SET(serverSock->getFd(), &rfds);
+    if (serverSock->outStream().hasBufferedData())
+      FD_SET(serverSock->getFd(), &wfds);
+    FD_SET(sock->getFd(), &rfds);
+    if (sock->outStream().hasBufferedData())
+      FD_SET(sock->getFd(), &wfds);
+    nfds = std::max(serverSock->getFd(), sock->getFd()) + 1;
+
+    serverStart = now();
+    timeout = rfb::Timer::checkTimeouts();
+    s->serverTime += now() - serverStart;
+
+    // Without any timers running the server has nothing more to send,
+    // e.g. if the changes didn't actually change anything
+    if ((timeout == 0) && !serverSock->outStream().hasBufferedData() &&
+        !sock->inStream().hasData(1))
+      waiting = false;
+
+    if (!waiting && haveRecord && !realtime) {
+      deadline = now();
+    } else if (realtime && haveRecord) {
+      deadline = start + (player.timestamp() - firstTimestamp) * 1000ULL;
+    } else {
+      deadline = now() + 1000000;
+    }
+
+    if ((timeout > 0) &&
+        (deadline > now() + (unsigned long long)timeout * 1000))
+      deadline = now() + timeout * 1000ULL;
+
+    if (deadline > now()) {
+      tv.tv_sec = (deadline - now()) / 1000000;
+      tv.tv_usec = (deadline - now()) % 1000000;
+    } else {
+      tv.tv_sec = 0;
+      tv.tv_usec = 0;
+    }
+
+    if (select(nfds, &rfds, &wfds, NULL, &tv) < 0) {
+      if (errno == EINTR)
+        continue;
+      throw rdr::SystemException("select", errno);
+    }
+
+    serverStart = now();
+    rfb::Timer::checkTimeouts();
+    if (FD_ISSET(serverSock->getFd(), &rfds))
+      server.processSocketReadEvent(serverSock);
+    if (FD_ISSET(serverSock->getFd(), &wfds))
+      server.processSocketWriteEvent(serverSock);
+    s->serverTime += now() - serverStart;
+
+    if (FD_ISSET(sock->getFd(), &rfds)) {
+      while (viewer->processMsg())
+        ;
+    }
+    if (FD_ISSET(sock->getFd(), &wfds))
+      sock->outStream().flush();
+  }
+
+  endCpuCounter();
+
+  s->replayTime = now() - start;
+  s->duration = (player.timestamp() - firstTimestamp) * 1000ULL;
+  s->cpuTime = getCpuCounter();
+  s->updates = viewer->updates;
+  s->bytes = viewer->getSocket()->inStream().pos();
+
+  server.removeSocket(serverSock);
+  delete serverSock;
+  delete viewer;
+}
+
+static const char syntax[] = "[options] <damage recording>";
+
+int main(int argc, char **argv)
+{
+  std::vector<const char*> args;
+  const char *fn;
+
+  args = parseParams(argc, argv, syntax);
+  if (args.size() > 1)
+    showUsage(argv[0], syntax);
+
+  if (args.empty()) {
+    fprintf(stderr, "No file specified!\n\n");
+    showUsage(argv[0], syntax);
+  }
+
+  fn = args[0];
+
+  if (rfb::encodingNum(encoding) == -1) {
+    fprintf(stderr, "Unknown encoding \"%s\"!\n\n", (const char*)encoding);
+    showUsage(argv[0], syntax);
+  }
+
+  // Everything is local, so no need for any authentication
+  rfb::SecurityServer::secTypes.setParam("None");
+  rfb::SecurityClient::secTypes.setParam("None");
+  rfb::CSecurity::upg = new DummyPasswdGetter();
+
+  struct stats s;
+
+  try {
+    runReplay(fn, &s);
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Failed to replay recording: %s\n", e.str());
+    return 1;
+  }
+
+  if (json) {
+    printf("{\n");
+    printf("  \"realtime\": %s,\n", realtime ? "true" : "false");
+    printf("  \"encoding\": \"%s\",\n", (const char*)encoding);
+    printf("  \"duration\": %g,\n", s.duration / 1000000.0);
+    printf("  \"replayTime\": %g,\n", s.replayTime / 1000000.0);
+    printf("  \"serverTime\": %g,\n", s.serverTime / 1000000.0);
+    printf("  \"cpuTime\": %g,\n", s.cpuTime);
+    printf("  \"updates\": %u,\n", s.updates);
+    printf("  \"bytes\": %llu\n", s.bytes);
+    printf("}\n");
+  } else {
+    printf("Recording length: %g s\n", s.duration / 1000000.0);
+    printf("Replay time: %g s\n", s.replayTime / 1000000.0);
+    printf("Server time: %g s\n", s.serverTime / 1000000.0);
+    printf("CPU time (server and viewer): %g s\n", s.cpuTime);
+    printf("Updates: %u\n", s.updates);
+    printf("Data: %g KiB (%g KiB/s)\n", s.bytes / 1024.0,
+           s.bytes / 1024.0 / (s.replayTime / 1000000.0));
+  }
+
+  return 0;
+}
@@ -17,6 +17,7 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -27,6 +28,11 @@
 #include <sys/time.h>
 #endif
 
+#include <rdr/Exception.h>
+#include <rfb/Configuration.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/util.h>
+
 #include "util.h"
 
 #ifdef WIN32
@@ -176,3 +182,91 @@ double getTimeCounter(void)
 
   return time;
 }
+
+unsigned long long now(void)
+{
+#ifdef WIN32
+  LARGE_INTEGER count, freq;
+
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+
+  return count.QuadPart / freq.QuadPart * 1000000 +
+         count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+  size_t index;
+
+  if (sorted.empty())
+    return 0.0;
+
+  // Nearest rank
+  index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+
+  return sorted[index];
+}
+
+std::vector<const char*> parseParams(int argc, char **argv,
+                                     const char *syntax)
+{
+  std::vector<const char*> args;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+      showUsage(argv[0], syntax);
+    }
+
+    args.push_back(argv[i]);
+  }
+
+  return args;
+}
+
+void showUsage(const char *argv0, const char *syntax)
+{
+  fprintf(stderr, "Syntax: %s %s\n", argv0, syntax);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+char* LoopbackSocket::getPeerAddress()
+{
+  return rfb::strDup("loopback");
+}
+
+char* LoopbackSocket::getPeerEndpoint()
+{
+  return rfb::strDup("loopback");
+}
+
+void DummyPasswdGetter::getUserPasswd(bool, char**, char**)
+{
+  throw rdr::Exception("No password available");
+}
+
+void HeadlessViewer::initDone()
+{
+  setFramebuffer(new rfb::ManagedPixelBuffer(server.pf(),
+                                             server.width(),
+                                             server.height()));
+}
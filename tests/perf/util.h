@@ -19,6 +19,12 @@
 #ifndef __TESTS_UTIL_H__
 #define __TESTS_UTIL_H__
 
+#include <vector>
+
+#include <network/Socket.h>
+#include <rfb/CConnection.h>
+#include <rfb/UserPasswdGetter.h>
+
 typedef void* cpucounter_t;
 
 void startCpuCounter(void);
@@ -39,4 +45,46 @@ void endTimeCounter(void);
 
 double getTimeCounter(void);
 
+// Current time in microseconds
+unsigned long long now(void);
+
+// Returns the value at the given percentile of an already sorted list
+double percentile(const std::vector<double>& sorted, double p);
+
+// Sets the parameters given on the command line, either as
+// "Name=value" or as "-Name value", and returns any other arguments.
+// Shows the usage on unknown options.
+std::vector<const char*> parseParams(int argc, char **argv,
+                                     const char *syntax);
+
+// Prints the syntax, followed by all parameters, and exits
+void showUsage(const char *argv0, const char *syntax);
+
+// A connected socket that isn't associated with a real peer
+class LoopbackSocket : public network::Socket {
+public:
+  LoopbackSocket(int fd) : Socket(fd) {}
+
+  virtual char* getPeerAddress();
+  virtual char* getPeerEndpoint();
+};
+
+// Used when only security types without passwords are expected
+class DummyPasswdGetter : public rfb::UserPasswdGetter {
+public:
+  virtual void getUserPasswd(bool, char**, char**);
+};
+
+// A viewer that just decodes into a frame buffer, and ignores
+// everything else the server sends
+class HeadlessViewer : public rfb::CConnection {
+public:
+  virtual void initDone();
+  virtual void setCursor(int, int, const rfb::Point&, const rdr::U8*) {}
+  virtual void setCursorPos(const rfb::Point&) {}
+  virtual void setColourMapEntries(int, int, rdr::U16*) {}
+  virtual void bell() {}
+  virtual void serverCutText(const char*) {}
+};
+
 #endif
@@ -0,0 +1,251 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rdr/Exception.h>
+
+#include <rfb/DamageRecording.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/Region.h>
+
+static const rfb::PixelFormat fbPF(32, 24, false, true,
+                                   255, 255, 255, 16, 8, 0);
+
+class TestHandler : public rfb::DamageHandler {
+public:
+    TestHandler() : pb(NULL), sizes(0), damages(0), cursors(0),
+                    cursorPositions(0) {}
+    ~TestHandler() { delete pb; }
+
+    virtual void setSize(int width, int height,
+                         const rfb::PixelFormat& pf)
+    {
+        const rdr::U32 black = 0;
+
+        delete pb;
+        pb = new rfb::ManagedPixelBuffer(pf, width, height);
+        pb->fillRect(pb->getRect(), &black);
+        sizes++;
+    }
+    virtual rfb::ModifiablePixelBuffer* getFramebuffer() { return pb; }
+    virtual void damage(const rfb::Region& changed)
+    {
+        lastDamage = changed;
+        damages++;
+    }
+    virtual void setCursor(int width, int height,
+                           const rfb::Point& hotspot,
+                           const rdr::U8* data)
+    {
+        cursorSize = rfb::Point(width, height);
+        cursorHotspot = hotspot;
+        cursorFirstByte = data[0];
+        cursors++;
+    }
+    virtual void setCursorPos(const rfb::Point& pos)
+    {
+        cursorPos = pos;
+        cursorPositions++;
+    }
+
+public:
+    rfb::ManagedPixelBuffer* pb;
+
+    int sizes, damages, cursors, cursorPositions;
+
+    rfb::Region lastDamage;
+    rfb::Point cursorSize, cursorHotspot, cursorPos;
+    rdr::U8 cursorFirstByte;
+};
+
+static void fillPattern(rfb::ManagedPixelBuffer* pb)
+{
+    rdr::U32* data;
+    int stride;
+
+    data = (rdr::U32*)pb->getBufferRW(pb->getRect(), &stride);
+    for (int y = 0; y < pb->height(); y++) {
+        for (int x = 0; x < pb->width(); x++)
+            data[y * stride + x] = (x * 7 + y * 13) & 0xffffff;
+    }
+    pb->commitBufferRW(pb->getRect());
+}
+
+static bool sameContents(const rfb::PixelBuffer* a,
+                         const rfb::PixelBuffer* b,
+                         const rfb::Rect& r)
+{
+    const rdr::U32 *da, *db;
+    int sa, sb;
+
+    da = (const rdr::U32*)a->getBuffer(r, &sa);
+    db = (const rdr::U32*)b->getBuffer(r, &sb);
+    for (int y = 0; y < r.height(); y++) {
+        if (memcmp(da + y * sa, db + y * sb, r.width() * 4) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+static void testRoundTrip(const char* filename)
+{
+    rfb::ManagedPixelBuffer src(fbPF, 300, 200);
+    rfb::Region changed;
+    rdr::U8 cursor[8 * 8 * 4];
+
+    printf("%s: ", __func__);
+
+    fillPattern(&src);
+
+    changed.assign_union(rfb::Rect(10, 10, 50, 50));
+    changed.assign_union(rfb::Rect(100, 100, 120, 150));
+
+    memset(cursor, 0xaa, sizeof(cursor));
+
+    {
+        rfb::DamageRecorder recorder(filename);
+
+        recorder.writeSize(src.width(), src.height(), src.getPF());
+        recorder.writeDamage(changed, &src);
+        recorder.writeCursor(8, 8, rfb::Point(2, 3), cursor);
+        recorder.writeCursorPos(rfb::Point(5, 6));
+    }
+
+    TestHandler handler;
+    rfb::DamagePlayer player(filename, &handler);
+    int records;
+
+    records = 0;
+    while (player.nextRecord()) {
+        player.processRecord();
+        records++;
+    }
+
+    if (records != 4) {
+        printf("FAILED (got %d records, expected 4)\n", records);
+        return;
+    }
+
+    if ((handler.sizes != 1) || (handler.pb == NULL) ||
+        (handler.pb->width() != 300) || (handler.pb->height() != 200) ||
+        !handler.pb->getPF().equal(fbPF)) {
+        printf("FAILED (wrong frame buffer size or format)\n");
+        return;
+    }
+
+    if ((handler.damages != 1) || !handler.lastDamage.equals(changed)) {
+        printf("FAILED (wrong damaged region)\n");
+        return;
+    }
+
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::const_iterator iter;
+    changed.get_rects(&rects);
+    for (iter = rects.begin(); iter != rects.end(); ++iter) {
+        if (!sameContents(&src, handler.pb, *iter)) {
+            printf("FAILED (wrong pixel data)\n");
+            return;
+        }
+    }
+
+    if ((handler.cursors != 1) ||
+        !handler.cursorSize.equals(rfb::Point(8, 8)) ||
+        !handler.cursorHotspot.equals(rfb::Point(2, 3)) ||
+        (handler.cursorFirstByte != 0xaa)) {
+        printf("FAILED (wrong cursor)\n");
+        return;
+    }
+
+    if ((handler.cursorPositions != 1) ||
+        !handler.cursorPos.equals(rfb::Point(5, 6))) {
+        printf("FAILED (wrong cursor position)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testTruncated(const char* filename)
+{
+    rfb::ManagedPixelBuffer src(fbPF, 64, 64);
+    long size;
+    FILE* f;
+
+    printf("%s: ", __func__);
+
+    fillPattern(&src);
+
+    {
+        rfb::DamageRecorder recorder(filename);
+
+        recorder.writeSize(src.width(), src.height(), src.getPF());
+        recorder.writeDamage(rfb::Region(src.getRect()), &src);
+    }
+
+    // Cut off the end of the pixel data
+    f = fopen(filename, "r");
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+    if (truncate(filename, size - 16) != 0) {
+        printf("FAILED (cannot truncate file)\n");
+        return;
+    }
+
+    try {
+        TestHandler handler;
+        rfb::DamagePlayer player(filename, &handler);
+
+        while (player.nextRecord())
+            player.processRecord();
+    } catch (rdr::Exception& e) {
+        printf("OK\n");
+        return;
+    }
+
+    printf("FAILED (no error for truncated recording)\n");
+}
+
+int main(int argc, char** argv)
+{
+    char filename[] = "/tmp/damagerecording.XXXXXX";
+    int fd;
+
+    fd = mkstemp(filename);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    try {
+        testRoundTrip(filename);
+        testTruncated(filename);
+    } catch (rdr::Exception& e) {
+        printf("FAILED (%s)\n", e.str());
+    }
+
+    unlink(filename);
+
+    return 0;
+}
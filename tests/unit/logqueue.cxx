@@ -0,0 +1,212 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <os/Mutex.h>
+#include <os/Thread.h>
+
+#include <rfb/Logger.h>
+#include <rfb/LogQueue.h>
+
+class TestLogger : public rfb::Logger {
+public:
+    TestLogger() : rfb::Logger("test") {}
+
+    virtual void write(int level, const char *logname, const char *text)
+    {
+        os::AutoMutex a(&mutex);
+        lines.push_back(text);
+    }
+
+    std::vector<std::string> getLines()
+    {
+        os::AutoMutex a(&mutex);
+        return lines;
+    }
+
+private:
+    os::Mutex mutex;
+    std::vector<std::string> lines;
+};
+
+class QueueThread : public os::Thread {
+public:
+    QueueThread() : queue(NULL) {}
+
+    rfb::LogQueue* queue;
+
+protected:
+    virtual void worker() { queue = rfb::LogQueue::getQueue(); }
+};
+
+static void testSingleQueue()
+{
+    QueueThread threads[8];
+
+    printf("%s: ", __func__);
+
+    for (int i = 0; i < 8; i++)
+        threads[i].start();
+    for (int i = 0; i < 8; i++)
+        threads[i].wait();
+
+    for (int i = 0; i < 8; i++) {
+        if (threads[i].queue != threads[0].queue) {
+            printf("FAILED (threads got different queues)\n");
+            return;
+        }
+    }
+
+    if (rfb::LogQueue::peekQueue() != threads[0].queue) {
+        printf("FAILED (peekQueue() returned a different queue)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testOrder()
+{
+    TestLogger logger;
+    rfb::LogQueue* queue;
+    std::vector<std::string> lines;
+    char buf[32];
+
+    printf("%s: ", __func__);
+
+    queue = rfb::LogQueue::getQueue();
+    for (int i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "line %d", i);
+        queue->write(&logger, 0, "test", buf);
+    }
+    queue->flush();
+
+    lines = logger.getLines();
+    if (lines.size() != 100) {
+        printf("FAILED (got %d lines, expected 100)\n", (int)lines.size());
+        return;
+    }
+
+    for (int i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "line %d", i);
+        if (lines[i] != buf) {
+            printf("FAILED (\"%s\" != \"%s\")\n", lines[i].c_str(), buf);
+            return;
+        }
+    }
+
+    printf("OK\n");
+}
+
+static void testRepeats()
+{
+    TestLogger logger;
+    rfb::LogQueue* queue;
+    std::vector<std::string> lines;
+
+    printf("%s: ", __func__);
+
+    queue = rfb::LogQueue::getQueue();
+    for (int i = 0; i < 5; i++)
+        queue->write(&logger, 0, "test", "same");
+    queue->write(&logger, 0, "test", "different");
+    queue->flush();
+
+    lines = logger.getLines();
+    if ((lines.size() != 3) || (lines[0] != "same") ||
+        (lines[1] != "Last message repeated 4 times") ||
+        (lines[2] != "different")) {
+        printf("FAILED (wrong output)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testRepeatLevels()
+{
+    TestLogger logger;
+    rfb::LogQueue* queue;
+    std::vector<std::string> lines;
+
+    printf("%s: ", __func__);
+
+    queue = rfb::LogQueue::getQueue();
+    queue->write(&logger, 10, "test", "same");
+    queue->write(&logger, 30, "test", "same");
+    queue->flush();
+
+    lines = logger.getLines();
+    if ((lines.size() != 2) || (lines[0] != "same") ||
+        (lines[1] != "same")) {
+        printf("FAILED (wrong output)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testLongLines()
+{
+    TestLogger logger;
+    rfb::LogQueue* queue;
+    std::vector<std::string> lines;
+    std::string longLine;
+
+    printf("%s: ", __func__);
+
+    longLine.assign(1000, 'x');
+
+    queue = rfb::LogQueue::getQueue();
+    queue->write(&logger, 0, "test", longLine.c_str());
+    // Identical after being cut short, but not actually repeated
+    queue->write(&logger, 0, "test", (longLine + "y").c_str());
+    queue->flush();
+
+    lines = logger.getLines();
+    if (lines.size() != 2) {
+        printf("FAILED (got %d lines, expected 2)\n", (int)lines.size());
+        return;
+    }
+
+    if ((lines[0].size() >= longLine.size()) ||
+        (lines[0].compare(lines[0].size() - 3, 3, "...") != 0) ||
+        (lines[0].compare(0, lines[0].size() - 3, longLine, 0,
+                          lines[0].size() - 3) != 0)) {
+        printf("FAILED (line not visibly truncated)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+    testSingleQueue();
+    testOrder();
+    testRepeats();
+    testRepeatLevels();
+    testLongLines();
+
+    return 0;
+}
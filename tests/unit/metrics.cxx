@@ -0,0 +1,98 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rfb/Metrics.h>
+
+static void testGrouping()
+{
+    rfb::Metrics metrics;
+    const char* a[] = { "connection", "0", "client", "a", NULL };
+    const char* b[] = { "connection", "1", "client", "a", NULL };
+    const char* expected =
+        "# HELP vnc_x_total X\n"
+        "# TYPE vnc_x_total counter\n"
+        "vnc_x_total{connection=\"0\",client=\"a\"} 1\n"
+        "vnc_x_total{connection=\"1\",client=\"a\"} 3\n"
+        "# HELP vnc_y Y\n"
+        "# TYPE vnc_y gauge\n"
+        "vnc_y{connection=\"0\",client=\"a\"} 2.5\n";
+
+    printf("%s: ", __func__);
+
+    // Added one client at a time, like the server does
+    metrics.describe("vnc_x_total", "counter", "X");
+    metrics.add("vnc_x_total", a, 1ULL);
+    metrics.describe("vnc_y", "gauge", "Y");
+    metrics.add("vnc_y", a, 2.5);
+    metrics.describe("vnc_x_total", "gauge", "ignored");
+    metrics.add("vnc_x_total", b, 3ULL);
+
+    if (strcmp(metrics.str(), expected) != 0) {
+        printf("FAILED (got \"%s\")\n", metrics.str());
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testNoLabels()
+{
+    rfb::Metrics metrics;
+    const char* empty[] = { NULL };
+
+    printf("%s: ", __func__);
+
+    metrics.add("vnc_a", NULL, 1ULL);
+    metrics.add("vnc_b", empty, 2ULL);
+
+    if (strcmp(metrics.str(), "vnc_a 1\nvnc_b 2\n") != 0) {
+        printf("FAILED (got \"%s\")\n", metrics.str());
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testEscaping()
+{
+    rfb::Metrics metrics;
+    const char* labels[] = { "client", "a\"b\\c\nd", NULL };
+
+    printf("%s: ", __func__);
+
+    metrics.add("vnc_a", labels, 1ULL);
+
+    if (strcmp(metrics.str(), "vnc_a{client=\"a\\\"b\\\\c\\nd\"} 1\n") != 0) {
+        printf("FAILED (got \"%s\")\n", metrics.str());
+        return;
+    }
+
+    printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+    testGrouping();
+    testNoLabels();
+    testEscaping();
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <rfb/Region.h>
+
+static bool iteratorMatches(const rfb::Region& region)
+{
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::const_iterator ri;
+    rfb::Region::const_iterator i;
+
+    region.get_rects(&rects);
+
+    ri = rects.begin();
+    for (i = region.begin(); i != region.end(); ++i) {
+        if (ri == rects.end())
+            return false;
+        if (!i->equals(*ri))
+            return false;
+        ++ri;
+    }
+
+    return ri == rects.end();
+}
+
+static rfb::Region multiRegion()
+{
+    rfb::Region region;
+
+    // Three bands, with two rects in the middle one
+    region.assign_union(rfb::Rect(10, 10, 50, 20));
+    region.assign_union(rfb::Rect(0, 20, 20, 30));
+    region.assign_union(rfb::Rect(40, 20, 60, 30));
+    region.assign_union(rfb::Rect(5, 30, 15, 40));
+
+    return region;
+}
+
+static void testIteratorEmpty()
+{
+    rfb::Region region;
+
+    printf("%s: ", __func__);
+
+    if (region.begin() != region.end()) {
+        printf("FAILED (empty region has rects)\n");
+        return;
+    }
+
+    region.reset(rfb::Rect(10, 10, 20, 20));
+    region.clear();
+    if (region.begin() != region.end()) {
+        printf("FAILED (cleared region has rects)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testIteratorSingle()
+{
+    rfb::Region region(rfb::Rect(10, 20, 30, 40));
+    rfb::Region::const_iterator i;
+
+    printf("%s: ", __func__);
+
+    i = region.begin();
+    if (i == region.end()) {
+        printf("FAILED (no rects)\n");
+        return;
+    }
+
+    if (!i->equals(rfb::Rect(10, 20, 30, 40))) {
+        printf("FAILED (got %d,%d-%d,%d)\n",
+               i->tl.x, i->tl.y, i->br.x, i->br.y);
+        return;
+    }
+
+    ++i;
+    if (i != region.end()) {
+        printf("FAILED (more than one rect)\n");
+        return;
+    }
+
+    if (!iteratorMatches(region)) {
+        printf("FAILED (differs from get_rects())\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testIteratorMulti()
+{
+    rfb::Region region;
+    int count;
+
+    printf("%s: ", __func__);
+
+    region = multiRegion();
+
+    count = 0;
+    for (rfb::Region::const_iterator i = region.begin();
+         i != region.end(); ++i)
+        count++;
+
+    if (count != region.numRects()) {
+        printf("FAILED (got %d rects, expected %d)\n",
+               count, region.numRects());
+        return;
+    }
+
+    if (count != 4) {
+        printf("FAILED (got %d rects)\n", count);
+        return;
+    }
+
+    if (!iteratorMatches(region)) {
+        printf("FAILED (differs from get_rects())\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testCopy()
+{
+    rfb::Region empty, single(rfb::Rect(1, 2, 3, 4)), multi;
+
+    printf("%s: ", __func__);
+
+    multi = multiRegion();
+
+    rfb::Region emptyCopy(empty);
+    rfb::Region singleCopy(single);
+    rfb::Region multiCopy(multi);
+
+    // Changing the originals must not affect the copies
+    empty.reset(rfb::Rect(0, 0, 10, 10));
+    single.clear();
+    multi.assign_union(rfb::Rect(100, 100, 110, 110));
+
+    if (!emptyCopy.is_empty()) {
+        printf("FAILED (empty copy)\n");
+        return;
+    }
+
+    if (!singleCopy.equals(rfb::Region(rfb::Rect(1, 2, 3, 4)))) {
+        printf("FAILED (single rect copy)\n");
+        return;
+    }
+
+    if (!multiCopy.equals(multiRegion())) {
+        printf("FAILED (multiple rect copy)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testAssign()
+{
+    rfb::Region region;
+
+    printf("%s: ", __func__);
+
+    // Single rect over multiple rects, and back again
+    region = multiRegion();
+    region = rfb::Region(rfb::Rect(1, 2, 3, 4));
+    if (!region.equals(rfb::Region(rfb::Rect(1, 2, 3, 4))) ||
+        !iteratorMatches(region)) {
+        printf("FAILED (single rect over multiple rects)\n");
+        return;
+    }
+
+    region = multiRegion();
+    if (!region.equals(multiRegion()) || !iteratorMatches(region)) {
+        printf("FAILED (multiple rects over single rect)\n");
+        return;
+    }
+
+    region = rfb::Region();
+    if (!region.is_empty() || (region.begin() != region.end())) {
+        printf("FAILED (empty over multiple rects)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testSelfAssign()
+{
+    rfb::Region single(rfb::Rect(1, 2, 3, 4)), multi;
+    rfb::Region* alias;
+
+    printf("%s: ", __func__);
+
+    multi = multiRegion();
+
+    // Through a pointer, to keep the compiler from complaining
+    alias = &single;
+    single = *alias;
+    if (!single.equals(rfb::Region(rfb::Rect(1, 2, 3, 4)))) {
+        printf("FAILED (single rect)\n");
+        return;
+    }
+
+    alias = &multi;
+    multi = *alias;
+    if (!multi.equals(multiRegion()) || !iteratorMatches(multi)) {
+        printf("FAILED (multiple rects)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+    testIteratorEmpty();
+    testIteratorSingle();
+    testIteratorMulti();
+    testCopy();
+    testAssign();
+    testSelfAssign();
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rfb/PixelBuffer.h>
+#include <rfb/ScaledPixelBuffer.h>
+
+static const rfb::PixelFormat pf(32, 24, false, true,
+                                 255, 255, 255, 0, 8, 16);
+
+static void fillNoise(rfb::ManagedPixelBuffer* pb, const rfb::Rect& r)
+{
+    rdr::U8* buffer;
+    int stride;
+
+    buffer = pb->getBufferRW(r, &stride);
+    for (int y = 0; y < r.height(); y++) {
+        for (int x = 0; x < r.width() * 4; x++)
+            buffer[y * stride * 4 + x] = rand();
+    }
+    pb->commitBufferRW(r);
+}
+
+static bool sameContents(const rfb::PixelBuffer* a,
+                         const rfb::PixelBuffer* b)
+{
+    const rdr::U8 *bufA, *bufB;
+    int strideA, strideB;
+
+    if ((a->width() != b->width()) || (a->height() != b->height()))
+        return false;
+
+    bufA = a->getBuffer(a->getRect(), &strideA);
+    bufB = b->getBuffer(b->getRect(), &strideB);
+
+    for (int y = 0; y < a->height(); y++) {
+        if (memcmp(bufA + y * strideA * 4, bufB + y * strideB * 4,
+                   a->width() * 4) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+static void testSolid()
+{
+    rfb::ManagedPixelBuffer src(pf, 300, 200);
+    rdr::U8 colour[4] = { 0x12, 0x34, 0x56, 0x00 };
+
+    printf("%s: ", __func__);
+
+    src.fillRect(src.getRect(), colour);
+
+    for (unsigned filter = 0; filter <= rfb::scaleFilterMaxNumber;
+         filter++) {
+        rfb::ScaledPixelBuffer scaled(&src, 123, 77, filter);
+        const rdr::U8* buffer;
+        int stride;
+
+        scaled.update(src.getRect());
+
+        // Every filter must preserve a solid colour exactly
+        buffer = scaled.getBuffer(scaled.getRect(), &stride);
+        for (int y = 0; y < scaled.height(); y++) {
+            for (int x = 0; x < scaled.width(); x++) {
+                if (memcmp(buffer + (y * stride + x) * 4, colour, 3) != 0) {
+                    printf("FAILED (filter %u, pixel %d,%d)\n", filter, x, y);
+                    return;
+                }
+            }
+        }
+    }
+
+    printf("OK\n");
+}
+
+static void testPartialUpdate()
+{
+    rfb::ManagedPixelBuffer src(pf, 320, 240);
+    rfb::Rect changed(100, 50, 140, 90);
+    rfb::Region affected;
+
+    printf("%s: ", __func__);
+
+    fillNoise(&src, src.getRect());
+
+    rfb::ScaledPixelBuffer partial(&src, 200, 150);
+    partial.update(src.getRect());
+
+    fillNoise(&src, changed);
+
+    affected = partial.update(changed);
+    if (!affected.equals(partial.scaleRegion(changed))) {
+        printf("FAILED (wrong affected region)\n");
+        return;
+    }
+
+    // Recalculating only the affected area must give the same result
+    // as starting from scratch
+    rfb::ScaledPixelBuffer full(&src, 200, 150);
+    full.update(src.getRect());
+
+    if (!sameContents(&partial, &full)) {
+        printf("FAILED (contents differ)\n");
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testScaleRect()
+{
+    rfb::ManagedPixelBuffer src(pf, 400, 300);
+    rfb::ScaledPixelBuffer scaled(&src, 200, 150);
+    rfb::Rect r;
+
+    printf("%s: ", __func__);
+
+    r = scaled.scaleRect(src.getRect());
+    if (!r.equals(scaled.getRect())) {
+        printf("FAILED (whole source maps to %d,%d-%d,%d)\n",
+               r.tl.x, r.tl.y, r.br.x, r.br.y);
+        return;
+    }
+
+    if (!scaled.scaleRect(rfb::Rect()).is_empty()) {
+        printf("FAILED (empty rect)\n");
+        return;
+    }
+
+    // A single source pixel must affect the pixel it ends up in
+    r = scaled.scaleRect(rfb::Rect(101, 51, 102, 52));
+    if (!r.contains(scaled.scalePoint(rfb::Point(101, 51)))) {
+        printf("FAILED (single pixel maps to %d,%d-%d,%d)\n",
+               r.tl.x, r.tl.y, r.br.x, r.br.y);
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testPoints()
+{
+    rfb::ManagedPixelBuffer src(pf, 400, 300);
+    rfb::ScaledPixelBuffer scaled(&src, 200, 150);
+    rfb::Point p;
+
+    printf("%s: ", __func__);
+
+    p = scaled.scalePoint(rfb::Point(399, 299));
+    if (!p.equals(rfb::Point(199, 149))) {
+        printf("FAILED (scaled to %d,%d)\n", p.x, p.y);
+        return;
+    }
+
+    // Going back and forth must end up at the same pixel
+    for (int y = 0; y < scaled.height(); y += 7) {
+        for (int x = 0; x < scaled.width(); x += 7) {
+            p = scaled.scalePoint(scaled.unscalePoint(rfb::Point(x, y)));
+            if (!p.equals(rfb::Point(x, y))) {
+                printf("FAILED (%d,%d became %d,%d)\n", x, y, p.x, p.y);
+                return;
+            }
+        }
+    }
+
+    printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+    testSolid();
+    testPartialUpdate();
+    testScaleRect();
+    testPoints();
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rdr/Exception.h>
+#include <rdr/MemOutStream.h>
+
+#include <rfb/PixelFormat.h>
+#include <rfb/SessionRecording.h>
+
+static const rfb::PixelFormat pf(16, 16, false, true,
+                                 31, 63, 31, 11, 5, 0);
+
+static bool makeTempFile(char* fn)
+{
+    int fd;
+
+    strcpy(fn, "/tmp/sessionrecordingXXXXXX");
+    fd = mkstemp(fn);
+    if (fd < 0)
+        return false;
+    close(fd);
+
+    return true;
+}
+
+static void record(const char* fn, rdr::MemOutStream* client)
+{
+    rfb::SessionRecorder recorder(fn);
+    rfb::RecordingOutStream out(client, &recorder);
+
+    recorder.startStream();
+    out.writeBytes("hello", 5);
+    out.flush();
+    out.writePixelFormat(pf);
+    out.writeBytes(" world", 6);
+    out.flush();
+
+    // A client that reconnects
+    recorder.startStream();
+    out.writeBytes("again", 5);
+    out.flush();
+}
+
+static bool readData(rfb::SessionPlayer* player, const char* expected)
+{
+    char buf[32];
+    size_t len;
+
+    len = strlen(expected);
+
+    if (!player->nextRecord())
+        return false;
+    if (player->recordType() != rfb::sessionRecordData)
+        return false;
+    if (!player->hasData(len))
+        return false;
+
+    player->readBytes(buf, len);
+    if (memcmp(buf, expected, len) != 0)
+        return false;
+
+    // Nothing more than what was written
+    return !player->hasData(1);
+}
+
+static void testRoundTrip()
+{
+    char fn[64];
+    rdr::MemOutStream client;
+    rfb::PixelFormat readPF;
+
+    printf("%s: ", __func__);
+
+    if (!makeTempFile(fn)) {
+        printf("FAILED (cannot create file)\n");
+        return;
+    }
+
+    record(fn, &client);
+
+    if ((client.length() != 16) ||
+        (memcmp(client.data(), "hello worldagain", 16) != 0)) {
+        printf("FAILED (client didn't get the data)\n");
+        unlink(fn);
+        return;
+    }
+
+    try {
+        rfb::SessionPlayer player(fn);
+
+        if (!player.nextRecord() ||
+            (player.recordType() != rfb::sessionRecordStream))
+            throw rdr::Exception("missing stream start");
+        if (!readData(&player, "hello"))
+            throw rdr::Exception("wrong first data");
+
+        if (!player.nextRecord() ||
+            (player.recordType() != rfb::sessionRecordPixelFormat))
+            throw rdr::Exception("missing pixel format");
+        player.readPixelFormat(&readPF);
+        if (!readPF.equal(pf))
+            throw rdr::Exception("wrong pixel format");
+
+        if (!readData(&player, " world"))
+            throw rdr::Exception("wrong second data");
+
+        if (!player.nextRecord() ||
+            (player.recordType() != rfb::sessionRecordStream))
+            throw rdr::Exception("missing second stream start");
+        if (!readData(&player, "again"))
+            throw rdr::Exception("wrong third data");
+
+        if (player.nextRecord())
+            throw rdr::Exception("extra records");
+    } catch (rdr::Exception& e) {
+        printf("FAILED (%s)\n", e.str());
+        unlink(fn);
+        return;
+    }
+
+    unlink(fn);
+
+    printf("OK\n");
+}
+
+static void testSkip()
+{
+    char fn[64];
+    rdr::MemOutStream client;
+    int types[6];
+    int count;
+
+    printf("%s: ", __func__);
+
+    if (!makeTempFile(fn)) {
+        printf("FAILED (cannot create file)\n");
+        return;
+    }
+
+    record(fn, &client);
+
+    // Unread data must be skipped over
+    count = 0;
+    try {
+        rfb::SessionPlayer player(fn);
+
+        while (player.nextRecord()) {
+            if (count < 6)
+                types[count] = player.recordType();
+            count++;
+        }
+    } catch (rdr::Exception& e) {
+        printf("FAILED (%s)\n", e.str());
+        unlink(fn);
+        return;
+    }
+
+    unlink(fn);
+
+    if ((count != 6) ||
+        (types[0] != rfb::sessionRecordStream) ||
+        (types[1] != rfb::sessionRecordData) ||
+        (types[2] != rfb::sessionRecordPixelFormat) ||
+        (types[3] != rfb::sessionRecordData) ||
+        (types[4] != rfb::sessionRecordStream) ||
+        (types[5] != rfb::sessionRecordData)) {
+        printf("FAILED (got %d records)\n", count);
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testPartialRead()
+{
+    char fn[64];
+    rdr::MemOutStream client;
+    char buf[9];
+
+    printf("%s: ", __func__);
+
+    if (!makeTempFile(fn)) {
+        printf("FAILED (cannot create file)\n");
+        return;
+    }
+
+    record(fn, &client);
+
+    try {
+        rfb::SessionPlayer player(fn);
+
+        player.nextRecord();
+
+        player.nextRecord();
+        if (!player.hasData(2))
+            throw rdr::Exception("no data");
+        player.skip(2);
+
+        // Pixel format left unread
+        player.nextRecord();
+
+        // Messages can span records, so what was already buffered of
+        // the previous data record must still be there
+        player.nextRecord();
+        if (!player.hasData(sizeof(buf)))
+            throw rdr::Exception("no data after partial read");
+        player.readBytes(buf, sizeof(buf));
+        if (memcmp(buf, "llo world", sizeof(buf)) != 0)
+            throw rdr::Exception("wrong data after partial read");
+    } catch (rdr::Exception& e) {
+        printf("FAILED (%s)\n", e.str());
+        unlink(fn);
+        return;
+    }
+
+    unlink(fn);
+
+    printf("OK\n");
+}
+
+static void testTruncated()
+{
+    char fn[64];
+    rdr::MemOutStream client;
+    long size;
+    int count;
+    FILE* f;
+
+    printf("%s: ", __func__);
+
+    if (!makeTempFile(fn)) {
+        printf("FAILED (cannot create file)\n");
+        return;
+    }
+
+    record(fn, &client);
+
+    // Cut the last record header in half
+    f = fopen(fn, "rb");
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+    if (truncate(fn, size - 5 - 5) != 0) {
+        printf("FAILED (cannot truncate file)\n");
+        unlink(fn);
+        return;
+    }
+
+    count = 0;
+    try {
+        rfb::SessionPlayer player(fn);
+
+        while (player.nextRecord())
+            count++;
+    } catch (rdr::Exception& e) {
+        printf("FAILED (%s)\n", e.str());
+        unlink(fn);
+        return;
+    }
+
+    unlink(fn);
+
+    if (count != 5) {
+        printf("FAILED (got %d records)\n", count);
+        return;
+    }
+
+    printf("OK\n");
+}
+
+static void testNotRecording()
+{
+    char fn[64];
+    FILE* f;
+
+    printf("%s: ", __func__);
+
+    if (!makeTempFile(fn)) {
+        printf("FAILED (cannot create file)\n");
+        return;
+    }
+
+    f = fopen(fn, "wb");
+    fputs("This is not a session recording\n", f);
+    fclose(f);
+
+    try {
+        rfb::SessionPlayer player(fn);
+    } catch (rdr::Exception& e) {
+        unlink(fn);
+        printf("OK\n");
+        return;
+    }
+
+    unlink(fn);
+
+    printf("FAILED (no exception)\n");
+}
+
+int main(int argc, char** argv)
+{
+    testRoundTrip();
+    testSkip();
+    testPartialRead();
+    testTruncated();
+    testNotRecording();
+
+    return 0;
+}
@@ -27,8 +27,13 @@
 #include <string>
 #include <unordered_map>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include <freerdp/freerdp.h>
@@ -36,6 +41,7 @@
 #include <freerdp/gdi/gdi.h>
 #include <freerdp/gdi/gfx.h>
 #include <freerdp/utils/signal.h>
+#include <freerdp/version.h>
 
 #include <freerdp/client/file.h>
 #include <freerdp/client/cmdline.h>
@@ -50,16 +56,20 @@
 #include <xkbcommon/xkbcommon.h>
 #include <utf8cpp/utf8.h>
 
+#include <rfb/DamageRecording.h>
 #include <rfb/PixelFormat.h>
 #include <rfb/Rect.h>
 #include <rfb/Pixel.h>
 #include <rfb/util.h>
 #include <rfb/ScreenSet.h>
 #include <rfb/LogWriter.h>
+#include <rfb/Metrics.h>
+#include <os/Trace.h>
 
 #include <rdp2vnc/RDPClient.h>
 #include <rdp2vnc/RDPDesktop.h>
 #include <rdp2vnc/RDPCursor.h>
+#include <rdp2vnc/RDPPixelBuffer.h>
 #include <rdp2vnc/key.h>
 
 using namespace std;
@@ -67,6 +77,100 @@ using namespace rfb;
 
 static rfb::LogWriter vlog("RDPClient");
 
+static StringParameter recordDamage("RecordDamage",
+  "Record all screen and cursor changes to this file, for replay with "
+  "the replayperf benchmark", "");
+static StringParameter rdpProfile("RdpProfile",
+  "Preset for the RDP codecs and visual effects, suited to how the "
+  "screen is sent on to VNC clients: Default, Lossless, Balanced or "
+  "LowBandwidth. Options after RdpArg take precedence", "Default");
+static StringParameter bitmapCacheDir("RdpBitmapCacheDir",
+  "Directory for persistent RDP bitmap caches shared by all sessions "
+  "(empty means no persistent cache, needs FreeRDP 3)", "");
+static StringParameter bitmapCacheName("RdpBitmapCacheName",
+  "Name of the shared bitmap cache, which should be the same for all "
+  "sessions to the same system image (defaults to the server name)", "");
+static IntParameter reconnectTime("RdpReconnectTime",
+  "Keep trying to reconnect a dropped RDP connection for this many "
+  "seconds before giving up (zero means never try)", 60, 0);
+
+// The frame buffer is always 32 bits per pixel, as that is what the
+// VNC side works with, so these only change how the RDP server renders
+// and compresses the session.
+static bool applyProfile(rdpSettings* settings, const char* profile) {
+  if (strcasecmp(profile, "Default") == 0) {
+    return true;
+  }
+  if (strcasecmp(profile, "Lossless") == 0) {
+    // Clients asking for lossless encodings would otherwise get the
+    // artefacts of lossy RDP codecs, encoded once more
+    settings->ColorDepth = 32;
+    settings->SupportGraphicsPipeline = TRUE;
+    settings->GfxH264 = FALSE;
+    settings->GfxAVC444 = FALSE;
+    settings->GfxProgressive = FALSE;
+    settings->GfxProgressiveV2 = FALSE;
+    settings->RemoteFxCodec = FALSE;
+    settings->NSCodec = FALSE;
+    return true;
+  }
+  if (strcasecmp(profile, "Balanced") == 0 ||
+      strcasecmp(profile, "LowBandwidth") == 0) {
+    // Lossy, but without the chroma subsampling of AVC, which looks
+    // worse once it has also passed through JPEG
+    settings->ColorDepth = 32;
+    settings->SupportGraphicsPipeline = TRUE;
+    settings->GfxH264 = FALSE;
+    settings->GfxAVC444 = FALSE;
+    settings->GfxProgressive = TRUE;
+    // Large changing areas cost bandwidth on both links
+    settings->DisableWallpaper = TRUE;
+    settings->DisableFullWindowDrag = TRUE;
+    settings->DisableMenuAnims = TRUE;
+    if (strcasecmp(profile, "LowBandwidth") == 0) {
+      // Themes and anti-aliased text add colours and gradients that
+      // compress poorly with the VNC encodings
+      settings->DisableThemes = TRUE;
+      settings->AllowFontSmoothing = FALSE;
+      settings->AllowDesktopComposition = FALSE;
+    }
+    return true;
+  }
+  vlog.error("Unknown RDP profile '%s'", profile);
+  return false;
+}
+
+#if FREERDP_VERSION_MAJOR >= 3
+static bool copyFile(const char* from, const char* to) {
+  int in = open(from, O_RDONLY);
+  if (in < 0) {
+    return false;
+  }
+  int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+  char buf[65536];
+  ssize_t len;
+  bool ok = true;
+  while ((len = read(in, buf, sizeof(buf))) > 0) {
+    if (write(out, buf, len) != len) {
+      ok = false;
+      break;
+    }
+  }
+  if (len < 0) {
+    ok = false;
+  }
+  close(in);
+  if (close(out) < 0) {
+    ok = false;
+  }
+  return ok;
+}
+#endif
+
 static int64_t getMSTimestamp() {
   timeval tv;
   gettimeofday(&tv, NULL);
@@ -309,6 +413,8 @@ bool RDPClient::beginPaint() {
 }
 
 bool RDPClient::endPaint() {
+  unique_lock<mutex> lock = lockVNCIfReconnecting();
+  framesDecoded++;
   rdpGdi* gdi = context->gdi;
   if (gdi->primary->hdc->hwnd->invalid->null) {
     return true;
@@ -316,6 +422,7 @@ bool RDPClient::endPaint() {
   hasChangedSize = false;
   int ninvalid = gdi->primary->hdc->hwnd->ninvalid;
   HGDI_RGN cinvalid = gdi->primary->hdc->hwnd->cinvalid;
+  Region changed;
   for (int i = 0; i < ninvalid; ++i) {
     int x = cinvalid[i].x;
     int y = cinvalid[i].y;
@@ -328,6 +435,17 @@ bool RDPClient::endPaint() {
         vlog.error("Add changed: %s", e.str());
       }
     }
+    if (recorder) {
+      changed.assign_union(Region(Rect(x, y, x + w, y + h)));
+    }
+  }
+  if (recorder) {
+    RDPPixelBuffer pb(Rect(), this);
+    try {
+      recorder->writeDamage(changed.intersect(pb.getRect()), &pb);
+    } catch (rdr::Exception& e) {
+      stopRecording(e);
+    }
   }
   gdi->primary->hdc->hwnd->invalid->null = TRUE;
   gdi->primary->hdc->hwnd->ninvalid = 0;
@@ -360,6 +478,16 @@ bool RDPClient::postConnect() {
   pointer.Set = rdpPointerSet;
   graphics_register_pointer(context->graphics, &pointer);
 
+  if (strcmp(recordDamage, "") != 0) {
+    try {
+      recorder.reset(new DamageRecorder(recordDamage));
+      vlog.info("Recording screen changes to %s", (const char*)recordDamage);
+    } catch (rdr::Exception& e) {
+      vlog.error("Failed to start recording: %s", e.str());
+    }
+    recordSize();
+  }
+
   instance->update->BeginPaint = rdpBeginPaint;
   instance->update->EndPaint = rdpEndPaint;
   instance->update->DesktopResize = rdpDesktopResize;
@@ -376,12 +504,20 @@ bool RDPClient::pointerSet(RDPPointerImpl* pointer) {
   if (!pointer->buffer) {
     return false;
   }
+  unique_lock<mutex> lock = lockVNCIfReconnecting();
   int width = pointer->width;
   int height = pointer->height;
   int x = pointer->x;
   int y = pointer->y;
   Point hotspot(x, y);
   lastCursor.reset(new RDPCursor(pointer->buffer, pointer->size, width, height, x, y));
+  if (recorder) {
+    try {
+      recorder->writeCursor(width, height, hotspot, pointer->buffer);
+    } catch (rdr::Exception& e) {
+      stopRecording(e);
+    }
+  }
   if (hasChangedSize) {
     hasPendingPointer = true;
   } else {
@@ -401,10 +537,18 @@ bool RDPClient::pointerSet(RDPPointerImpl* pointer) {
 }
 
 bool RDPClient::pointerSetPosition(uint32_t x, uint32_t y) {
+  unique_lock<mutex> lock = lockVNCIfReconnecting();
   if (lastCursor) {
     lastCursor->posX = x;
     lastCursor->posY = y;
   }
+  if (recorder) {
+    try {
+      recorder->writeCursorPos(Point(x, y));
+    } catch (rdr::Exception& e) {
+      stopRecording(e);
+    }
+  }
   if (hasChangedSize) {
     hasPendingPointer = true;
   } else {
@@ -421,9 +565,11 @@ bool RDPClient::pointerSetPosition(uint32_t x, uint32_t y) {
 }
 
 bool RDPClient::desktopResize() {
+  unique_lock<mutex> lock = lockVNCIfReconnecting();
   if (!gdi_resize(context->gdi, context->settings->DesktopWidth, context->settings->DesktopHeight)) {
     return false;
   }
+  recordSize();
   if (!desktop) {
     return true;
   }
@@ -436,6 +582,7 @@ bool RDPClient::desktopResize() {
 }
 
 bool RDPClient::playSound(const PLAY_SOUND_UPDATE* playSound) {
+  unique_lock<mutex> lock = lockVNCIfReconnecting();
   if (desktop && desktop->server) {
     try {
       desktop->server->bell();
@@ -625,7 +772,8 @@ RDPClient::RDPClient(int argc_, char** argv_, bool& stopSignal_)
     hasSentCliprdrFormats(false), oldButtonMask(0), cliprdrRequestedFormatId(-1),
     hasCapsLocked(false), hasSyncedCapsLocked(false), hasAnnouncedClipboard(false),
     isClientClipboardAvailable(false), hasClientRequestedClipboard(false), hasReceivedDisplayControlCaps(false),
-    hasChangedSize(false), hasPendingPointer(false)
+    hasChangedSize(false), hasPendingPointer(false), reconnecting(false),
+    framesDecoded(0), decodeTime(0), lockWaitTime(0)
 {
 }
 
@@ -633,6 +781,7 @@ RDPClient::~RDPClient() {
   if (context) {
     freerdp_client_context_free(context);
   }
+  publishBitmapCache();
 }
 
 bool RDPClient::init(char* domain, char* username, char* password, int width, int height) {
@@ -656,11 +805,16 @@ bool RDPClient::init(char* domain, char* username, char* password, int width, in
   ctxWithPointer->client = this;
   instance = context->instance;
 
+  if (!applyProfile(context->settings, rdpProfile)) {
+    return false;
+  }
   status = freerdp_client_settings_parse_command_line(context->settings, argc, argv, false);
   if (status != 0) {
     freerdp_client_settings_command_line_status_print(context->settings, status, argc, argv);
     return false;
   }
+  freerdp_performance_flags_make(context->settings);
+  setupBitmapCache();
   if (domain) {
     context->settings->Domain = domain;
   }
@@ -676,6 +830,11 @@ bool RDPClient::init(char* domain, char* username, char* password, int width, in
   if (height != -1) {
     context->settings->DesktopHeight = height;
   }
+  // Makes the server hand out an auto-reconnect cookie, so that a
+  // reconnect does not need a new logon
+  if (reconnectTime > 0) {
+    context->settings->AutoReconnectionEnabled = TRUE;
+  }
   return true;
 }
 
@@ -756,29 +915,188 @@ void RDPClient::setRDPDesktop(RDPDesktop* desktop_) {
 void RDPClient::eventLoop() {
   HANDLE handles[64];
   DWORD numHandles;
-  while (!freerdp_shall_disconnect(instance)) {
+  while (true) {
+    bool failed = false;
+    if (freerdp_shall_disconnect(instance)) {
+      if (reconnect()) {
+        continue;
+      }
+      break;
+    }
     {
       lock_guard<mutex> lock(mutexVNC);
       numHandles = freerdp_get_event_handles(context, handles, 64);
     }
     if (numHandles == 0) {
-      return;
+      break;
     }
     if (stopSignal) {
       return;
     }
     if (WaitForMultipleObjects(numHandles, handles, FALSE, 10000) == WAIT_FAILED) {
-      return;
+      break;
     }
     {
-      lock_guard<mutex> lock(mutexVNC);
+      unique_lock<mutex> lock(mutexVNC, defer_lock);
+      uint64_t start = os::Trace::now();
+      {
+        TRACE_SPAN("RDPClient: wait for mutexVNC");
+        lock.lock();
+      }
+      uint64_t locked = os::Trace::now();
+      lockWaitTime += locked - start;
+      TRACE_SPAN("RDPClient: freerdp_check_event_handles");
       if (!freerdp_check_event_handles(context)) {
-        return;
+        failed = true;
       }
+      decodeTime += os::Trace::now() - locked;
     }
+    if (failed && !reconnect()) {
+      break;
+    }
+  }
+  // Viewers would otherwise be left looking at a frozen screen
+  if (!stopSignal) {
+    vlog.error("RDP connection closed");
+    stopSignal = true;
+  }
+}
+
+bool RDPClient::reconnect() {
+  if (reconnectTime == 0 || stopSignal) {
+    return false;
+  }
+  // Anything else means the server ended the session on purpose
+  UINT32 error = freerdp_error_info(instance);
+  if (error != ERRINFO_SUCCESS && error != ERRINFO_GRAPHICS_SUBSYSTEM_FAILED) {
+    vlog.info("RDP session ended: %s", freerdp_get_error_info_string(error));
+    return false;
+  }
+  vlog.info("RDP connection lost, reconnecting");
+  // mutexVNC is not held across freerdp_reconnect(), as that can take
+  // seconds and the cliprdr callbacks take it from the channel thread.
+  // The callbacks that touch the frame buffer or the VNC server take it
+  // themselves while this is set, and VNC input is dropped meanwhile.
+  {
+    lock_guard<mutex> lock(mutexVNC);
+    reconnecting = true;
+  }
+  bool reconnected = false;
+  int64_t start = getMSTimestamp();
+  while (!stopSignal) {
+    if (freerdp_reconnect(instance)) {
+      vlog.info("Reconnected after %d ms", (int)(getMSTimestamp() - start));
+      reconnected = true;
+      break;
+    }
+    if (getMSTimestamp() - start >= reconnectTime * 1000LL) {
+      vlog.error("Failed to reconnect within %d seconds", (int)reconnectTime);
+      break;
+    }
+    usleep(500000);
+  }
+  {
+    lock_guard<mutex> lock(mutexVNC);
+    reconnecting = false;
+  }
+  return reconnected;
+}
+
+// The event loop holds mutexVNC whenever FreeRDP calls back into us,
+// except during freerdp_reconnect()
+unique_lock<mutex> RDPClient::lockVNCIfReconnecting() {
+  unique_lock<mutex> lock(mutexVNC, defer_lock);
+  if (reconnecting) {
+    lock.lock();
+  }
+  return lock;
+}
+
+// FreeRDP 3 offers the keys in BitmapCachePersistFile to the server
+// when connecting, and saves its bitmap cache there when the context is
+// freed. Sessions to the same image end up with nearly the same cache,
+// so they share one file. Each session works on a private copy, and the
+// copy replaces the shared file atomically when the session ends, so
+// concurrent sessions never see a partial file.
+//
+// FreeRDP 2 always sends an empty persistent key list and never reads
+// or writes the file, so there is nothing to share with it.
+void RDPClient::setupBitmapCache() {
+  if (strcmp(bitmapCacheDir, "") == 0) {
+    return;
+  }
+#if FREERDP_VERSION_MAJOR < 3
+  vlog.error("Ignoring RdpBitmapCacheDir, as FreeRDP %d has no persistent "
+             "bitmap cache support", FREERDP_VERSION_MAJOR);
+#else
+  rdpSettings* settings = context->settings;
+  string name = (const char*)bitmapCacheName;
+  const char* hostname = freerdp_settings_get_string(settings, FreeRDP_ServerHostname);
+  if (name.empty() && hostname) {
+    name = hostname;
+  }
+  if (name.empty()) {
+    vlog.error("No name for the shared bitmap cache");
+    return;
+  }
+  for (size_t i = 0; i < name.size(); i++) {
+    if (name[i] == '/') {
+      name[i] = '_';
+    }
+  }
+  sharedCacheFile = string((const char*)bitmapCacheDir) + "/" + name + ".bmc";
+  sessionCacheFile = sharedCacheFile + "." + to_string(getpid());
+  if (copyFile(sharedCacheFile.c_str(), sessionCacheFile.c_str())) {
+    vlog.info("Using shared bitmap cache %s", sharedCacheFile.c_str());
+  } else if (errno != ENOENT) {
+    vlog.error("Failed to copy bitmap cache %s: %s",
+               sharedCacheFile.c_str(), strerror(errno));
+    // Start with an empty cache rather than a partial one
+    unlink(sessionCacheFile.c_str());
+  }
+  freerdp_settings_set_string(settings, FreeRDP_BitmapCachePersistFile,
+                              sessionCacheFile.c_str());
+  freerdp_settings_set_bool(settings, FreeRDP_BitmapCacheEnabled, TRUE);
+  freerdp_settings_set_bool(settings, FreeRDP_BitmapCachePersistEnabled, TRUE);
+#endif
+}
+
+void RDPClient::publishBitmapCache() {
+  if (sessionCacheFile.empty()) {
+    return;
+  }
+  struct stat st;
+  // A session that never got going has nothing better to offer
+  if (!hasConnected || stat(sessionCacheFile.c_str(), &st) != 0 ||
+      st.st_size == 0) {
+    unlink(sessionCacheFile.c_str());
+    return;
+  }
+  if (rename(sessionCacheFile.c_str(), sharedCacheFile.c_str()) != 0) {
+    vlog.error("Failed to update bitmap cache %s: %s",
+               sharedCacheFile.c_str(), strerror(errno));
+    unlink(sessionCacheFile.c_str());
+  }
+}
+
+void RDPClient::recordSize() {
+  if (!recorder) {
+    return;
+  }
+  RDPPixelBuffer pb(Rect(), this);
+  try {
+    recorder->writeSize(pb.width(), pb.height(), pb.getPF());
+    recorder->writeDamage(pb.getRect(), &pb);
+  } catch (rdr::Exception& e) {
+    stopRecording(e);
   }
 }
 
+void RDPClient::stopRecording(const rdr::Exception& e) {
+  vlog.error("Failed to record screen changes: %s", e.str());
+  recorder.reset();
+}
+
 void RDPClient::sendPendingPointer() {
   if (lastCursor && desktop && desktop->server) {
     try {
@@ -823,6 +1141,9 @@ rdr::U8* RDPClient::getBuffer() {
 }
 
 void RDPClient::pointerEvent(const Point& pos, int buttonMask) {
+  if (reconnecting) {
+    return;
+  }
   uint16_t flags = 0;
   bool left = buttonMask & 1;
   bool middle = buttonMask & 2;
@@ -896,6 +1217,9 @@ void RDPClient::pointerEvent(const Point& pos, int buttonMask) {
 }
 
 void RDPClient::keyEvent(rdr::U32 keysym, rdr::U32 xtcode, bool down) {
+  if (reconnecting) {
+    return;
+  }
   if (down) {
     pressedKeys.insert(keysym);
   } else {
@@ -964,7 +1288,7 @@ void RDPClient::keyEvent(rdr::U32 keysym, rdr::U32 xtcode, bool down) {
 }
 
 void RDPClient::handleClipboardRequest() {
-  if (!cliprdrContext || !hasAnnouncedClipboard) {
+  if (reconnecting || !cliprdrContext || !hasAnnouncedClipboard) {
     return;
   }
   lock_guard<mutex> lock(mutexCliprdr);
@@ -976,7 +1300,7 @@ void RDPClient::handleClipboardRequest() {
 }
 
 void RDPClient::handleClipboardAnnounce(bool available) {
-  if (!cliprdrContext) {
+  if (reconnecting || !cliprdrContext) {
     return;
   }
   lock_guard<mutex> lock(mutexCliprdr);
@@ -991,7 +1315,7 @@ void RDPClient::handleClipboardAnnounce(bool available) {
 }
 
 void RDPClient::handleClipboardData(const char* data) {
-  if (!cliprdrContext) {
+  if (reconnecting || !cliprdrContext) {
     return;
   }
   lock_guard<mutex> lock(mutexCliprdr);
@@ -1003,7 +1327,7 @@ void RDPClient::handleClipboardData(const char* data) {
 
 unsigned int RDPClient::setScreenLayout(int fbWidth, int fbHeight, const rfb::ScreenSet& layout) {
   // We only handle the simple case of one screen
-  if (!dispContext || !hasReceivedDisplayControlCaps) {
+  if (reconnecting || !dispContext || !hasReceivedDisplayControlCaps) {
     return rfb::resultProhibited;
   }
   int numMonitors = layout.num_screens();
@@ -1033,4 +1357,18 @@ unsigned int RDPClient::setScreenLayout(int fbWidth, int fbHeight, const rfb::Sc
 
 std::mutex &RDPClient::getMutex() {
   return mutexVNC;
-}
\ No newline at end of file
+}
+
+void RDPClient::getMetrics(rfb::Metrics* metrics) {
+  const char* labels[] = { "thread", "rdp", NULL };
+  metrics->describe("rdp2vnc_rdp_frames_total", "counter",
+                    "RDP updates decoded");
+  metrics->add("rdp2vnc_rdp_frames_total", NULL,
+               (unsigned long long)framesDecoded);
+  metrics->describe("rdp2vnc_rdp_decode_seconds_total", "counter",
+                    "Time spent processing RDP data");
+  metrics->add("rdp2vnc_rdp_decode_seconds_total", NULL, decodeTime / 1000000.0);
+  metrics->describe("rdp2vnc_lock_wait_seconds_total", "counter",
+                    "Time spent waiting for the session lock");
+  metrics->add("rdp2vnc_lock_wait_seconds_total", labels, lockWaitTime / 1000000.0);
+}
@@ -25,6 +25,7 @@
 
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <unordered_set>
 #include <inttypes.h>
@@ -42,10 +43,16 @@
 #include <freerdp/client/channels.h>
 #include <freerdp/channels/channels.h>
 
+#include <rdr/Exception.h>
 #include <rfb/Rect.h>
 #include <rfb/ScreenSet.h>
 #include <rfb/Configuration.h>
 
+namespace rfb {
+  class DamageRecorder;
+  class Metrics;
+}
+
 struct RDPCursor;
 class RDPDesktop;
 class RDPPointerImpl;
@@ -71,6 +78,8 @@ public:
   void handleClipboardData(const char* data);
   unsigned int setScreenLayout(int fbWidth, int fbHeight, const rfb::ScreenSet& layout);
   std::mutex &getMutex();
+  // Must be called with the mutex held
+  void getMetrics(rfb::Metrics* metrics);
 private:
   friend class RDPDesktop;
   static BOOL rdpBeginPaint(rdpContext* context);
@@ -121,7 +130,13 @@ private:
   void channelConnected(ChannelConnectedEventArgs* e);
   void channelDisconnected(ChannelDisconnectedEventArgs* e);
   void eventLoop();
+  bool reconnect();
+  std::unique_lock<std::mutex> lockVNCIfReconnecting();
   void sendPendingPointer();
+  void recordSize();
+  void setupBitmapCache();
+  void publishBitmapCache();
+  void stopRecording(const rdr::Exception& e);
 
   int argc;
   char** argv;
@@ -137,6 +152,9 @@ private:
   uint32_t cliprdrRequestedFormatId;
   std::unique_ptr<std::thread> thread_;
   std::shared_ptr<RDPCursor> lastCursor;
+  std::unique_ptr<rfb::DamageRecorder> recorder;
+  std::string sharedCacheFile;
+  std::string sessionCacheFile;
   std::mutex mutexVNC;
   std::mutex mutexCliprdr;
   std::unordered_set<uint32_t> pressedKeys;
@@ -149,11 +167,17 @@ private:
   bool hasReceivedDisplayControlCaps;
   bool hasChangedSize;
   bool hasPendingPointer;
+  // Set with mutexVNC held, VNC input is dropped while it is set
+  bool reconnecting;
   int maxNumMonitors;
   int maxMonitorAreaFactorA;
   int maxMonitorAreaFactorB;
   int64_t lastProcessTime;
   int64_t lastChangeSizeTime;
+  // Statistics, updated with the mutex held. Times are in microseconds.
+  uint64_t framesDecoded;
+  uint64_t decodeTime;
+  uint64_t lockWaitTime;
 };
 
 #endif // __RDPCLIENT_H__
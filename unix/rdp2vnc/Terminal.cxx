@@ -50,6 +50,8 @@
 
 static const int glyphWidth = 16;
 static const int glyphHeight = 16;
+// A full screen of distinct glyphs and colours fits comfortably
+static const size_t maxCachedGlyphs = 16384;
 
 using namespace std;
 using namespace rfb;
@@ -59,7 +61,8 @@ static rfb::LogWriter vlog("Terminal");
 
 TerminalDesktop::TerminalDesktop(Geometry* geometry_)
   : geometry(geometry_), server(NULL), running(false), vt(NULL), requestedWidth(-1), requestedHeight(-1),
-    defaultFGColor(0x00f8f8f2), defaultBGColor(0x00272822)
+    defaultFGColor(0x00f8f8f2), defaultBGColor(0x00272822),
+    cursorPos({0, 0}), cursorVisible(false)
 {
   PixelFormat format(32, 24, false, true, 255, 255, 255, 16, 8, 0);
   pb.reset(new ManagedPixelBuffer(format, geometry->width(), geometry->height()));
@@ -93,6 +96,7 @@ bool TerminalDesktop::initTerminal(int lines, int cols) {
   }
   this->lines = lines;
   this->cols = cols;
+  dirtyColumns.assign(lines, make_pair(cols, 0));
   vt = vterm_new(lines, cols);
   if (!vt) {
     return false;
@@ -105,6 +109,7 @@ bool TerminalDesktop::initTerminal(int lines, int cols) {
   memset(&screenCallbacks, 0, sizeof(VTermScreenCallbacks));
   screenCallbacks.damage = screenDamage;
   screenCallbacks.movecursor = screenMoveCursor;
+  screenCallbacks.moverect = screenMoveRect;
   vterm_screen_set_callbacks(vtScreen, &screenCallbacks, this);
   vterm_output_set_callback(vt, terminalOutputCallback, this);
   VTermColor fg, bg;
@@ -311,6 +316,12 @@ int TerminalDesktop::screenMoveCursor(VTermPos pos, VTermPos oldpos, int visible
   return 1;
 }
 
+int TerminalDesktop::screenMoveRect(VTermRect dest, VTermRect src, void* user) {
+  TerminalDesktop* desktop = (TerminalDesktop *)user;
+  // Returning 0 makes libvterm report dest as damaged instead
+  return desktop->moveRect(dest, src) ? 1 : 0;
+}
+
 void TerminalDesktop::damage(VTermRect rect) {
   int x1 = rect.start_col;
   int x2 = rect.end_col;
@@ -330,10 +341,54 @@ void TerminalDesktop::damage(VTermRect rect) {
   }
 }
 
+bool TerminalDesktop::moveRect(VTermRect dest, VTermRect src) {
+  if (dest.start_col < 0 || dest.end_col > cols || dest.start_row < 0 || dest.end_row > lines) {
+    return false;
+  }
+  if (src.start_col < 0 || src.end_col > cols || src.start_row < 0 || src.end_row > lines) {
+    return false;
+  }
+  if (dest.start_col >= dest.end_col || dest.start_row >= dest.end_row) {
+    return true;
+  }
+  Rect destRect = terminalRectToRFBRect(dest.start_col, dest.end_col, dest.start_row, dest.end_row);
+  Rect srcRect = terminalRectToRFBRect(src.start_col, src.end_col, src.start_row, src.end_row);
+  Point delta = destRect.tl.subtract(srcRect.tl);
+  // The server has to know about everything drawn so far, or it
+  // would move stale pixels
+  flushDamage();
+  try {
+    pb->copyRect(destRect, delta);
+    if (server) {
+      server->add_copied(Region(destRect), delta);
+    }
+  } catch (rfb::Exception& e) {
+    vlog.error("Move rect: %s", e.str());
+    return false;
+  }
+  // The cursor is drawn in to the pixel buffer, so don't leave a copy
+  // of it behind
+  if (cursorVisible) {
+    VTermPos moved {cursorPos.row + dest.start_row - src.start_row,
+                    cursorPos.col + dest.start_col - src.start_col};
+    if (cursorPos.row >= src.start_row && cursorPos.row < src.end_row &&
+        cursorPos.col >= src.start_col && cursorPos.col < src.end_col) {
+      renderCell(moved);
+    }
+    if (cursorPos.row >= dest.start_row && cursorPos.row < dest.end_row &&
+        cursorPos.col >= dest.start_col && cursorPos.col < dest.end_col) {
+      renderCursor(cursorPos);
+    }
+  }
+  return true;
+}
+
 void TerminalDesktop::moveCursor(VTermPos pos, VTermPos oldpos, bool visible) {
   if (pos.row < 0 || pos.row >= lines || pos.col < 0 || pos.col >= cols) {
     return;
   }
+  cursorPos = pos;
+  cursorVisible = visible;
   if (visible) {
     renderCursor(pos);
   }
@@ -397,6 +452,27 @@ void TerminalDesktop::terminalOutput(const char* s, size_t len) {
   }
 }
 
+const uint32_t* TerminalDesktop::getGlyph(uint32_t ch, int width, uint32_t fg, uint32_t bg) {
+  GlyphKey key {ch, fg, bg, width};
+  auto it = glyphCache.find(key);
+  if (it != glyphCache.end()) {
+    return it->second.data();
+  }
+  if (glyphCache.size() >= maxCachedGlyphs) {
+    glyphCache.clear();
+  }
+  int gw = width == 2 ? glyphWidth : glyphWidth / 2;
+  vector<uint32_t> pixels(gw * glyphHeight);
+  size_t glyphIndex = ch < glyphBitmapSize ? ch : 0;
+  for (int i = 0; i < glyphHeight; ++i) {
+    uint16_t line = ch == 0 ? 0 : glyphBitmap[glyphIndex][i];
+    for (int j = 0; j < gw; ++j) {
+      pixels[i * gw + j] = (line & (1 << j)) ? fg : bg;
+    }
+  }
+  return glyphCache.emplace(key, move(pixels)).first->second.data();
+}
+
 void TerminalDesktop::renderGlyph(int x, int y, int width, uint32_t ch, uint32_t fg, uint32_t bg) {
   if (width > 2) {
     width = 2;
@@ -407,39 +483,46 @@ void TerminalDesktop::renderGlyph(int x, int y, int width, uint32_t ch, uint32_t
   Rect glyphRect = terminalPosToRFBRect(x, y, width);
   int stride;
   uint32_t* buffer = (uint32_t *)pb->getBufferRW(glyphRect, &stride);
-  size_t glyphIndex = ch < glyphBitmapSize ? ch : 0;
-  if (ch == 0) {
-    for (int i = 0; i < glyphHeight; ++i) {
-      int gw = width == 2 ? glyphWidth : glyphWidth / 2;
-      for (int j = 0; j < gw; ++j) {
-        buffer[i * stride + j] = bg;
-      }
+  const uint32_t* glyph = getGlyph(ch, width, fg, bg);
+  int gw = width == 2 ? glyphWidth : glyphWidth / 2;
+  for (int i = 0; i < glyphHeight; ++i) {
+    memcpy(buffer + i * stride, glyph + i * gw, gw * sizeof(uint32_t));
+  }
+  // Reported to the server in flushDamage(), once libvterm is done
+  pair<int, int>& dirty = dirtyColumns[y];
+  dirty.first = min(dirty.first, x);
+  dirty.second = max(dirty.second, x + width);
+}
+
+void TerminalDesktop::flushDamage() {
+  Region changed;
+  int start = 0;
+  for (int i = 1; i <= lines; ++i) {
+    // Lines with the same dirty columns are sent as one rectangle
+    if (i < lines && dirtyColumns[i] == dirtyColumns[start]) {
+      continue;
     }
-  } else {
-    for (int i = 0; i < glyphHeight; ++i) {
-      uint16_t line = glyphBitmap[glyphIndex][i];
-      int gw = width == 2 ? glyphWidth : glyphWidth / 2;
-      for (int j = 0; j < gw; ++j) {
-        if (line & (1 << j)) {
-          buffer[i * stride + j] = fg;
-        } else {
-          buffer[i * stride + j] = bg;
-        }
-      }
+    pair<int, int>& dirty = dirtyColumns[start];
+    if (dirty.first < dirty.second) {
+      changed.assign_union(Region(terminalRectToRFBRect(dirty.first, dirty.second, start, i)));
     }
+    start = i;
   }
-  if (server) {
-    try {
-      server->add_changed(Region(glyphRect));
-    } catch (rfb::Exception& e) {
-      vlog.error("Add change: %s", e.str());
-    }
+  dirtyColumns.assign(lines, make_pair(cols, 0));
+  if (!server || changed.is_empty()) {
+    return;
+  }
+  try {
+    server->add_changed(changed);
+  } catch (rfb::Exception& e) {
+    vlog.error("Add change: %s", e.str());
   }
 }
 
 bool runTerminal(TerminalDesktop* desktop, rfb::VNCServerST* server,
   std::list<SocketListener *>& listeners, bool* caughtSignal,
-  const std::function<void (int infd, int outfd)>& terminalHandler) {
+  const std::function<void (int infd, int outfd)>& terminalHandler,
+  bool singleSession) {
 
   int inFd = desktop->getInFd();
   int* outFds = desktop->getOutFds();
@@ -485,6 +568,10 @@ bool runTerminal(TerminalDesktop* desktop, rfb::VNCServerST* server,
       }
     }
 
+    if (singleSession && clients_connected == 0) {
+      return false;
+    }
+
     tv.tv_sec = 0;
     tv.tv_usec = 10000;
     // Do the wait...
@@ -505,6 +592,7 @@ bool runTerminal(TerminalDesktop* desktop, rfb::VNCServerST* server,
         VTerm* vt = desktop->getTerminal();
         if (vt) {
           vterm_input_write(vt, buffer, len);
+          desktop->flushDamage();
         }
       }
     }
@@ -20,8 +20,10 @@
 #define __TERMINAL_H__
 
 #include <memory>
+#include <unordered_map>
 #include <unordered_set>
 #include <functional>
+#include <vector>
 
 #include <rfb/VNCServerST.h>
 #include <rfb/SDesktop.h>
@@ -56,17 +58,38 @@ public:
   VTerm* getTerminal();
   std::pair<int, int> getRequestedDesktopSize();
   const Geometry& getGeometry();
+  // Hand everything drawn since the last call over to the server
+  void flushDamage();
 private:
+  struct GlyphKey {
+    uint32_t ch;
+    uint32_t fg;
+    uint32_t bg;
+    int width;
+    bool operator==(const GlyphKey& other) const {
+      return ch == other.ch && fg == other.fg && bg == other.bg &&
+             width == other.width;
+    }
+  };
+  struct GlyphKeyHash {
+    size_t operator()(const GlyphKey& key) const {
+      return std::hash<uint64_t>()(((uint64_t)key.fg << 32) | key.bg) ^
+             std::hash<uint32_t>()((key.ch << 1) | (key.width - 1));
+    }
+  };
   rfb::ScreenSet computeScreenLayout();
   static void terminalOutputCallback(const char* s, size_t len, void* user);
   static int screenDamage(VTermRect rect, void* user);
   static int screenMoveCursor(VTermPos pos, VTermPos oldpos, int visible, void* user);
+  static int screenMoveRect(VTermRect dest, VTermRect src, void* user);
   void damage(VTermRect rect);
+  bool moveRect(VTermRect dest, VTermRect src);
   void moveCursor(VTermPos pos, VTermPos oldpos, bool visible);
   void renderCursor(VTermPos pos);
   void renderCell(VTermPos pos, bool reverse = false);
   void terminalOutput(const char* s, size_t len);
   void renderGlyph(int x, int y, int width, uint32_t ch, uint32_t fg, uint32_t bg);
+  const uint32_t* getGlyph(uint32_t ch, int width, uint32_t fg, uint32_t bg);
   rfb::Rect terminalPosToRFBRect(int x, int y, int width);
   rfb::Rect terminalLineToRFBRect(int line);
   rfb::Rect terminalRectToRFBRect(int x1, int x2, int y1, int y2);
@@ -88,10 +111,19 @@ private:
   int requestedHeight;
   int defaultFGColor;
   int defaultBGColor;
+  VTermPos cursorPos;
+  bool cursorVisible;
+  // Glyphs already expanded to pixels, for each colour combination
+  std::unordered_map<GlyphKey, std::vector<uint32_t>, GlyphKeyHash> glyphCache;
+  // First and last + 1 column drawn on each line since the last flush
+  std::vector<std::pair<int, int>> dirtyColumns;
 };
 
+// Returns false if interrupted, or if singleSession is set and the
+// last client has disconnected
 bool runTerminal(TerminalDesktop* desktop, rfb::VNCServerST* server,
   std::list<network::SocketListener *>& listeners, bool* caughtSignal,
-  const std::function<void (int infd, int outfd)>& terminalHandler);
+  const std::function<void (int infd, int outfd)>& terminalHandler,
+  bool singleSession = false);
 
 #endif // __TERMINAL_H__
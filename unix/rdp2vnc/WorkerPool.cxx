@@ -0,0 +1,379 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// WorkerPool.cxx
+//
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <rdr/Exception.h>
+#include <rfb/Configuration.h>
+#include <rfb/LogWriter.h>
+#include <rfb/util.h>
+#include <network/TcpSocket.h>
+#include <network/UnixSocket.h>
+
+#include <rdp2vnc/WorkerPool.h>
+
+using namespace network;
+
+static rfb::LogWriter vlog("WorkerPool");
+
+WorkerPool::WorkerPool(int size_)
+  : size(size_), asyncLog(NULL), nextSpawn(0)
+{
+  rfb::VoidParameter* param;
+
+  // fork() only copies the calling thread, so the front-end must not
+  // start a thread for log output. The workers get the setting back.
+  param = rfb::Configuration::getParam("AsyncLog");
+  if (param != NULL) {
+    asyncLog = param->getValueStr();
+    param->setParam("0");
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  std::list<Worker>::iterator i;
+
+  // Workers that have been handed a connection are left running
+  for (i = idle.begin(); i != idle.end(); i++) {
+    kill(i->pid, SIGTERM);
+    close(i->fd);
+  }
+
+  delete [] asyncLog;
+}
+
+int WorkerPool::run(std::list<SocketListener*>& listeners,
+                    bool* caughtSignal)
+{
+  std::list<SocketListener*>::iterator li;
+  std::list<Worker>::iterator wi;
+
+  vlog.info("Keeping %d sessions ready", size);
+
+  while (!*caughtSignal) {
+    fd_set rfds;
+    struct timeval tv;
+    int n;
+
+    reap();
+
+    if (time(NULL) >= nextSpawn) {
+      while ((int)idle.size() < size) {
+        int fd;
+
+        fd = spawn();
+        if (fd < 0)
+          continue;
+
+        // Deleting the listeners would also remove any Unix socket
+        // from the file system
+        for (li = listeners.begin(); li != listeners.end(); li++)
+          close((*li)->getFd());
+        listeners.clear();
+
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        if (asyncLog != NULL)
+          rfb::Configuration::setParam("AsyncLog", asyncLog);
+
+        return fd;
+      }
+    }
+
+    FD_ZERO(&rfds);
+
+    for (li = listeners.begin(); li != listeners.end(); li++)
+      FD_SET((*li)->getFd(), &rfds);
+    for (wi = idle.begin(); wi != idle.end(); wi++)
+      FD_SET(wi->fd, &rfds);
+
+    // Dead workers are also noticed through their sockets, so this
+    // only limits how long exited sessions stay zombies
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+
+    n = select(FD_SETSIZE, &rfds, NULL, NULL, &tv);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw rdr::SystemException("select", errno);
+    }
+
+    for (wi = idle.begin(); wi != idle.end();) {
+      char c;
+      ssize_t len;
+
+      if (!FD_ISSET(wi->fd, &rfds)) {
+        wi++;
+        continue;
+      }
+
+      len = read(wi->fd, &c, 1);
+      if (len == 1) {
+        vlog.debug("Worker %d is ready", (int)wi->pid);
+        wi->ready = true;
+      }
+      if ((len == 1) || ((len < 0) && (errno == EINTR))) {
+        wi++;
+        continue;
+      }
+
+      vlog.error("Worker %d exited before getting a connection",
+                 (int)wi->pid);
+      close(wi->fd);
+      wi = idle.erase(wi);
+
+      // Avoid a busy loop if workers cannot start at all
+      nextSpawn = time(NULL) + 1;
+    }
+
+    for (li = listeners.begin(); li != listeners.end(); li++) {
+      Socket* sock;
+
+      if (!FD_ISSET((*li)->getFd(), &rfds))
+        continue;
+
+      sock = (*li)->accept();
+      if (sock == NULL) {
+        vlog.status("Client connection rejected");
+        continue;
+      }
+
+      if (!handOff(sock)) {
+        rfb::CharArray peer(sock->getPeerEndpoint());
+        vlog.error("No session available for connection from %s",
+                   peer.buf);
+      }
+
+      // The worker has its own copy of the descriptor
+      delete sock;
+    }
+  }
+
+  return -1;
+}
+
+void WorkerPool::notifyReady(int fd)
+{
+  char c;
+
+  // The front-end may already have passed on a connection and closed
+  // its end, which is harmless
+  c = 0;
+  send(fd, &c, 1, MSG_NOSIGNAL);
+}
+
+Socket* WorkerPool::receiveConnection(int fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr* cmsg;
+  char flags;
+  ssize_t len;
+  int sockFd;
+  struct sockaddr_storage addr;
+  socklen_t salen;
+  Socket* sock;
+
+  memset(&msg, 0, sizeof(msg));
+
+  iov.iov_base = &flags;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  do {
+    len = recvmsg(fd, &msg, 0);
+  } while ((len < 0) && (errno == EINTR));
+
+  if (len < 0) {
+    int e = errno;
+    close(fd);
+    throw rdr::SystemException("recvmsg", e);
+  }
+
+  close(fd);
+
+  if (len == 0)
+    return NULL;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if ((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) ||
+      (cmsg->cmsg_type != SCM_RIGHTS) ||
+      (cmsg->cmsg_len != CMSG_LEN(sizeof(int))))
+    throw rdr::Exception("Invalid connection hand-off message");
+
+  memcpy(&sockFd, CMSG_DATA(cmsg), sizeof(int));
+
+  salen = sizeof(addr);
+  if ((getsockname(sockFd, (struct sockaddr*)&addr, &salen) == 0) &&
+      (addr.ss_family == AF_UNIX))
+    sock = new UnixSocket(sockFd);
+  else
+    sock = new TcpSocket(sockFd);
+
+  // The front-end has already applied any connection filter
+  if (flags & 1)
+    sock->setRequiresQuery();
+
+  rfb::CharArray peer(sock->getPeerEndpoint());
+  vlog.info("Got connection from %s", peer.buf);
+
+  return sock;
+}
+
+int WorkerPool::spawn()
+{
+  int fds[2];
+  pid_t pid;
+  Worker worker;
+  std::list<Worker>::iterator i;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    throw rdr::SystemException("socketpair", errno);
+
+  pid = fork();
+  if (pid < 0) {
+    int e = errno;
+    close(fds[0]);
+    close(fds[1]);
+    throw rdr::SystemException("fork", e);
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    for (i = idle.begin(); i != idle.end(); i++)
+      close(i->fd);
+    idle.clear();
+    return fds[1];
+  }
+
+  close(fds[1]);
+
+  vlog.debug("Started worker %d", (int)pid);
+
+  worker.pid = pid;
+  worker.fd = fds[0];
+  worker.ready = false;
+  idle.push_back(worker);
+
+  return -1;
+}
+
+bool WorkerPool::handOff(Socket* sock)
+{
+  while (!idle.empty()) {
+    std::list<Worker>::iterator i;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+      struct cmsghdr hdr;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr* cmsg;
+    char flags;
+    int sockFd;
+    Worker worker;
+    ssize_t len;
+    int err;
+
+    // Prefer a worker that has finished starting up
+    for (i = idle.begin(); i != idle.end(); i++) {
+      if (i->ready)
+        break;
+    }
+    if (i == idle.end())
+      i = idle.begin();
+
+    worker = *i;
+    idle.erase(i);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+
+    flags = sock->requiresQuery() ? 1 : 0;
+    iov.iov_base = &flags;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    sockFd = sock->getFd();
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sockFd, sizeof(int));
+
+    do {
+      len = sendmsg(worker.fd, &msg, MSG_NOSIGNAL);
+    } while ((len < 0) && (errno == EINTR));
+    err = errno;
+
+    // Anything still queued stays readable for the worker
+    close(worker.fd);
+
+    if (len == 1) {
+      rfb::CharArray peer(sock->getPeerEndpoint());
+      vlog.info("Handed connection from %s to worker %d",
+                peer.buf, (int)worker.pid);
+      return true;
+    }
+
+    vlog.error("Failed to hand connection to worker %d: %s",
+               (int)worker.pid, strerror(err));
+    kill(worker.pid, SIGTERM);
+  }
+
+  return false;
+}
+
+void WorkerPool::reap()
+{
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    if (WIFEXITED(status))
+      vlog.debug("Worker %d exited with status %d", (int)pid,
+                 WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+      vlog.debug("Worker %d was terminated by signal %d", (int)pid,
+                 WTERMSIG(status));
+  }
+}
@@ -0,0 +1,78 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// WorkerPool.h
+//
+// Keeps a number of rdp2vnc processes started and waiting, so that a
+// new connection only has to be passed to one of them instead of
+// waiting for a whole new process to start up. Connections are
+// accepted by the front-end process and sent to the workers over a
+// Unix socket as SCM_RIGHTS messages.
+//
+
+#ifndef __WORKERPOOL_H__
+#define __WORKERPOOL_H__
+
+#include <list>
+#include <sys/types.h>
+
+#include <network/Socket.h>
+
+class WorkerPool
+{
+public:
+  // Must be created before anything is logged, see WorkerPool.cxx
+  WorkerPool(int size);
+  ~WorkerPool();
+
+  // Accepts connections on the listeners and hands them to the
+  // workers until caughtSignal is set, and then returns -1. In each
+  // worker this instead returns the descriptor to receive the
+  // connection on, and the listeners have been closed.
+  int run(std::list<network::SocketListener*>& listeners,
+          bool* caughtSignal);
+
+  // Called by a worker once it is ready to show the greeter
+  static void notifyReady(int fd);
+  // Called by a worker to wait for its connection. Each worker only
+  // gets a single one, so this also closes fd. Returns NULL if the
+  // front-end has gone away.
+  static network::Socket* receiveConnection(int fd);
+
+private:
+  struct Worker {
+    pid_t pid;
+    int fd;
+    bool ready;
+  };
+
+  // Returns the descriptor for the new worker in the worker, and -1
+  // in the front-end
+  int spawn();
+  bool handOff(network::Socket* sock);
+  void reap();
+
+  int size;
+  std::list<Worker> idle;
+  char* asyncLog;
+  // When we may start more workers after one has failed
+  time_t nextSpawn;
+};
+
+#endif // __WORKERPOOL_H__
@@ -19,12 +19,15 @@
 // FIXME: Check cases when screen width/height is not a multiply of 32.
 //        e.g. 800x600.
 
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 #include <iostream>
 #include <strings.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
@@ -32,7 +35,9 @@
 #include <rfb/LogWriter.h>
 #include <rfb/VNCServerST.h>
 #include <rfb/Configuration.h>
+#include <rfb/Metrics.h>
 #include <rfb/Timer.h>
+#include <os/Trace.h>
 #include <network/TcpSocket.h>
 #include <network/UnixSocket.h>
 
@@ -44,6 +49,7 @@
 #include <rdp2vnc/DesktopMux.h>
 #include <rdp2vnc/Terminal.h>
 #include <rdp2vnc/Greeter.h>
+#include <rdp2vnc/WorkerPool.h>
 
 extern char buildtime[];
 
@@ -64,6 +70,10 @@ BoolParameter rdpArg("RdpArg", "Command line arguments after this are for freerd
 BoolParameter interactiveLogin("InteractiveLogin", "Show an interactive greeter", false);
 IntParameter terminalWidth("TerminalWidth", "Width of the interactive login terminal", 1024);
 IntParameter terminalHeight("TerminalHeight", "Width of the interactive login terminal", 768);
+IntParameter workers("Workers", "Number of sessions to keep started and waiting for "
+                     "connections, requires InteractiveLogin (zero means none)", 0, 0);
+StringParameter metricsSocket("MetricsSocket", "Unix socket to serve metrics on, "
+                              "%p is replaced by the process id", "");
 
 //
 // Allow the main loop terminate itself gracefully on receiving a signal.
@@ -224,6 +234,54 @@ static void listenServer(std::list<SocketListener*>& listeners) {
   delete[] hostsData;
 }
 
+static std::unique_ptr<SocketListener> listenMetrics() {
+  std::string path = (const char*)metricsSocket;
+  size_t pos = path.find("%p");
+  if (pos != std::string::npos) {
+    path.replace(pos, 2, std::to_string(getpid()));
+  }
+  std::unique_ptr<SocketListener> listener(new UnixListener(path.c_str(), 0600));
+  vlog.info("Serving metrics on %s", path.c_str());
+  return listener;
+}
+
+static void serveMetrics(Socket* sock, VNCServerST* server, RDPClient* rdpClient,
+                         uint64_t lockWaitTime) {
+  Metrics metrics;
+  const char* labels[] = { "thread", "main", NULL };
+
+  server->getMetrics(&metrics);
+  rdpClient->getMetrics(&metrics);
+  metrics.add("rdp2vnc_lock_wait_seconds_total", labels, lockWaitTime / 1000000.0);
+
+  FILE* fp = fopen("/proc/self/statm", "r");
+  if (fp) {
+    unsigned long size, resident;
+    if (fscanf(fp, "%lu %lu", &size, &resident) == 2) {
+      metrics.describe("process_resident_memory_bytes", "gauge",
+                       "Resident memory size");
+      metrics.add("process_resident_memory_bytes", NULL,
+                  (unsigned long long)resident * sysconf(_SC_PAGESIZE));
+    }
+    fclose(fp);
+  }
+
+  // Answered as HTTP so that it can be fetched with e.g.
+  // "curl --unix-socket". The request itself does not matter.
+  std::string body = metrics.str();
+  std::string response = "HTTP/1.0 200 OK\r\n"
+                         "Content-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                         "\r\n" + body;
+
+  // The session must never wait for a slow reader
+  ssize_t len = send(sock->getFd(), response.data(), response.size(),
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (len < (ssize_t)response.size()) {
+    vlog.error("Failed to send metrics");
+  }
+}
+
 int main(int argc, char** argv)
 {
   initStdIOLoggers();
@@ -274,7 +332,42 @@ int main(int argc, char** argv)
   std::unique_ptr<DesktopMux> desktopMux;
   std::unique_ptr<TerminalDesktop> terminalDesktop;
   std::list<SocketListener*> listeners;
+  std::unique_ptr<SocketListener> metricsListener;
+  uint64_t lockWaitTime = 0;
   Geometry terminalGeo((int)terminalWidth, (int)terminalHeight);
+  int handoffFd = -1;
+
+  if (workers > 0) {
+    if (!interactiveLogin) {
+      vlog.error("Workers requires InteractiveLogin");
+      return 1;
+    }
+
+    // This process only accepts connections and passes each of them
+    // on to an already started copy of itself
+    try {
+      WorkerPool pool(workers);
+
+      signal(SIGINT, CleanupSignalHandler);
+      signal(SIGTERM, CleanupSignalHandler);
+
+      listenServer(listeners);
+      handoffFd = pool.run(listeners, &caughtSignal);
+    } catch (rdr::Exception &e) {
+      vlog.error("%s", e.str());
+      return 1;
+    }
+
+    if (handoffFd < 0) {
+      for (std::list<SocketListener*>::iterator i = listeners.begin();
+           i != listeners.end();
+           i++) {
+        delete *i;
+      }
+      vlog.info("Terminated");
+      return 0;
+    }
+  }
 
   if (interactiveLogin) {
     try {
@@ -287,10 +380,19 @@ int main(int argc, char** argv)
       desktopMux->desktop = terminalDesktop.get();
       server.reset(new VNCServerST("rdp2vnc", desktopMux.get()));
       
-      listenServer(listeners);
+      if (handoffFd >= 0) {
+        WorkerPool::notifyReady(handoffFd);
+        Socket* sock = WorkerPool::receiveConnection(handoffFd);
+        if (!sock) {
+          return 0;
+        }
+        server->addSocket(sock);
+      } else {
+        listenServer(listeners);
+      }
       if (!runTerminal(terminalDesktop.get(), server.get(), listeners, &caughtSignal, [&](int infd, int outfd) {
         greeter.handle(infd, outfd);
-      })) {
+      }, handoffFd >= 0)) {
         return 1;
       }
       rdpClient = move(greeter.getRDPClient());
@@ -312,6 +414,10 @@ int main(int argc, char** argv)
       vlog.error("%s", e.str());
       return 1;
     }
+
+    // The greeter is gone and the server has been handed the RDP frame
+    // buffer, so the terminal's buffers are no longer needed
+    terminalDesktop.reset();
   } else {
     try {
       rdpClient.reset(new RDPClient(rdpArgc, rdpArgv, caughtSignal));
@@ -334,6 +440,10 @@ int main(int argc, char** argv)
 
   // RDP client and VNC Desktop have been set
   try {
+    if (strcmp(metricsSocket, "") != 0) {
+      metricsListener = listenMetrics();
+    }
+
     while (!caughtSignal) {
       struct timeval tv;
       fd_set rfds, wfds;
@@ -349,6 +459,9 @@ int main(int argc, char** argv)
              i != listeners.end();
              i++)
           FD_SET((*i)->getFd(), &rfds);
+        if (metricsListener) {
+          FD_SET(metricsListener->getFd(), &rfds);
+        }
 
         server->getSockets(&sockets);
         int clients_connected = 0;
@@ -363,6 +476,12 @@ int main(int argc, char** argv)
             clients_connected++;
           }
         }
+
+        // Nobody can reach a pooled session once its connection is gone
+        if (handoffFd >= 0 && clients_connected == 0) {
+          vlog.info("Connection closed, ending session");
+          break;
+        }
       }
 
       tv.tv_sec = 0;
@@ -381,7 +500,15 @@ int main(int argc, char** argv)
 
 
       {
-        std::lock_guard<std::mutex> lock(rdpClient->getMutex());
+        std::unique_lock<std::mutex> lock(rdpClient->getMutex(),
+                                          std::defer_lock);
+        uint64_t start = os::Trace::now();
+        {
+          TRACE_SPAN("rdp2vnc: wait for mutexVNC");
+          lock.lock();
+        }
+        lockWaitTime += os::Trace::now() - start;
+        TRACE_SPAN("rdp2vnc: process sockets");
         // Accept new VNC connections
         for (std::list<SocketListener*>::iterator i = listeners.begin();
              i != listeners.end();
@@ -396,6 +523,13 @@ int main(int argc, char** argv)
           }
         }
 
+        if (metricsListener && FD_ISSET(metricsListener->getFd(), &rfds)) {
+          std::unique_ptr<Socket> sock(metricsListener->accept());
+          if (sock) {
+            serveMetrics(sock.get(), server.get(), rdpClient.get(), lockWaitTime);
+          }
+        }
+
         Timer::checkTimeouts();
 
         // Client list could have been changed.
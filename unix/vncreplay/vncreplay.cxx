@@ -0,0 +1,509 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- vncreplay.cxx - Serve a session recording to VNC viewers
+//
+// The recording is decoded as if it was a live connection, and the
+// result is served to any number of viewers. Playback starts once the
+// first viewer connects and is paused whenever there are none.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include <os/Trace.h>
+#include <rdr/MemOutStream.h>
+#include <rfb/CConnection.h>
+#include <rfb/CMsgReader.h>
+#include <rfb/CMsgWriter.h>
+#include <rfb/Configuration.h>
+#include <rfb/Logger_stdio.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SDesktop.h>
+#include <rfb/SessionRecording.h>
+#include <rfb/Timer.h>
+#include <rfb/VNCServerST.h>
+#include <rfb/util.h>
+#include <network/TcpSocket.h>
+#include <network/UnixSocket.h>
+
+using namespace rfb;
+using namespace network;
+
+static LogWriter vlog("Main");
+
+IntParameter rfbport("rfbport", "TCP port to listen for RFB protocol",5900);
+StringParameter rfbunixpath("rfbunixpath", "Unix socket to listen for RFB protocol", "");
+IntParameter rfbunixmode("rfbunixmode", "Unix socket access mode", 0600);
+BoolParameter localhostOnly("localhost",
+                            "Only allow connections from localhost",
+                            false);
+
+// The format the recording is decoded to, and served in
+static const PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+
+static bool caughtSignal = false;
+
+static void CleanupSignalHandler(int sig)
+{
+  caughtSignal = true;
+}
+
+class ReplayDesktop : public SDesktop {
+public:
+  ReplayDesktop() : server(NULL), running(false) {}
+
+  void setServer(VNCServer* vs) { server = vs; }
+  bool isRunning() { return running; }
+
+  virtual void start(VNCServer* vs) { running = true; }
+  virtual void stop() { running = false; }
+  virtual void queryConnection(network::Socket* sock,
+                               const char* userName) {
+    server->approveConnection(sock, true, NULL);
+  }
+  virtual void terminate() { kill(getpid(), SIGTERM); }
+
+private:
+  VNCServer* server;
+  bool running;
+};
+
+// ReplayConnection decodes a single recorded stream. The framebuffer
+// of a CConnection goes away with it, so the result is copied to a
+// separate buffer that outlives the stream.
+class ReplayConnection : public CConnection {
+public:
+  ReplayConnection(SessionPlayer* player, VNCServerST* server,
+                   ManagedPixelBuffer* screen);
+  ~ReplayConnection();
+
+  bool hasFramebuffer() { return getFramebuffer() != NULL; }
+
+  // Discards the messages we would have sent to the server
+  void clearOutput() { out.clear(); }
+
+  virtual void initDone();
+  virtual void resizeFramebuffer();
+  virtual void setCursor(int, int, const Point&, const rdr::U8*);
+  virtual void setCursorPos(const Point&);
+  virtual void setName(const char* name);
+  virtual void framebufferUpdateEnd();
+  virtual bool dataRect(const Rect&, int);
+  virtual void setColourMapEntries(int, int, rdr::U16*);
+  virtual void bell();
+  virtual void serverCutText(const char*);
+
+private:
+  rdr::MemOutStream out;
+
+  VNCServerST* vncServer;
+  ManagedPixelBuffer* screen;
+
+  Region damage;
+};
+
+ReplayConnection::ReplayConnection(SessionPlayer* player,
+                                   VNCServerST* server_,
+                                   ManagedPixelBuffer* screen_)
+  : vncServer(server_), screen(screen_)
+{
+  setStreams(player, &out);
+
+  // The recording starts with the ServerInit message
+  setState(RFBSTATE_INITIALISATION);
+  setReader(new CMsgReader(this, player));
+  setWriter(new CMsgWriter(&server, &out));
+}
+
+ReplayConnection::~ReplayConnection()
+{
+}
+
+void ReplayConnection::initDone()
+{
+  resizeFramebuffer();
+}
+
+void ReplayConnection::resizeFramebuffer()
+{
+  ModifiablePixelBuffer* fb;
+  const rdr::U8* data;
+  int stride;
+
+  setFramebuffer(new ManagedPixelBuffer(fbPF, server.width(),
+                                        server.height()));
+
+  fb = getFramebuffer();
+
+  screen->setSize(fb->width(), fb->height());
+  data = fb->getBuffer(fb->getRect(), &stride);
+  screen->imageRect(fb->getRect(), data, stride);
+
+  vncServer->setPixelBuffer(screen, server.screenLayout());
+
+  damage.clear();
+}
+
+void ReplayConnection::setCursor(int width, int height,
+                                 const Point& hotspot,
+                                 const rdr::U8* data)
+{
+  vncServer->setCursor(width, height, hotspot, data);
+}
+
+void ReplayConnection::setCursorPos(const Point& pos)
+{
+  vncServer->setCursorPos(pos, false);
+}
+
+void ReplayConnection::setName(const char* name)
+{
+  CConnection::setName(name);
+  vncServer->setName(name);
+}
+
+void ReplayConnection::framebufferUpdateEnd()
+{
+  ModifiablePixelBuffer* fb;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+
+  // Makes sure all rects have been decoded
+  CConnection::framebufferUpdateEnd();
+
+  fb = getFramebuffer();
+
+  damage.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); ++i) {
+    const rdr::U8* data;
+    int stride;
+
+    data = fb->getBuffer(*i, &stride);
+    screen->imageRect(*i, data, stride);
+  }
+
+  vncServer->add_changed(damage);
+  damage.clear();
+}
+
+bool ReplayConnection::dataRect(const Rect& r, int encoding)
+{
+  if (!CConnection::dataRect(r, encoding))
+    return false;
+
+  damage.assign_union(r);
+
+  return true;
+}
+
+void ReplayConnection::setColourMapEntries(int, int, rdr::U16*)
+{
+}
+
+void ReplayConnection::bell()
+{
+  vncServer->bell();
+}
+
+void ReplayConnection::serverCutText(const char*)
+{
+}
+
+static ReplayConnection* processRecord(SessionPlayer* player,
+                                       ReplayConnection* conn,
+                                       VNCServerST* server,
+                                       ManagedPixelBuffer* screen)
+{
+  PixelFormat pf;
+
+  switch (player->recordType()) {
+  case sessionRecordStream:
+    delete conn;
+    // Anything still buffered belongs to the previous stream
+    if (player->avail())
+      player->skip(player->avail());
+    vlog.info("New stream at %u ms", player->timestamp());
+    conn = new ReplayConnection(player, server, screen);
+    break;
+  case sessionRecordPixelFormat:
+    player->readPixelFormat(&pf);
+    if (conn != NULL)
+      conn->setPixelFormat(pf);
+    break;
+  case sessionRecordData:
+    if (conn == NULL)
+      break;
+    try {
+      while (conn->processMsg())
+        ;
+      conn->clearOutput();
+    } catch (rdr::Exception& e) {
+      // Most likely data the recorder had to drop, so give up until
+      // the next stream
+      vlog.error("Failed to decode stream: %s", e.str());
+      delete conn;
+      conn = NULL;
+    }
+    break;
+  default:
+    vlog.debug("Ignoring record of unknown type %d",
+               player->recordType());
+  }
+
+  return conn;
+}
+
+char* programName;
+
+static void printVersion(FILE *fp)
+{
+  fprintf(fp, "TigerVNC session player version %s\n", PACKAGE_VERSION);
+}
+
+static void usage()
+{
+  printVersion(stderr);
+  fprintf(stderr, "\nUsage: %s [<parameters>] <recording>\n", programName);
+  fprintf(stderr, "       %s --version\n", programName);
+  fprintf(stderr,"\n"
+          "Parameters can be turned on with -<param> or off with -<param>=0\n"
+          "Parameters which take a value can be specified as "
+          "-<param> <value>\n"
+          "Other valid forms are <param>=<value> -<param>=<value> "
+          "--<param>=<value>\n"
+          "Parameter names are case-insensitive.  The parameters are:\n\n");
+  Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  const char* filename;
+
+  initStdIOLoggers();
+  LogWriter::setLogParams("*:stderr:30");
+
+  programName = argv[0];
+  filename = NULL;
+
+  Configuration::enableServerParams();
+
+  for (int i = 1; i < argc; i++) {
+    if (Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i+1 < argc) {
+        if (Configuration::setParam(&argv[i][1], argv[i+1])) {
+          i++;
+          continue;
+        }
+      }
+      if (strcmp(argv[i], "-v") == 0 ||
+          strcmp(argv[i], "-version") == 0 ||
+          strcmp(argv[i], "--version") == 0) {
+        printVersion(stdout);
+        return 0;
+      }
+      usage();
+    }
+
+    if (filename != NULL)
+      usage();
+    filename = argv[i];
+  }
+
+  if (filename == NULL)
+    usage();
+
+  signal(SIGHUP, CleanupSignalHandler);
+  signal(SIGINT, CleanupSignalHandler);
+  signal(SIGTERM, CleanupSignalHandler);
+
+  std::list<SocketListener*> listeners;
+
+  try {
+    SessionPlayer player(filename);
+    ManagedPixelBuffer screen(fbPF, 0, 0);
+    ReplayConnection* conn;
+    bool haveRecord;
+    unsigned long long playTime, lastTick;
+
+    ReplayDesktop desktop;
+    VNCServerST server("vncreplay", &desktop);
+    desktop.setServer(&server);
+
+    // Decode up to the first ServerInit, so there is something to
+    // show the viewers
+    conn = NULL;
+    haveRecord = player.nextRecord();
+    while (haveRecord && ((conn == NULL) || !conn->hasFramebuffer())) {
+      conn = processRecord(&player, conn, &server, &screen);
+      haveRecord = player.nextRecord();
+    }
+
+    if ((conn == NULL) || !conn->hasFramebuffer())
+      throw rdr::Exception("No usable stream in %s", filename);
+
+    if (rfbunixpath.getValueStr()[0] != '\0') {
+      listeners.push_back(new network::UnixListener(rfbunixpath, rfbunixmode));
+      vlog.info("Listening on %s (mode %04o)", (const char*)rfbunixpath, (int)rfbunixmode);
+    }
+
+    if ((int)rfbport != -1) {
+      if (localhostOnly)
+        createLocalTcpListeners(&listeners, (int)rfbport);
+      else
+        createTcpListeners(&listeners, 0, (int)rfbport);
+      vlog.info("Listening on port %d", (int)rfbport);
+    }
+
+    // Position in the recording, in microseconds
+    playTime = (unsigned long long)player.timestamp() * 1000;
+    lastTick = os::Trace::now();
+
+    while (!caughtSignal) {
+      int wait_ms;
+      struct timeval tv;
+      fd_set rfds, wfds;
+      std::list<Socket*> sockets;
+      std::list<Socket*>::iterator i;
+      unsigned long long now;
+
+      // The clock only runs while someone is watching
+      now = os::Trace::now();
+      if (desktop.isRunning())
+        playTime += now - lastTick;
+      lastTick = now;
+
+      while (haveRecord) {
+        unsigned long long recordTime;
+
+        recordTime = (unsigned long long)player.timestamp() * 1000;
+
+        // No point in waiting for the recorded client to reconnect
+        if ((player.recordType() == sessionRecordStream) &&
+            (recordTime > playTime))
+          playTime = recordTime;
+
+        if (recordTime > playTime)
+          break;
+
+        conn = processRecord(&player, conn, &server, &screen);
+        haveRecord = player.nextRecord();
+        if (!haveRecord)
+          vlog.info("End of recording");
+      }
+
+      FD_ZERO(&rfds);
+      FD_ZERO(&wfds);
+
+      for (std::list<SocketListener*>::iterator i = listeners.begin();
+           i != listeners.end();
+           i++)
+        FD_SET((*i)->getFd(), &rfds);
+
+      server.getSockets(&sockets);
+      for (i = sockets.begin(); i != sockets.end(); i++) {
+        if ((*i)->isShutdown()) {
+          server.removeSocket(*i);
+          delete (*i);
+        } else {
+          FD_SET((*i)->getFd(), &rfds);
+          if ((*i)->outStream().hasBufferedData())
+            FD_SET((*i)->getFd(), &wfds);
+        }
+      }
+
+      wait_ms = 0;
+
+      if (haveRecord && desktop.isRunning()) {
+        unsigned long long recordTime;
+
+        recordTime = (unsigned long long)player.timestamp() * 1000;
+        wait_ms = (recordTime - playTime + 999) / 1000;
+      }
+
+      soonestTimeout(&wait_ms, Timer::checkTimeouts());
+
+      tv.tv_sec = wait_ms / 1000;
+      tv.tv_usec = (wait_ms % 1000) * 1000;
+
+      int n = select(FD_SETSIZE, &rfds, &wfds, 0,
+                     wait_ms ? &tv : NULL);
+
+      if (n < 0) {
+        if (errno == EINTR) {
+          vlog.debug("Interrupted select() system call");
+          continue;
+        } else {
+          throw rdr::SystemException("select", errno);
+        }
+      }
+
+      // Accept new VNC connections
+      for (std::list<SocketListener*>::iterator i = listeners.begin();
+           i != listeners.end();
+           i++) {
+        if (FD_ISSET((*i)->getFd(), &rfds)) {
+          Socket* sock = (*i)->accept();
+          if (sock) {
+            server.addSocket(sock);
+          } else {
+            vlog.status("Client connection rejected");
+          }
+        }
+      }
+
+      Timer::checkTimeouts();
+
+      // Client list could have been changed.
+      server.getSockets(&sockets);
+
+      // Process events on existing VNC connections
+      for (i = sockets.begin(); i != sockets.end(); i++) {
+        if (FD_ISSET((*i)->getFd(), &rfds))
+          server.processSocketReadEvent(*i);
+        if (FD_ISSET((*i)->getFd(), &wfds))
+          server.processSocketWriteEvent(*i);
+      }
+    }
+
+    delete conn;
+
+  } catch (rdr::Exception &e) {
+    vlog.error("%s", e.str());
+    return 1;
+  }
+
+  // Run listener destructors; remove UNIX sockets etc
+  for (std::list<SocketListener*>::iterator i = listeners.begin();
+       i != listeners.end();
+       i++) {
+    delete *i;
+  }
+
+  vlog.info("Terminated");
+  return 0;
+}
@@ -23,6 +23,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <X11/Xlib.h>
 #include <rfb/LogWriter.h>
 #include <rfb/VNCServer.h>
@@ -35,6 +41,9 @@ using namespace rfb;
 
 static LogWriter vlog("PollingMgr");
 
+// How often timing statistics are logged, in milliseconds
+static const unsigned statsInterval = 10000;
+
 const int PollingManager::m_pollingOrder[32] = {
    0, 16,  8, 24,  4, 20, 12, 28,
   10, 26, 18,  2, 22,  6, 30, 14,
@@ -81,6 +90,14 @@ PollingManager::PollingManager(Display *dpy, const Image *image,
 
   m_changeFlags = new bool[m_numTiles];
   memset(m_changeFlags, 0, m_numTiles * sizeof(bool));
+
+  gettimeofday(&m_statsStart, NULL);
+  m_pollEnd = m_statsStart;
+  m_statsPolls = 0;
+  m_statsPollTime = 0;
+  m_statsMaxPollTime = 0;
+  m_statsWaitTime = 0;
+  m_statsTilesChanged = 0;
 }
 
 PollingManager::~PollingManager()
@@ -92,28 +109,52 @@ PollingManager::~PollingManager()
 }
 
 //
-// DEBUG: Measuring time spent in the poll() function,
-//        as well as time intervals between poll() calls.
+// Timing statistics: time spent in the poll() function, time
+// intervals between poll() calls and the number of tiles found to be
+// changed. Collected continuously and logged every statsInterval.
 //
 
-#ifdef DEBUG
-void PollingManager::debugBeforePoll()
+static unsigned usBetween(const struct timeval *first,
+                          const struct timeval *second)
 {
-  TimeMillis timeNow;
-  int diff = timeNow.diffFrom(m_timeSaved);
-  fprintf(stderr, "[wait%4dms]\t[step %2d]\t", diff, m_pollingStep % 32);
-  m_timeSaved = timeNow;
+  return (second->tv_sec - first->tv_sec) * 1000000 +
+         (second->tv_usec - first->tv_usec);
 }
 
-void PollingManager::debugAfterPoll()
+void PollingManager::statsBeforePoll()
 {
-  TimeMillis timeNow;
-  int diff = timeNow.diffFrom(m_timeSaved);
-  fprintf(stderr, "[poll%4dms]\n", diff);
-  m_timeSaved = timeNow;
+  gettimeofday(&m_pollStart, NULL);
+  m_statsWaitTime += usBetween(&m_pollEnd, &m_pollStart);
 }
 
-#endif
+void PollingManager::statsAfterPoll()
+{
+  unsigned elapsed;
+
+  gettimeofday(&m_pollEnd, NULL);
+
+  elapsed = usBetween(&m_pollStart, &m_pollEnd);
+  m_statsPolls++;
+  m_statsPollTime += elapsed;
+  if (elapsed > m_statsMaxPollTime)
+    m_statsMaxPollTime = elapsed;
+
+  if (usBetween(&m_statsStart, &m_pollEnd) < statsInterval * 1000)
+    return;
+
+  vlog.debug("%u polls, %llu us avg (%u us max), %llu ms avg interval",
+             m_statsPolls, m_statsPollTime / m_statsPolls,
+             m_statsMaxPollTime,
+             m_statsWaitTime / m_statsPolls / 1000);
+  vlog.debug("%u tiles changed", m_statsTilesChanged);
+
+  m_statsStart = m_pollEnd;
+  m_statsPolls = 0;
+  m_statsPollTime = 0;
+  m_statsMaxPollTime = 0;
+  m_statsWaitTime = 0;
+  m_statsTilesChanged = 0;
+}
 
 //
 // Search for changed rectangles on the screen.
@@ -121,15 +162,60 @@ void PollingManager::debugAfterPoll()
 
 void PollingManager::poll(VNCServer *server)
 {
-#ifdef DEBUG
-  debugBeforePoll();
-#endif
+  statsBeforePoll();
 
   pollScreen(server);
 
-#ifdef DEBUG
-  debugAfterPoll();
+  statsAfterPoll();
+}
+
+//
+// Compare two blocks of pixel data, returns true if they differ.
+// This runs for every tile of every row that is polled, so avoid the
+// overhead of memcmp() when SSE2 is available.
+//
+
+static inline bool pixelsDiffer(const char *a, const char *b, int len)
+{
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+
+  while (len >= 64) {
+    __m128i d0, d1, d2, d3;
+
+    d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)a),
+                       _mm_loadu_si128((const __m128i*)b));
+    d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 16)),
+                       _mm_loadu_si128((const __m128i*)(b + 16)));
+    d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 32)),
+                       _mm_loadu_si128((const __m128i*)(b + 32)));
+    d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 48)),
+                       _mm_loadu_si128((const __m128i*)(b + 48)));
+
+    d0 = _mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(d0, zero)) != 0xffff)
+      return true;
+
+    a += 64;
+    b += 64;
+    len -= 64;
+  }
+
+  while (len >= 16) {
+    __m128i d;
+
+    d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)a),
+                      _mm_loadu_si128((const __m128i*)b));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, zero)) != 0xffff)
+      return true;
+
+    a += 16;
+    b += 16;
+    len -= 16;
+  }
 #endif
+
+  return (len != 0) && (memcmp(a, b, len) != 0);
 }
 
 #ifdef DEBUG_REPORT_CHANGED_TILES
@@ -168,6 +254,8 @@ bool PollingManager::pollScreen(VNCServer *server)
     nTilesChanged = sendChanges(server);
   }
 
+  m_statsTilesChanged += nTilesChanged;
+
 #ifdef DEBUG_PRINT_NUM_CHANGED_TILES
   printf("%3d ", nTilesChanged);
   if (m_pollingStep % 32 == 0) {
@@ -175,12 +263,6 @@ bool PollingManager::pollScreen(VNCServer *server)
   }
 #endif
 
-#ifdef DEBUG
-  if (nTilesChanged != 0) {
-    fprintf(stderr, "#%d# ", nTilesChanged);
-  }
-#endif
-
   return (nTilesChanged != 0);
 }
 
@@ -209,7 +291,7 @@ int PollingManager::checkRow(int x, int y, int w)
   int nTilesChanged = 0;
   int nBytesPerTile = 32 * m_bytesPerPixel;
   for (int i = 0; i < w / 32; i++) {
-    if (memcmp(ptr_old, ptr_new, nBytesPerTile)) {
+    if (pixelsDiffer(ptr_old, ptr_new, nBytesPerTile)) {
       *pChangeFlags = true;
       nTilesChanged++;
     }
@@ -221,7 +303,7 @@ int PollingManager::checkRow(int x, int y, int w)
   // Handle the rightmost pixels, if the width is not a multiple of 32.
   int nBytesLeft = (w % 32) * m_bytesPerPixel;
   if (nBytesLeft != 0) {
-    if (memcmp(ptr_old, ptr_new, nBytesLeft)) {
+    if (pixelsDiffer(ptr_old, ptr_new, nBytesLeft)) {
       *pChangeFlags = true;
       nTilesChanged++;
     }
@@ -23,15 +23,13 @@
 #ifndef __POLLINGMANAGER_H__
 #define __POLLINGMANAGER_H__
 
+#include <sys/time.h>
+
 #include <X11/Xlib.h>
 #include <rfb/VNCServer.h>
 
 #include <x0vncserver/Image.h>
 
-#ifdef DEBUG
-#include <x0vncserver/TimeMillis.h>
-#endif
-
 class PollingManager {
 
 public:
@@ -107,14 +105,21 @@ private:
   unsigned int m_pollingStep;
   static const int m_pollingOrder[];
 
-#ifdef DEBUG
 private:
 
-  void debugBeforePoll();
-  void debugAfterPoll();
+  // Timing statistics, written to the log at regular intervals.
+  void statsBeforePoll();
+  void statsAfterPoll();
+
+  struct timeval m_statsStart;
+  struct timeval m_pollStart;
+  struct timeval m_pollEnd;
 
-  TimeMillis m_timeSaved;
-#endif
+  unsigned m_statsPolls;
+  unsigned long long m_statsPollTime;
+  unsigned m_statsMaxPollTime;
+  unsigned long long m_statsWaitTime;
+  unsigned m_statsTilesChanged;
 
 };
 
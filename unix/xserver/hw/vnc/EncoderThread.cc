@@ -0,0 +1,153 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// EncoderThread.cc
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include <rdr/Exception.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Timer.h>
+
+#include "EncoderThread.h"
+#include "XserverDesktop.h"
+
+using namespace rfb;
+
+static LogWriter vlog("EncoderThread");
+
+EncoderThread::EncoderThread()
+  : stopRequested(false)
+{
+  if (pipe(wakeupPipe) < 0)
+    throw rdr::SystemException("pipe", errno);
+
+  fcntl(wakeupPipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(wakeupPipe[1], F_SETFL, O_NONBLOCK);
+}
+
+EncoderThread::~EncoderThread()
+{
+  stop();
+  wait();
+
+  close(wakeupPipe[0]);
+  close(wakeupPipe[1]);
+}
+
+void EncoderThread::addDesktop(XserverDesktop* desktop)
+{
+  os::AutoMutex a(&lock);
+  desktops.push_back(desktop);
+}
+
+void EncoderThread::removeDesktop(XserverDesktop* desktop)
+{
+  os::AutoMutex a(&lock);
+  desktops.remove(desktop);
+}
+
+bool EncoderThread::hasDesktops()
+{
+  os::AutoMutex a(&lock);
+  return !desktops.empty();
+}
+
+void EncoderThread::wakeup()
+{
+  char c = 0;
+
+  // A full pipe means a wakeup is already pending
+  if (write(wakeupPipe[1], &c, 1) < 0 && errno != EAGAIN)
+    vlog.error("Failed to wake up encoder thread: %s", strerror(errno));
+}
+
+void EncoderThread::stop()
+{
+  os::AutoMutex a(&lock);
+  stopRequested = true;
+  wakeup();
+}
+
+void EncoderThread::worker()
+{
+  std::list<XserverDesktop*>::iterator i;
+
+  lock.lock();
+
+  while (!stopRequested) {
+    fd_set rfds, wfds;
+    int nfds, timeout;
+    struct timeval tv;
+    int ret;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+
+    FD_SET(wakeupPipe[0], &rfds);
+    nfds = wakeupPipe[0] + 1;
+
+    timeout = -1;
+
+    try {
+      for (i = desktops.begin(); i != desktops.end(); i++)
+        (*i)->prepareSocketEvents(&rfds, &wfds, &nfds);
+
+      timeout = Timer::checkTimeouts();
+    } catch (rdr::Exception& e) {
+      vlog.error("%s", e.str());
+    }
+
+    lock.unlock();
+
+    if (timeout > 0) {
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+    }
+
+    ret = select(nfds, &rfds, &wfds, NULL, timeout > 0 ? &tv : NULL);
+
+    lock.lock();
+
+    if (ret < 0) {
+      if (errno != EINTR)
+        vlog.error("select: %s", strerror(errno));
+      continue;
+    }
+
+    if (FD_ISSET(wakeupPipe[0], &rfds)) {
+      char buf[64];
+      while (read(wakeupPipe[0], buf, sizeof(buf)) > 0)
+        ;
+    }
+
+    try {
+      for (i = desktops.begin(); i != desktops.end(); i++)
+        (*i)->processSocketEvents(&rfds, &wfds);
+    } catch (rdr::Exception& e) {
+      vlog.error("%s", e.str());
+    }
+  }
+
+  lock.unlock();
+}
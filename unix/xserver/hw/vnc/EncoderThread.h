@@ -0,0 +1,67 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// EncoderThread.h
+//
+// Runs the RFB side of all XserverDesktop instances (client sockets,
+// encoding and timers) outside of the X server's dispatch loop. All
+// access to the VNC servers must be done with the lock held. The X
+// thread only hands over snapshots of damaged areas and takes care of
+// any requests that need to touch X server state.
+//
+
+#ifndef __ENCODERTHREAD_H__
+#define __ENCODERTHREAD_H__
+
+#include <list>
+
+#include <os/Mutex.h>
+#include <os/Thread.h>
+
+class XserverDesktop;
+
+class EncoderThread : public os::Thread {
+public:
+  EncoderThread();
+  virtual ~EncoderThread();
+
+  void addDesktop(XserverDesktop* desktop);
+  void removeDesktop(XserverDesktop* desktop);
+  bool hasDesktops();
+
+  // Interrupts the thread's wait so that it rechecks its sockets
+  // and timers
+  void wakeup();
+
+  void stop();
+
+  os::Mutex* getLock() { return &lock; }
+
+protected:
+  virtual void worker();
+
+private:
+  os::Mutex lock;
+  bool stopRequested;
+
+  std::list<XserverDesktop*> desktops;
+
+  int wakeupPipe[2];
+};
+
+#endif
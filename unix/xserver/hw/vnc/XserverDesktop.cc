@@ -22,9 +22,11 @@
 //
 
 #include <assert.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <unistd.h>
 #include <pwd.h>
@@ -32,6 +34,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/utsname.h>
+#include <sys/select.h>
 
 #include <network/Socket.h>
 #include <rfb/Exception.h>
@@ -41,6 +44,7 @@
 #include <rfb/ServerCore.h>
 
 #include "XserverDesktop.h"
+#include "EncoderThread.h"
 #include "vncBlockHandler.h"
 #include "vncExtInit.h"
 #include "vncHooks.h"
@@ -66,6 +70,28 @@ IntParameter queryConnectTimeout("QueryConnectTimeout",
                                  "Accept Connection dialog before "
                                  "rejecting the connection",
                                  10);
+BoolParameter useEncoderThread("EncoderThread",
+                               "Handle VNC clients and encode updates in "
+                               "a separate thread, rather than in the X "
+                               "server's main loop", false);
+
+// Shared by all screens, as rfb::Timer is not thread safe
+static EncoderThread* encoderThread = NULL;
+
+// Holds the encoder thread's lock, if the thread is in use
+class EncoderLock {
+public:
+  EncoderLock(EncoderThread* t) : thread(t) {
+    if (thread)
+      thread->getLock()->lock();
+  }
+  ~EncoderLock() {
+    if (thread)
+      thread->getLock()->unlock();
+  }
+private:
+  EncoderThread* thread;
+};
 
 
 XserverDesktop::XserverDesktop(int screenIndex_,
@@ -76,13 +102,36 @@ XserverDesktop::XserverDesktop(int screenIndex_,
   : screenIndex(screenIndex_),
     server(0), listeners(listeners_),
     shadowFramebuffer(NULL),
-    queryConnectId(0), queryConnectTimer(this)
+    queryConnectId(0), queryConnectTimer(this),
+    encoder(NULL), snapshot(NULL),
+    pendingCursorPos(false), pendingCursorWarped(false),
+    pendingCursor(false), layoutDone(NULL), layoutPending(false)
 {
   format = pf;
 
+  if (useEncoderThread) {
+    if (encoderThread == NULL) {
+      encoderThread = new EncoderThread();
+      encoderThread->start();
+    }
+    encoder = encoderThread;
+
+    snapshot = new ManagedPixelBuffer(pf, width, height);
+    layoutDone = new os::Condition(encoder->getLock());
+
+    if (pipe(eventPipe) < 0)
+      throw rdr::SystemException("pipe", errno);
+    fcntl(eventPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(eventPipe[1], F_SETFL, O_NONBLOCK);
+    vncSetNotifyFd(eventPipe[0], screenIndex, true, false);
+  }
+
   server = new VNCServerST(name, this);
   setFramebuffer(width, height, fbptr, stride);
 
+  if (encoder)
+    encoder->addDesktop(this);
+
   for (std::list<SocketListener*>::iterator i = listeners.begin();
        i != listeners.end();
        i++) {
@@ -97,18 +146,51 @@ XserverDesktop::~XserverDesktop()
     delete listeners.back();
     listeners.pop_back();
   }
+
+  if (encoder) {
+    encoder->removeDesktop(this);
+
+    {
+      EncoderLock l(encoder);
+      std::map<network::Socket*, bool>::iterator iter;
+
+      queryConnectTimer.stop();
+      delete server;
+
+      for (iter = queuedQueries.begin(); iter != queuedQueries.end(); ++iter) {
+        if (iter->second)
+          delete iter->first;
+      }
+    }
+
+    if (!encoder->hasDesktops()) {
+      delete encoderThread;
+      encoderThread = NULL;
+    }
+
+    vncRemoveNotifyFd(eventPipe[0]);
+    close(eventPipe[0]);
+    close(eventPipe[1]);
+
+    delete layoutDone;
+    delete snapshot;
+  } else {
+    delete server;
+  }
+
   if (shadowFramebuffer)
     delete [] shadowFramebuffer;
-  delete server;
 }
 
 void XserverDesktop::blockUpdates()
 {
+  EncoderLock l(encoder);
   server->blockUpdates();
 }
 
 void XserverDesktop::unblockUpdates()
 {
+  EncoderLock l(encoder);
   server->unblockUpdates();
 }
 
@@ -132,13 +214,37 @@ void XserverDesktop::setFramebuffer(int w, int h, void* fbptr, int stride_)
   vncSetGlueContext(screenIndex);
   layout = ::computeScreenLayout(&outputIdMap);
 
-  server->setPixelBuffer(this, layout);
+  EncoderLock l(encoder);
+
+  if (encoder) {
+    // Anything queued refers to the old framebuffer, and the new one
+    // will be sent in its entirety anyway
+    pendingChanged.clear();
+    pendingCopied.clear();
+
+    const rdr::U8* buffer;
+    int bufStride;
+
+    snapshot->setSize(w, h);
+    grabRegion(getRect());
+    buffer = getBuffer(getRect(), &bufStride);
+    snapshot->imageRect(getRect(), buffer, bufStride);
+
+    server->setPixelBuffer(snapshot, layout);
+  } else {
+    server->setPixelBuffer(this, layout);
+  }
 }
 
 void XserverDesktop::refreshScreenLayout()
 {
+  ScreenSet layout;
+
   vncSetGlueContext(screenIndex);
-  server->setScreenLayout(::computeScreenLayout(&outputIdMap));
+  layout = ::computeScreenLayout(&outputIdMap);
+
+  EncoderLock l(encoder);
+  server->setScreenLayout(layout);
 }
 
 void XserverDesktop::start(rfb::VNCServer* vs)
@@ -154,6 +260,30 @@ void XserverDesktop::stop()
 
 void XserverDesktop::queryConnection(network::Socket* sock,
                                      const char* userName)
+{
+  if (encoder) {
+    QueuedEvent event;
+    CharArray address(sock->getPeerAddress());
+
+    event.type = QueuedEvent::QueryConnection;
+    event.sock = sock;
+    event.address = address.buf;
+    event.data = userName ? userName : "";
+
+    // We're called with the encoder lock held
+    queuedQueries[sock] = false;
+
+    queueEvent(event);
+    return;
+  }
+
+  CharArray address(sock->getPeerAddress());
+  startQueryConnect(sock, address.buf, userName);
+}
+
+void XserverDesktop::startQueryConnect(network::Socket* sock,
+                                       const char* address,
+                                       const char* userName)
 {
   int count;
 
@@ -168,7 +298,7 @@ void XserverDesktop::queryConnection(network::Socket* sock,
     return;
   }
 
-  queryConnectAddress.replaceBuf(sock->getPeerAddress());
+  queryConnectAddress.replaceBuf(strDup(address));
   if (!userName)
     userName = "(anonymous)";
   queryConnectUsername.replaceBuf(strDup(userName));
@@ -180,6 +310,8 @@ void XserverDesktop::queryConnection(network::Socket* sock,
 
 void XserverDesktop::requestClipboard()
 {
+  EncoderLock l(encoder);
+
   try {
     server->requestClipboard();
   } catch (rdr::Exception& e) {
@@ -189,6 +321,8 @@ void XserverDesktop::requestClipboard()
 
 void XserverDesktop::announceClipboard(bool available)
 {
+  EncoderLock l(encoder);
+
   try {
     server->announceClipboard(available);
   } catch (rdr::Exception& e) {
@@ -198,6 +332,8 @@ void XserverDesktop::announceClipboard(bool available)
 
 void XserverDesktop::sendClipboardData(const char* data)
 {
+  EncoderLock l(encoder);
+
   try {
     server->sendClipboardData(data);
   } catch (rdr::Exception& e) {
@@ -207,16 +343,20 @@ void XserverDesktop::sendClipboardData(const char* data)
 
 void XserverDesktop::bell()
 {
+  EncoderLock l(encoder);
   server->bell();
 }
 
 void XserverDesktop::setLEDState(unsigned int state)
 {
+  EncoderLock l(encoder);
   server->setLEDState(state);
 }
 
 void XserverDesktop::setDesktopName(const char* name)
 {
+  EncoderLock l(encoder);
+
   try {
     server->setName(name);
   } catch (rdr::Exception& e) {
@@ -252,6 +392,18 @@ void XserverDesktop::setCursor(int width, int height, int hotX, int hotY,
     }
   }
 
+  if (encoder) {
+    // Cursor changes are frequent, so avoid waiting on the encoder
+    // thread and let the block handler pass on the latest shape
+    pendingCursor = true;
+    pendingCursorWidth = width;
+    pendingCursorHeight = height;
+    pendingCursorHotspot = Point(hotX, hotY);
+    pendingCursorData.assign(cursorData, cursorData + width * height * 4);
+    delete [] cursorData;
+    return;
+  }
+
   try {
     server->setCursor(width, height, Point(hotX, hotY), cursorData);
   } catch (rdr::Exception& e) {
@@ -263,6 +415,13 @@ void XserverDesktop::setCursor(int width, int height, int hotX, int hotY,
 
 void XserverDesktop::setCursorPos(int x, int y, bool warped)
 {
+  if (encoder) {
+    oldCursorPos = Point(x, y);
+    pendingCursorPos = true;
+    pendingCursorWarped = pendingCursorWarped || warped;
+    return;
+  }
+
   try {
     server->setCursorPos(Point(x, y), warped);
   } catch (rdr::Exception& e) {
@@ -272,6 +431,17 @@ void XserverDesktop::setCursorPos(int x, int y, bool warped)
 
 void XserverDesktop::add_changed(const rfb::Region &region)
 {
+  if (encoder) {
+    // Changes are always handed over before copies, so fold any
+    // earlier copy in to the changed region to keep the order intact
+    if (!pendingCopied.is_empty()) {
+      pendingChanged.assign_union(pendingCopied);
+      pendingCopied.clear();
+    }
+    pendingChanged.assign_union(region);
+    return;
+  }
+
   try {
     server->add_changed(region);
   } catch (rdr::Exception& e) {
@@ -281,6 +451,14 @@ void XserverDesktop::add_changed(const rfb::Region &region)
 
 void XserverDesktop::add_copied(const rfb::Region &dest, const rfb::Point &delta)
 {
+  if (encoder) {
+    if (!pendingCopied.is_empty())
+      pendingChanged.assign_union(pendingCopied);
+    pendingCopied = dest;
+    pendingCopyDelta = delta;
+    return;
+  }
+
   try {
     server->add_copied(dest, delta);
   } catch (rdr::Exception& e) {
@@ -291,6 +469,11 @@ void XserverDesktop::add_copied(const rfb::Region &dest, const rfb::Point &delta
 void XserverDesktop::handleSocketEvent(int fd, bool read, bool write)
 {
   try {
+    if (encoder && (fd == eventPipe[0])) {
+      handleQueuedEvents();
+      return;
+    }
+
     if (read) {
       if (handleListenerEvent(fd, &listeners, server))
         return;
@@ -321,6 +504,14 @@ bool XserverDesktop::handleListenerEvent(int fd,
 
   Socket* sock = (*i)->accept();
   vlog.debug("new client, sock %d", sock->getFd());
+
+  if (encoder) {
+    EncoderLock l(encoder);
+    sockserv->addSocket(sock);
+    encoder->wakeup();
+    return true;
+  }
+
   sockserv->addSocket(sock);
   vncSetNotifyFd(sock->getFd(), screenIndex, true, false);
 
@@ -360,6 +551,20 @@ void XserverDesktop::blockHandler(int* timeout)
   // [1] Technically Xvnc has InitInput(), but libvnc.so has nothing.
   vncInitInputDevice();
 
+  if (encoder) {
+    // The encoder thread deals with the clients and timers, so all we
+    // need to do here is to give it what has changed since last time
+    int cursorX, cursorY;
+    vncGetPointerPos(&cursorX, &cursorY);
+    cursorX -= vncGetScreenX(screenIndex);
+    cursorY -= vncGetScreenY(screenIndex);
+    if (oldCursorPos.x != cursorX || oldCursorPos.y != cursorY)
+      setCursorPos(cursorX, cursorY, false);
+
+    flushPending(timeout);
+    return;
+  }
+
   try {
     std::list<Socket*> sockets;
     std::list<Socket*>::iterator i;
@@ -401,6 +606,14 @@ void XserverDesktop::blockHandler(int* timeout)
 void XserverDesktop::addClient(Socket* sock, bool reverse)
 {
   vlog.debug("new client, sock %d reverse %d",sock->getFd(),reverse);
+
+  if (encoder) {
+    EncoderLock l(encoder);
+    server->addSocket(sock, reverse);
+    encoder->wakeup();
+    return;
+  }
+
   server->addSocket(sock, reverse);
   vncSetNotifyFd(sock->getFd(), screenIndex, true, false);
 }
@@ -408,7 +621,207 @@ void XserverDesktop::addClient(Socket* sock, bool reverse)
 void XserverDesktop::disconnectClients()
 {
   vlog.debug("disconnecting all clients");
-  return server->closeClients("Disconnection from server end");
+
+  EncoderLock l(encoder);
+  server->closeClients("Disconnection from server end");
+}
+
+void XserverDesktop::prepareSocketEvents(fd_set* rfds, fd_set* wfds,
+                                         int* nfds)
+{
+  std::list<Socket*> sockets;
+  std::list<Socket*>::iterator i;
+
+  server->getSockets(&sockets);
+  for (i = sockets.begin(); i != sockets.end(); i++) {
+    int fd = (*i)->getFd();
+    if ((*i)->isShutdown()) {
+      QueuedEvent event;
+
+      vlog.debug("client gone, sock %d",fd);
+      server->removeSocket(*i);
+
+      // The X thread still has to look at a query for this socket
+      if (queuedQueries.count(*i) != 0)
+        queuedQueries[*i] = true;
+      else
+        delete (*i);
+
+      event.type = QueuedEvent::ClientGone;
+      event.fd = fd;
+      queueEvent(event);
+      continue;
+    }
+
+    FD_SET(fd, rfds);
+    if ((*i)->outStream().hasBufferedData())
+      FD_SET(fd, wfds);
+    if (fd >= *nfds)
+      *nfds = fd + 1;
+  }
+}
+
+void XserverDesktop::processSocketEvents(fd_set* rfds, fd_set* wfds)
+{
+  std::list<Socket*> sockets;
+  std::list<Socket*>::iterator i;
+
+  server->getSockets(&sockets);
+  for (i = sockets.begin(); i != sockets.end(); i++) {
+    int fd = (*i)->getFd();
+    if (FD_ISSET(fd, rfds))
+      server->processSocketReadEvent(*i);
+    if (FD_ISSET(fd, wfds))
+      server->processSocketWriteEvent(*i);
+  }
+}
+
+void XserverDesktop::queueEvent(const QueuedEvent& event)
+{
+  char c = 0;
+
+  {
+    os::AutoMutex a(&queueLock);
+    eventQueue.push_back(event);
+  }
+
+  // A full pipe means that the X thread already has been poked
+  if (write(eventPipe[1], &c, 1) < 0 && errno != EAGAIN)
+    vlog.error("Failed to wake up X server thread: %s", strerror(errno));
+}
+
+void XserverDesktop::handleQueuedEvents()
+{
+  std::list<QueuedEvent> events;
+  std::list<QueuedEvent>::iterator i;
+  char buf[64];
+
+  while (read(eventPipe[0], buf, sizeof(buf)) > 0)
+    ;
+
+  {
+    os::AutoMutex a(&queueLock);
+    events.swap(eventQueue);
+  }
+
+  for (i = events.begin(); i != events.end(); i++) {
+    switch (i->type) {
+    case QueuedEvent::PointerEvent:
+      vncPointerMove(i->pos.x + vncGetScreenX(screenIndex),
+                     i->pos.y + vncGetScreenY(screenIndex));
+      vncPointerButtonAction(i->buttonMask);
+      break;
+    case QueuedEvent::KeyEvent:
+      vncKeyboardEvent(i->keysym, i->keycode, i->down);
+      break;
+    case QueuedEvent::ScreenLayout:
+      {
+        unsigned int result;
+
+        result = applyScreenLayout(i->width, i->height, i->layout);
+
+        EncoderLock l(encoder);
+        layoutResult = result;
+        layoutPending = false;
+        layoutDone->broadcast();
+      }
+      break;
+    case QueuedEvent::ClipboardRequest:
+      vncHandleClipboardRequest();
+      break;
+    case QueuedEvent::ClipboardAnnounce:
+      vncHandleClipboardAnnounce(i->available);
+      break;
+    case QueuedEvent::ClipboardData:
+      vncHandleClipboardData(i->data.c_str());
+      break;
+    case QueuedEvent::QueryConnection:
+      {
+        EncoderLock l(encoder);
+        bool gone;
+
+        gone = queuedQueries[i->sock];
+        queuedQueries.erase(i->sock);
+
+        if (gone) {
+          delete i->sock;
+          break;
+        }
+
+        startQueryConnect(i->sock, i->address.c_str(),
+                          i->data.empty() ? NULL : i->data.c_str());
+      }
+      break;
+    case QueuedEvent::ClientGone:
+      vncClientGone(i->fd);
+      break;
+    }
+  }
+}
+
+void XserverDesktop::flushPending(int* timeout)
+{
+  if (pendingChanged.is_empty() && pendingCopied.is_empty() &&
+      !pendingCursor && !pendingCursorPos)
+    return;
+
+  // Waiting for the encoder thread here would stall the X server for
+  // as long as an update takes to encode, so just try again shortly
+  if (!encoder->getLock()->tryLock()) {
+    if ((*timeout == -1) || (*timeout > 10))
+      *timeout = 10;
+    return;
+  }
+
+  try {
+    Region damage;
+
+    damage = pendingChanged.union_(pendingCopied);
+    damage.assign_intersect(getRect());
+
+    if (!damage.is_empty()) {
+      std::vector<Rect> rects;
+      std::vector<Rect>::iterator i;
+
+      // The X server isn't drawing at the moment, so this gives us a
+      // consistent picture for the encoder thread to work from
+      grabRegion(damage);
+
+      damage.get_rects(&rects);
+      for (i = rects.begin(); i != rects.end(); i++) {
+        const rdr::U8* buffer;
+        int stride;
+
+        buffer = getBuffer(*i, &stride);
+        snapshot->imageRect(*i, buffer, stride);
+      }
+
+      if (!pendingChanged.is_empty())
+        server->add_changed(pendingChanged);
+      if (!pendingCopied.is_empty())
+        server->add_copied(pendingCopied, pendingCopyDelta);
+    }
+
+    if (pendingCursor)
+      server->setCursor(pendingCursorWidth, pendingCursorHeight,
+                        pendingCursorHotspot, pendingCursorData.data());
+
+    if (pendingCursorPos)
+      server->setCursorPos(oldCursorPos, pendingCursorWarped);
+  } catch (rdr::Exception& e) {
+    vlog.error("XserverDesktop::flushPending: %s",e.str());
+  }
+
+  pendingChanged.clear();
+  pendingCopied.clear();
+  pendingCursor = false;
+  pendingCursorPos = false;
+  pendingCursorWarped = false;
+
+  encoder->getLock()->unlock();
+
+  // Make sure the encoder thread notices any timers we've started
+  encoder->wakeup();
 }
 
 
@@ -417,6 +830,8 @@ void XserverDesktop::getQueryConnect(uint32_t* opaqueId,
                                      const char** username,
                                      int *timeout)
 {
+  EncoderLock l(encoder);
+
   *opaqueId = queryConnectId;
 
   if (!queryConnectTimer.isStarted()) {
@@ -433,6 +848,8 @@ void XserverDesktop::getQueryConnect(uint32_t* opaqueId,
 void XserverDesktop::approveConnection(uint32_t opaqueId, bool accept,
                                        const char* rejectMsg)
 {
+  EncoderLock l(encoder);
+
   if (queryConnectId == opaqueId) {
     server->approveConnection(queryConnectSocket, accept, rejectMsg);
     queryConnectId = 0;
@@ -452,6 +869,15 @@ void XserverDesktop::terminate()
 
 void XserverDesktop::pointerEvent(const Point& pos, int buttonMask)
 {
+  if (encoder) {
+    QueuedEvent event;
+    event.type = QueuedEvent::PointerEvent;
+    event.pos = pos;
+    event.buttonMask = buttonMask;
+    queueEvent(event);
+    return;
+  }
+
   vncPointerMove(pos.x + vncGetScreenX(screenIndex),
                  pos.y + vncGetScreenY(screenIndex));
   vncPointerButtonAction(buttonMask);
@@ -459,6 +885,32 @@ void XserverDesktop::pointerEvent(const Point& pos, int buttonMask)
 
 unsigned int XserverDesktop::setScreenLayout(int fb_width, int fb_height,
                                              const rfb::ScreenSet& layout)
+{
+  if (encoder) {
+    QueuedEvent event;
+
+    // The client needs an answer, so wait for the X thread to do the
+    // change. The lock is released while waiting, which lets the X
+    // thread update us with the new layout just as it would have if
+    // this was done directly.
+    event.type = QueuedEvent::ScreenLayout;
+    event.width = fb_width;
+    event.height = fb_height;
+    event.layout = layout;
+
+    layoutPending = true;
+    queueEvent(event);
+    while (layoutPending)
+      layoutDone->wait();
+
+    return layoutResult;
+  }
+
+  return applyScreenLayout(fb_width, fb_height, layout);
+}
+
+unsigned int XserverDesktop::applyScreenLayout(int fb_width, int fb_height,
+                                               const rfb::ScreenSet& layout)
 {
   unsigned int result;
 
@@ -480,16 +932,39 @@ unsigned int XserverDesktop::setScreenLayout(int fb_width, int fb_height,
 
 void XserverDesktop::handleClipboardRequest()
 {
+  if (encoder) {
+    QueuedEvent event;
+    event.type = QueuedEvent::ClipboardRequest;
+    queueEvent(event);
+    return;
+  }
+
   vncHandleClipboardRequest();
 }
 
 void XserverDesktop::handleClipboardAnnounce(bool available)
 {
+  if (encoder) {
+    QueuedEvent event;
+    event.type = QueuedEvent::ClipboardAnnounce;
+    event.available = available;
+    queueEvent(event);
+    return;
+  }
+
   vncHandleClipboardAnnounce(available);
 }
 
 void XserverDesktop::handleClipboardData(const char* data_)
 {
+  if (encoder) {
+    QueuedEvent event;
+    event.type = QueuedEvent::ClipboardData;
+    event.data = data_;
+    queueEvent(event);
+    return;
+  }
+
   vncHandleClipboardData(data_);
 }
 
@@ -517,6 +992,16 @@ void XserverDesktop::keyEvent(rdr::U32 keysym, rdr::U32 keycode, bool down)
   if (!rawKeyboard)
     keycode = 0;
 
+  if (encoder) {
+    QueuedEvent event;
+    event.type = QueuedEvent::KeyEvent;
+    event.keysym = keysym;
+    event.keycode = keycode;
+    event.down = down;
+    queueEvent(event);
+    return;
+  }
+
   vncKeyboardEvent(keysym, keycode, down);
 }
 
@@ -27,14 +27,19 @@
 #include <dix-config.h>
 #endif
 
+#include <list>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <stdint.h>
+#include <sys/select.h>
 
 #include <rfb/SDesktop.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/Configuration.h>
 #include <rfb/Timer.h>
+#include <os/Mutex.h>
 #include <unixcommon.h>
 #include "Input.h"
 
@@ -44,6 +49,8 @@ namespace rfb {
 
 namespace network { class SocketListener; class Socket; class SocketServer; }
 
+class EncoderThread;
+
 class XserverDesktop : public rfb::SDesktop, public rfb::FullFramePixelBuffer,
                        public rfb::Timer::Callback {
 public:
@@ -75,6 +82,10 @@ public:
   void addClient(network::Socket* sock, bool reverse);
   void disconnectClients();
 
+  // methods called from the encoder thread, with its lock held
+  void prepareSocketEvents(fd_set* rfds, fd_set* wfds, int* nfds);
+  void processSocketEvents(fd_set* rfds, fd_set* wfds);
+
   // QueryConnect methods called from X server code
   // getQueryConnect()
   //   Returns information about the currently waiting query
@@ -114,6 +125,36 @@ protected:
 
   virtual bool handleTimeout(rfb::Timer* t);
 
+  // Requests from the encoder thread that have to be carried out by
+  // the X server's thread
+  struct QueuedEvent {
+    enum Type {
+      PointerEvent, KeyEvent, ScreenLayout, ClipboardRequest,
+      ClipboardAnnounce, ClipboardData, QueryConnection, ClientGone
+    } type;
+
+    rfb::Point pos;
+    int buttonMask;
+    rdr::U32 keysym, keycode;
+    bool down;
+    int width, height;
+    rfb::ScreenSet layout;
+    bool available;
+    std::string data;
+    network::Socket* sock;
+    std::string address;
+    int fd;
+  };
+
+  void queueEvent(const QueuedEvent& event);
+  void handleQueuedEvents();
+  void flushPending(int* timeout);
+
+  void startQueryConnect(network::Socket* sock, const char* address,
+                         const char* userName);
+  unsigned int applyScreenLayout(int fb_width, int fb_height,
+                                 const rfb::ScreenSet& layout);
+
 private:
 
   int screenIndex;
@@ -130,5 +171,32 @@ private:
   OutputIdMap outputIdMap;
 
   rfb::Point oldCursorPos;
+
+  // State used when the RFB side runs on the encoder thread
+  EncoderThread* encoder;
+  rfb::ManagedPixelBuffer* snapshot;
+
+  rfb::Region pendingChanged;
+  rfb::Region pendingCopied;
+  rfb::Point pendingCopyDelta;
+  bool pendingCursorPos, pendingCursorWarped;
+  bool pendingCursor;
+  int pendingCursorWidth, pendingCursorHeight;
+  rfb::Point pendingCursorHotspot;
+  std::vector<rdr::U8> pendingCursorData;
+
+  os::Mutex queueLock;
+  std::list<QueuedEvent> eventQueue;
+  int eventPipe[2];
+
+  // Sockets that are waiting for a QueryConnection event to be seen by
+  // the X thread, and whether their client has gone away meanwhile. A
+  // socket in here is not deleted until then. Protected by the encoder
+  // thread's lock.
+  std::map<network::Socket*, bool> queuedQueries;
+
+  os::Condition* layoutDone;
+  bool layoutPending;
+  unsigned int layoutResult;
 };
 #endif
@@ -23,8 +23,10 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/select.h>
 #endif
 
 #include <rfb/CMsgWriter.h>
@@ -75,8 +77,20 @@ static const PixelFormat mediumColourPF(8, 8, false, true,
 // Time new bandwidth estimates are weighted against (in ms)
 static const unsigned bpsEstimateWindow = 1000;
 
+// The GUI thread holds the FLTK lock whenever it uses the connection,
+// so the reader thread takes it as well when it updates the connection
+// state or sends something. It is never held whilst waiting for or
+// decoding server data.
+class StateLock {
+public:
+  StateLock(bool needed) : locked(needed) { if (locked) Fl::lock(); }
+  ~StateLock() { if (locked) Fl::unlock(); }
+private:
+  bool locked;
+};
+
 CConn::CConn(const char* vncServerName, network::Socket* socket=NULL)
-  : serverHost(0), serverPort(0), desktop(NULL),
+  : serverHost(0), serverPort(0), desktop(NULL), readerThread(NULL),
     updateCount(0), pixelCount(0),
     lastServerEncoding((unsigned int)-1), bpsEstimate(20000000)
 {
@@ -129,6 +143,24 @@ CConn::CConn(const char* vncServerName, network::Socket* socket=NULL)
 
 CConn::~CConn()
 {
+  if (readerThread) {
+    std::list<GUIEvent*>::iterator iter;
+
+    readerThread->stop();
+    // The thread might be waiting for the GUI lock, so we cannot hold
+    // on to it whilst waiting for it
+    Fl::unlock();
+    delete readerThread;
+    Fl::lock();
+    readerThread = NULL;
+
+    // FLTK might still have events queued that refer to us
+    os::AutoMutex a(&eventMutex);
+    for (iter = pendingEvents.begin(); iter != pendingEvents.end(); ++iter)
+      (*iter)->cc = NULL;
+    pendingEvents.clear();
+  }
+
   close();
 
   OptionsDialog::removeCallback(handleOptions);
@@ -243,51 +275,86 @@ void CConn::socketEvent(FL_SOCKET fd, void *data)
 
   recursing = true;
 
+  cc->processMessages();
+
+  // Everything up until the desktop window is created might need
+  // dialogs, so only hand over to the reader thread after that
+  if (networkThread && (cc->desktop != NULL) && !should_exit()) {
+    vlog.info("Processing server messages on a separate thread");
+    Fl::remove_fd(fd);
+    cc->readerThread = new ReaderThread(cc);
+    cc->readerThread->start();
+    recursing = false;
+    return;
+  }
+
+  when = FL_READ | FL_EXCEPT;
+  if (cc->sock->outStream().hasBufferedData())
+    when |= FL_WRITE;
+
+  Fl::add_fd(fd, when, socketEvent, data);
+
+  recursing = false;
+}
+
+void CConn::processMessages()
+{
   try {
-    // We might have been called to flush unwritten socket data
-    cc->sock->outStream().flush();
+    if (readerThread == NULL) {
+      // We might have been called to flush unwritten socket data
+      sock->outStream().flush();
 
-    cc->sock->outStream().cork(true);
+      sock->outStream().cork(true);
+    } else {
+      // The GUI thread writes to the socket as well, so we cannot cork
+      // it here without holding up its input events
+      StateLock lock(true);
+      sock->outStream().flush();
+    }
 
     // processMsg() only processes one message, so we need to loop
     // until the buffers are empty or things will stall.
-    while (cc->processMsg()) {
+    while (processMsg()) {
+
+      if (readerThread != NULL) {
+        if (readerThread->isStopping())
+          break;
+        continue;
+      }
 
       // Make sure that the FLTK handling and the timers gets some CPU
       // time in case of back to back messages
-       Fl::check();
-       Timer::checkTimeouts();
+      Fl::check();
+      Timer::checkTimeouts();
 
-       // Also check if we need to stop reading and terminate
-       if (should_exit())
-         break;
+      // Also check if we need to stop reading and terminate
+      if (should_exit())
+        break;
     }
 
-    cc->sock->outStream().cork(false);
-    cc->sock->outStream().flush();
+    if (readerThread == NULL) {
+      sock->outStream().cork(false);
+      sock->outStream().flush();
+    }
   } catch (rdr::EndOfStream& e) {
     vlog.info("%s", e.str());
-    if (!cc->desktop) {
+    if (!desktop) {
       vlog.error(_("The connection was dropped by the server before "
                    "the session could be established."));
-      exit_vncviewer(_("The connection was dropped by the server "
-                       "before the session could be established."));
+      exitViewer(_("The connection was dropped by the server "
+                   "before the session could be established."));
     } else {
-      exit_vncviewer();
+      exitViewer();
     }
   } catch (rdr::Exception& e) {
+    char error[1024];
+
     vlog.error("%s", e.str());
-    exit_vncviewer(_("An unexpected error occurred when communicating "
-                     "with the server:\n\n%s"), e.str());
+    snprintf(error, sizeof(error),
+             _("An unexpected error occurred when communicating "
+               "with the server:\n\n%s"), e.str());
+    exitViewer(error);
   }
-
-  when = FL_READ | FL_EXCEPT;
-  if (cc->sock->outStream().hasBufferedData())
-    when |= FL_WRITE;
-
-  Fl::add_fd(fd, when, socketEvent, data);
-
-  recursing = false;
 }
 
 ////////////////////// CConnection callback methods //////////////////////
@@ -319,6 +386,8 @@ void CConn::initDone()
 // it is set initially).
 void CConn::setDesktopSize(int w, int h)
 {
+  StateLock lock(readerThread != NULL);
+
   CConnection::setDesktopSize(w,h);
   resizeFramebuffer();
 }
@@ -327,6 +396,8 @@ void CConn::setDesktopSize(int w, int h)
 void CConn::setExtendedDesktopSize(unsigned reason, unsigned result,
                                    int w, int h, const rfb::ScreenSet& layout)
 {
+  StateLock lock(readerThread != NULL);
+
   CConnection::setExtendedDesktopSize(reason, result, w, h, layout);
 
   if ((reason == reasonClient) && (result != resultSuccess)) {
@@ -340,8 +411,50 @@ void CConn::setExtendedDesktopSize(unsigned reason, unsigned result,
 // setName() is called when the desktop name changes
 void CConn::setName(const char* name)
 {
-  CConnection::setName(name);
-  desktop->setName(name);
+  GUIEvent* ev;
+
+  {
+    StateLock lock(readerThread != NULL);
+    CConnection::setName(name);
+  }
+
+  if (readerThread == NULL) {
+    desktop->setName(name);
+    return;
+  }
+
+  ev = new GUIEvent(this, GUIEvent::Name);
+  ev->text = strDup(name);
+  postEvent(ev);
+}
+
+void CConn::fence(rdr::U32 flags, unsigned len, const char data[])
+{
+  StateLock lock(readerThread != NULL);
+
+  CMsgHandler::fence(flags, len, data);
+
+  if (flags & fenceFlagRequest) {
+    // We handle everything synchronously so we trivially honor these modes
+    flags = flags & (fenceFlagBlockBefore | fenceFlagBlockAfter);
+
+    writer()->writeFence(flags, len, data);
+    return;
+  }
+}
+
+void CConn::endOfContinuousUpdates()
+{
+  StateLock lock(readerThread != NULL);
+
+  CConnection::endOfContinuousUpdates();
+}
+
+void CConn::supportsQEMUKeyEvent()
+{
+  StateLock lock(readerThread != NULL);
+
+  CConnection::supportsQEMUKeyEvent();
 }
 
 // framebufferUpdateStart() is called at the beginning of an update.
@@ -350,14 +463,20 @@ void CConn::setName(const char* name)
 // one.
 void CConn::framebufferUpdateStart()
 {
-  CConnection::framebufferUpdateStart();
+  {
+    StateLock lock(readerThread != NULL);
+    CConnection::framebufferUpdateStart();
+  }
 
   // For bandwidth estimate
   gettimeofday(&updateStartTime, NULL);
   updateStartPos = sock->inStream().pos();
 
   // Update the screen prematurely for very slow updates
-  Fl::add_timeout(1.0, handleUpdateTimeout, this);
+  if (readerThread)
+    postEvent(new GUIEvent(this, GUIEvent::UpdateStart));
+  else
+    Fl::add_timeout(1.0, handleUpdateTimeout, this);
 }
 
 // framebufferUpdateEnd() is called at the end of an update.
@@ -369,6 +488,12 @@ void CConn::framebufferUpdateEnd()
   unsigned long long elapsed, bps, weight;
   struct timeval now;
 
+  // Finish decoding before taking the lock so that the GUI thread
+  // isn't held up by it
+  flushDecoder();
+
+  StateLock lock(readerThread != NULL);
+
   CConnection::framebufferUpdateEnd();
 
   updateCount++;
@@ -390,8 +515,12 @@ void CConn::framebufferUpdateEnd()
   bpsEstimate = ((bpsEstimate * (1000000 - weight)) +
                  (bps * weight)) / 1000000;
 
-  Fl::remove_timeout(handleUpdateTimeout, this);
-  desktop->updateWindow();
+  if (readerThread) {
+    postEvent(new GUIEvent(this, GUIEvent::UpdateEnd));
+  } else {
+    Fl::remove_timeout(handleUpdateTimeout, this);
+    desktop->updateWindow();
+  }
 
   // Compute new settings based on updated bandwidth values
   if (autoSelect)
@@ -407,6 +536,11 @@ void CConn::setColourMapEntries(int firstColour, int nColours, rdr::U16* rgbs)
 
 void CConn::bell()
 {
+  if (readerThread != NULL) {
+    postEvent(new GUIEvent(this, GUIEvent::Bell));
+    return;
+  }
+
   fl_beep();
 }
 
@@ -428,47 +562,136 @@ bool CConn::dataRect(const Rect& r, int encoding)
 void CConn::setCursor(int width, int height, const Point& hotspot,
                       const rdr::U8* data)
 {
-  desktop->setCursor(width, height, hotspot, data);
+  GUIEvent* ev;
+
+  if (readerThread == NULL) {
+    desktop->setCursor(width, height, hotspot, data);
+    return;
+  }
+
+  ev = new GUIEvent(this, GUIEvent::Cursor);
+  ev->width = width;
+  ev->height = height;
+  ev->pos = hotspot;
+  ev->data = new rdr::U8[width * height * 4];
+  memcpy(ev->data, data, width * height * 4);
+  postEvent(ev);
 }
 
 void CConn::setCursorPos(const Point& pos)
 {
-  desktop->setCursorPos(pos);
+  GUIEvent* ev;
+
+  if (readerThread == NULL) {
+    desktop->setCursorPos(pos);
+    return;
+  }
+
+  ev = new GUIEvent(this, GUIEvent::CursorPos);
+  ev->pos = pos;
+  postEvent(ev);
+}
+
+void CConn::serverCutText(const char* str)
+{
+  StateLock lock(readerThread != NULL);
+
+  CConnection::serverCutText(str);
 }
 
-void CConn::fence(rdr::U32 flags, unsigned len, const char data[])
+void CConn::setLEDState(unsigned int state)
 {
-  CMsgHandler::fence(flags, len, data);
+  GUIEvent* ev;
 
-  if (flags & fenceFlagRequest) {
-    // We handle everything synchronously so we trivially honor these modes
-    flags = flags & (fenceFlagBlockBefore | fenceFlagBlockAfter);
+  {
+    StateLock lock(readerThread != NULL);
+    CConnection::setLEDState(state);
+  }
 
-    writer()->writeFence(flags, len, data);
+  if (readerThread == NULL) {
+    desktop->setLEDState(state);
     return;
   }
+
+  ev = new GUIEvent(this, GUIEvent::LEDState);
+  ev->value = state;
+  postEvent(ev);
 }
 
-void CConn::setLEDState(unsigned int state)
+void CConn::handleClipboardCaps(rdr::U32 flags, const rdr::U32* lengths)
+{
+  StateLock lock(readerThread != NULL);
+
+  CConnection::handleClipboardCaps(flags, lengths);
+}
+
+void CConn::handleClipboardRequest(rdr::U32 flags)
+{
+  StateLock lock(readerThread != NULL);
+
+  CConnection::handleClipboardRequest(flags);
+}
+
+void CConn::handleClipboardPeek(rdr::U32 flags)
+{
+  StateLock lock(readerThread != NULL);
+
+  CConnection::handleClipboardPeek(flags);
+}
+
+void CConn::handleClipboardNotify(rdr::U32 flags)
 {
-  CConnection::setLEDState(state);
+  StateLock lock(readerThread != NULL);
 
-  desktop->setLEDState(state);
+  CConnection::handleClipboardNotify(flags);
+}
+
+void CConn::handleClipboardProvide(rdr::U32 flags, const size_t* lengths,
+                                   const rdr::U8* const* data)
+{
+  StateLock lock(readerThread != NULL);
+
+  CConnection::handleClipboardProvide(flags, lengths, data);
 }
 
 void CConn::handleClipboardRequest()
 {
+  if (readerThread != NULL) {
+    postEvent(new GUIEvent(this, GUIEvent::ClipboardRequest));
+    return;
+  }
+
   desktop->handleClipboardRequest();
 }
 
 void CConn::handleClipboardAnnounce(bool available)
 {
-  desktop->handleClipboardAnnounce(available);
+  GUIEvent* ev;
+
+  if (readerThread == NULL) {
+    desktop->handleClipboardAnnounce(available);
+    return;
+  }
+
+  ev = new GUIEvent(this, GUIEvent::ClipboardAnnounce);
+  ev->value = available;
+  postEvent(ev);
 }
 
+// Also called on the GUI thread by requestClipboard(), in which case
+// the event just ends up being handled a bit later
 void CConn::handleClipboardData(const char* data)
 {
-  desktop->handleClipboardData(data);
+  GUIEvent* ev;
+
+  if (readerThread == NULL) {
+    desktop->handleClipboardData(data);
+    return;
+  }
+
+  ev = new GUIEvent(this, GUIEvent::ClipboardData);
+  ev->text = strDup(data);
+  postEvent(ev);
 }
 
 
@@ -476,7 +699,59 @@ void CConn::handleClipboardData(const char* data)
 
 void CConn::resizeFramebuffer()
 {
-  desktop->resizeFramebuffer(server.width(), server.height());
+  ModifiablePixelBuffer* pb;
+  GUIEvent* ev;
+  bool resized;
+
+  if (readerThread == NULL) {
+    desktop->resizeFramebuffer(server.width(), server.height());
+    return;
+  }
+
+  // The frame buffer is only replaced whilst we wait below, so it is
+  // safe to look at here
+  pb = getFramebuffer();
+  if ((pb->width() == server.width()) && (pb->height() == server.height()))
+    return;
+
+  ev = new GUIEvent(this, GUIEvent::Resize);
+  ev->width = server.width();
+  ev->height = server.height();
+
+  readerThread->beginResize();
+  postEvent(ev);
+
+  // We are called from setDesktopSize() or setExtendedDesktopSize()
+  // with the GUI lock held, and the GUI thread needs it to do the
+  // resize
+  Fl::unlock();
+  resized = readerThread->waitForResize();
+  Fl::lock();
+
+  if (!resized)
+    throw rdr::Exception("Connection closed during resize");
+}
+
+// exit_vncviewer() may only be called from the GUI thread
+void CConn::exitViewer(const char* error)
+{
+  GUIEvent* ev;
+
+  if (readerThread == NULL) {
+    if (error != NULL)
+      exit_vncviewer("%s", error);
+    else
+      exit_vncviewer();
+    return;
+  }
+
+  ev = new GUIEvent(this, GUIEvent::Exit);
+  if (error != NULL)
+    ev->text = strDup(error);
+  postEvent(ev);
+
+  // Nothing more should be read from the server after this
+  readerThread->stop();
 }
 
 // autoSelectFormatAndEncoding() chooses the format and encoding appropriate
@@ -603,3 +878,196 @@ void CConn::handleUpdateTimeout(void *data)
 
   Fl::repeat_timeout(1.0, handleUpdateTimeout, data);
 }
+
+CConn::GUIEvent::GUIEvent(CConn* cc, Type type)
+  : cc(cc), type(type), width(0), height(0), value(0),
+    text(NULL), data(NULL)
+{
+}
+
+CConn::GUIEvent::~GUIEvent()
+{
+  strFree(text);
+  delete [] data;
+}
+
+void CConn::postEvent(GUIEvent* ev)
+{
+  os::AutoMutex a(&eventMutex);
+
+  pendingEvents.push_back(ev);
+  Fl::awake(handleEvent, ev);
+}
+
+void CConn::handleEvent(void *data)
+{
+  GUIEvent* ev;
+  CConn* self;
+
+  ev = (GUIEvent*)data;
+  self = ev->cc;
+
+  // The connection might have been closed after this was posted
+  if (self == NULL) {
+    delete ev;
+    return;
+  }
+
+  self->eventMutex.lock();
+  self->pendingEvents.remove(ev);
+  self->eventMutex.unlock();
+
+  switch (ev->type) {
+  case GUIEvent::UpdateStart:
+    Fl::add_timeout(1.0, handleUpdateTimeout, self);
+    break;
+  case GUIEvent::UpdateEnd:
+    Fl::remove_timeout(handleUpdateTimeout, self);
+    self->desktop->updateWindow();
+    break;
+  case GUIEvent::Resize:
+    self->desktop->resizeFramebuffer(ev->width, ev->height);
+    self->readerThread->resizeDone();
+    break;
+  case GUIEvent::Name:
+    self->desktop->setName(ev->text);
+    break;
+  case GUIEvent::Bell:
+    fl_beep();
+    break;
+  case GUIEvent::Cursor:
+    self->desktop->setCursor(ev->width, ev->height, ev->pos, ev->data);
+    break;
+  case GUIEvent::CursorPos:
+    self->desktop->setCursorPos(ev->pos);
+    break;
+  case GUIEvent::LEDState:
+    self->desktop->setLEDState(ev->value);
+    break;
+  case GUIEvent::ClipboardRequest:
+    self->desktop->handleClipboardRequest();
+    break;
+  case GUIEvent::ClipboardAnnounce:
+    self->desktop->handleClipboardAnnounce(ev->value);
+    break;
+  case GUIEvent::ClipboardData:
+    self->desktop->handleClipboardData(ev->text);
+    break;
+  case GUIEvent::Exit:
+    if (ev->text != NULL)
+      exit_vncviewer("%s", ev->text);
+    else
+      exit_vncviewer();
+    break;
+  }
+
+  delete ev;
+}
+
+CConn::ReaderThread::ReaderThread(CConn* cc)
+  : resized(&mutex)
+{
+  this->cc = cc;
+
+  stopRequested = false;
+  resizePending = false;
+}
+
+CConn::ReaderThread::~ReaderThread()
+{
+  wait();
+}
+
+void CConn::ReaderThread::stop()
+{
+  os::AutoMutex a(&mutex);
+
+  stopRequested = true;
+  resized.broadcast();
+}
+
+bool CConn::ReaderThread::isStopping()
+{
+  os::AutoMutex a(&mutex);
+
+  return stopRequested;
+}
+
+void CConn::ReaderThread::beginResize()
+{
+  os::AutoMutex a(&mutex);
+
+  resizePending = true;
+}
+
+bool CConn::ReaderThread::waitForResize()
+{
+  os::AutoMutex a(&mutex);
+
+  while (resizePending && !stopRequested)
+    resized.wait();
+
+  return !resizePending;
+}
+
+void CConn::ReaderThread::resizeDone()
+{
+  os::AutoMutex a(&mutex);
+
+  resizePending = false;
+  resized.broadcast();
+}
+
+void CConn::ReaderThread::worker()
+{
+  int fd;
+
+  fd = cc->sock->getFd();
+
+  while (!isStopping()) {
+    fd_set rfds, wfds;
+    struct timeval tv;
+    bool wantWrite;
+    int n;
+
+    {
+      // The GUI thread writes to the socket as well
+      StateLock lock(true);
+      wantWrite = cc->sock->outStream().hasBufferedData();
+    }
+
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    FD_ZERO(&wfds);
+    if (wantWrite)
+      FD_SET(fd, &wfds);
+
+    // Wake up regularly so we notice when we should stop
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
+
+    n = select(fd + 1, &rfds, &wfds, NULL, &tv);
+    if (n < 0) {
+      char error[1024];
+
+      if (errno == EINTR)
+        continue;
+
+      rdr::SystemException e("select", errno);
+
+      vlog.error("%s", e.str());
+      snprintf(error, sizeof(error),
+               _("An unexpected error occurred when communicating "
+                 "with the server:\n\n%s"), e.str());
+      cc->exitViewer(error);
+      break;
+    }
+
+    if (n == 0)
+      continue;
+
+    // Reading and decoding is done without the GUI lock, which is
+    // only taken briefly by the message handlers
+    cc->processMessages();
+  }
+}
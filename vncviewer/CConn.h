@@ -20,8 +20,13 @@
 #ifndef __CCONN_H__
 #define __CCONN_H__
 
+#include <list>
+
 #include <FL/Fl.H>
 
+#include <os/Mutex.h>
+#include <os/Thread.h>
+
 #include <rfb/CConnection.h>
 #include <rdr/FdInStream.h>
 
@@ -53,6 +58,10 @@ public:
 
   void setName(const char* name);
 
+  void fence(rdr::U32 flags, unsigned len, const char data[]);
+  void endOfContinuousUpdates();
+  void supportsQEMUKeyEvent();
+
   void setColourMapEntries(int firstColour, int nColours, rdr::U16* rgbs);
 
   void bell();
@@ -65,18 +74,29 @@ public:
                  const rdr::U8* data);
   void setCursorPos(const rfb::Point& pos);
 
-  void fence(rdr::U32 flags, unsigned len, const char data[]);
+  void serverCutText(const char* str);
 
   void setLEDState(unsigned int state);
 
+  void handleClipboardCaps(rdr::U32 flags, const rdr::U32* lengths);
+  void handleClipboardRequest(rdr::U32 flags);
+  void handleClipboardPeek(rdr::U32 flags);
+  void handleClipboardNotify(rdr::U32 flags);
+  void handleClipboardProvide(rdr::U32 flags, const size_t* lengths,
+                              const rdr::U8* const* data);
+
   virtual void handleClipboardRequest();
   virtual void handleClipboardAnnounce(bool available);
   virtual void handleClipboardData(const char* data);
 
 private:
 
+  void processMessages();
+
   void resizeFramebuffer();
 
+  void exitViewer(const char* error=NULL);
+
   void autoSelectFormatAndEncoding();
   void updatePixelFormat();
 
@@ -85,12 +105,73 @@ private:
   static void handleUpdateTimeout(void *data);
 
 private:
+  // Things the reader thread needs the GUI thread to do, as only the
+  // GUI thread may touch the windows
+  struct GUIEvent {
+    enum Type {
+      UpdateStart, UpdateEnd, Resize, Name, Bell, Cursor, CursorPos,
+      LEDState, ClipboardRequest, ClipboardAnnounce, ClipboardData, Exit
+    };
+
+    GUIEvent(CConn* cc, Type type);
+    ~GUIEvent();
+
+    CConn* cc;
+    Type type;
+
+    int width, height;
+    rfb::Point pos;
+    unsigned value;
+    char* text;
+    rdr::U8* data;
+  };
+
+  void postEvent(GUIEvent* ev);
+  static void handleEvent(void *data);
+
+  class ReaderThread : public os::Thread {
+  public:
+    ReaderThread(CConn* cc);
+    ~ReaderThread();
+
+    void stop();
+    bool isStopping();
+
+    // The reader thread calls beginResize() before asking the GUI
+    // thread to resize, and then waitForResize() which blocks until
+    // the GUI thread has called resizeDone(). Returns false if the
+    // thread was stopped first.
+    void beginResize();
+    bool waitForResize();
+    void resizeDone();
+
+  protected:
+    void worker();
+
+  private:
+    CConn* cc;
+
+    // Protects the frame buffer hand over to the GUI thread on
+    // resize, as well as the stop request
+    os::Mutex mutex;
+    os::Condition resized;
+
+    bool stopRequested;
+    bool resizePending;
+  };
+
   char* serverHost;
   int serverPort;
   network::Socket* sock;
 
   DesktopWindow *desktop;
 
+  ReaderThread *readerThread;
+
+  // Posted events that the GUI thread hasn't handled yet
+  os::Mutex eventMutex;
+  std::list<GUIEvent*> pendingEvents;
+
   unsigned updateCount;
   unsigned pixelCount;
 
@@ -1437,13 +1437,13 @@ void DesktopWindow::handleStatsTimeout(void *data)
 
   const size_t statsCount = sizeof(self->stats)/sizeof(self->stats[0]);
 
-  unsigned updates, pixels, pos;
+  unsigned updates, pixels, pos, presents, latency;
   unsigned elapsed;
 
   const unsigned statsWidth = 200;
-  const unsigned statsHeight = 100;
+  const unsigned statsHeight = 115;
   const unsigned graphWidth = statsWidth - 10;
-  const unsigned graphHeight = statsHeight - 25;
+  const unsigned graphHeight = statsHeight - 40;
 
   Fl_Image_Surface *surface;
   Fl_RGB_Image *image;
@@ -1456,6 +1456,8 @@ void DesktopWindow::handleStatsTimeout(void *data)
   updates = self->cc->getUpdateCount();
   pixels = self->cc->getPixelCount();
   pos = self->cc->getPosition();
+  presents = self->viewport->getPresentCount();
+  latency = self->viewport->getPresentLatency();
   elapsed = msSince(&self->statsLastTime);
   if (elapsed < 1)
     elapsed = 1;
@@ -1528,17 +1530,24 @@ void DesktopWindow::handleStatsTimeout(void *data)
 
   fl_color(FL_GREEN);
   snprintf(buffer, sizeof(buffer), "%u upd/s", self->stats[statsCount-1].ups);
-  fl_draw(buffer, 5, statsHeight - 5);
+  fl_draw(buffer, 5, statsHeight - 20);
 
   fl_color(FL_YELLOW);
   siPrefix(self->stats[statsCount-1].pps, "pix/s",
            buffer, sizeof(buffer), 3);
-  fl_draw(buffer, 5 + (statsWidth-10)/3, statsHeight - 5);
+  fl_draw(buffer, 5 + (statsWidth-10)/3, statsHeight - 20);
 
   fl_color(FL_RED);
   siPrefix(self->stats[statsCount-1].bps * 8, "bps",
            buffer, sizeof(buffer), 3);
-  fl_draw(buffer, 5 + (statsWidth-10)*2/3, statsHeight - 5);
+  fl_draw(buffer, 5 + (statsWidth-10)*2/3, statsHeight - 20);
+
+  fl_color(FL_CYAN);
+  snprintf(buffer, sizeof(buffer), "%u pres/s",
+           presents * 1000 / elapsed);
+  fl_draw(buffer, 5, statsHeight - 5);
+  snprintf(buffer, sizeof(buffer), "%u ms pres latency", latency);
+  fl_draw(buffer, 5 + (statsWidth-10)/3, statsHeight - 5);
 
   image = surface->image();
   delete surface;
@@ -24,11 +24,13 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include <rfb/CMsgWriter.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Exception.h>
 #include <rfb/ledStates.h>
+#include <rfb/util.h>
 
 // FLTK can pull in the X11 headers on some systems
 #ifndef XK_VoidSymbol
@@ -114,6 +116,8 @@ static const WORD SCAN_FAKE = 0xaa;
 
 Viewport::Viewport(int w, int h, const rfb::PixelFormat& serverPF, CConn* cc_)
   : Fl_Widget(0, 0, w, h), cc(cc_), frameBuffer(NULL),
+    presentPending(false), damagePending(false),
+    presentCount(0), presentLatencySum(0),
     lastPointerPos(0, 0), lastButtonMask(0),
 #ifdef WIN32
     altGrArmed(false),
@@ -170,6 +174,8 @@ Viewport::Viewport(int w, int h, const rfb::PixelFormat& serverPF, CConn* cc_)
   assert(frameBuffer);
   cc->setFramebuffer(frameBuffer);
 
+  memset(&lastPresent, 0, sizeof(lastPresent));
+
   contextMenu = new Fl_Menu_Button(0, 0, 0, 0);
   // Setting box type to FL_NO_BOX prevents it from trying to draw the
   // button component (which we don't want)
@@ -195,6 +201,7 @@ Viewport::~Viewport()
   // Unregister all timeouts in case they get a change tro trigger
   // again later when this object is already gone.
   Fl::remove_timeout(handlePointerTimeout, this);
+  Fl::remove_timeout(handlePresentTimeout, this);
 #ifdef WIN32
   Fl::remove_timeout(handleAltGrTimeout, this);
 #endif
@@ -227,10 +234,54 @@ const rfb::PixelFormat &Viewport::getPreferredPF()
 
 void Viewport::updateWindow()
 {
-  Rect r;
+  unsigned elapsed;
 
-  r = frameBuffer->getDamage();
-  damage(FL_DAMAGE_USER1, r.tl.x + x(), r.tl.y + y(), r.width(), r.height());
+  // Latency is counted from when the damage arrived, so that it
+  // includes any time spent waiting below
+  if (!damagePending) {
+    damagePending = true;
+    gettimeofday(&damageTime, NULL);
+  }
+
+  // Already waiting to present, which will include this update
+  if (presentPending)
+    return;
+
+  // Drawing more often than the display can show is just wasted
+  // effort, so merge updates that arrive too quickly
+  if (presentInterval > 0) {
+    elapsed = msSince(&lastPresent);
+    if (elapsed < (unsigned)presentInterval) {
+      presentPending = true;
+      Fl::add_timeout((double)(presentInterval - elapsed) / 1000.0,
+                      handlePresentTimeout, this);
+      return;
+    }
+  }
+
+  presentDamage();
+}
+
+unsigned Viewport::getPresentCount()
+{
+  return presentCount;
+}
+
+// Average time in milliseconds from an update being ready until it
+// has been drawn, since the last call
+unsigned Viewport::getPresentLatency()
+{
+  unsigned latency;
+
+  if (presentCount == 0)
+    return 0;
+
+  latency = presentLatencySum / presentCount / 1000;
+
+  presentCount = 0;
+  presentLatencySum = 0;
+
+  return latency;
 }
 
 static const char * dotcursor_xpm[] = {
@@ -525,6 +576,8 @@ void Viewport::draw(Surface* dst)
     return;
 
   frameBuffer->draw(dst, X - x(), Y - y(), X, Y, W, H);
+
+  presentDone();
 }
 
 
@@ -538,6 +591,8 @@ void Viewport::draw()
     return;
 
   frameBuffer->draw(X - x(), Y - y(), X, Y, W, H);
+
+  presentDone();
 }
 
 
@@ -935,6 +990,50 @@ void Viewport::handleKeyRelease(int keyCode)
 }
 
 
+void Viewport::presentDamage()
+{
+  Rect r;
+
+  gettimeofday(&lastPresent, NULL);
+
+  r = frameBuffer->getDamage();
+  if (r.is_empty()) {
+    damagePending = false;
+    return;
+  }
+
+  damage(FL_DAMAGE_USER1, r.tl.x + x(), r.tl.y + y(), r.width(), r.height());
+}
+
+
+void Viewport::handlePresentTimeout(void *data)
+{
+  Viewport *self = (Viewport *)data;
+
+  assert(self);
+
+  self->presentPending = false;
+  self->presentDamage();
+}
+
+
+void Viewport::presentDone()
+{
+  struct timeval now;
+
+  if (!damagePending)
+    return;
+
+  gettimeofday(&now, NULL);
+
+  presentCount++;
+  presentLatencySum += (now.tv_sec - damageTime.tv_sec) * 1000000ULL +
+                       (now.tv_usec - damageTime.tv_usec);
+
+  damagePending = false;
+}
+
+
 int Viewport::handleSystemEvent(void *event, void *data)
 {
   Viewport *self = (Viewport *)data;
@@ -22,6 +22,8 @@
 
 #include <map>
 
+#include <sys/time.h>
+
 #include <rfb/Rect.h>
 
 #include <FL/Fl_Widget.H>
@@ -47,6 +49,10 @@ public:
   // Flush updates to screen
   void updateWindow();
 
+  // Statistics on how often updates are put on screen
+  unsigned getPresentCount();
+  unsigned getPresentLatency();
+
   // New image for the locally rendered cursor
   void setCursor(int width, int height, const rfb::Point& hotspot,
                  const rdr::U8* data);
@@ -89,6 +95,10 @@ private:
 
   static int handleSystemEvent(void *event, void *data);
 
+  void presentDamage();
+  static void handlePresentTimeout(void *data);
+  void presentDone();
+
 #ifdef WIN32
   static void handleAltGrTimeout(void *data);
   void resolveAltGrDetection(bool isAltGrSequence);
@@ -108,6 +118,13 @@ private:
 
   PlatformPixelBuffer* frameBuffer;
 
+  bool presentPending;
+  struct timeval lastPresent;
+  bool damagePending;
+  struct timeval damageTime;
+  unsigned presentCount;
+  unsigned long long presentLatencySum;
+
   rfb::Point lastPointerPos;
   int lastButtonMask;
 
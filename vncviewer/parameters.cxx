@@ -152,6 +152,16 @@ BoolParameter fullscreenSystemKeys("FullscreenSystemKeys",
                                    "to the server when in full screen mode.",
                                    true);
 
+IntParameter presentInterval("PresentInterval",
+                              "Minimum time in milliseconds between "
+                              "presenting framebuffer updates on screen "
+                              "(0 = present every update)", 0);
+
+BoolParameter networkThread("NetworkThread",
+                            "Read and process data from the server on a "
+                            "separate thread instead of the GUI thread",
+                            false);
+
 #ifndef WIN32
 StringParameter via("via", "Gateway to tunnel via", "");
 #endif
@@ -70,6 +70,8 @@ extern rfb::StringParameter display;
 extern rfb::StringParameter menuKey;
 
 extern rfb::BoolParameter fullscreenSystemKeys;
+extern rfb::IntParameter presentInterval;
+extern rfb::BoolParameter networkThread;
 extern rfb::BoolParameter alertOnFatalError;
 
 #ifndef WIN32
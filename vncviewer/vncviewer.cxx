@@ -700,6 +700,11 @@ int main(int argc, char** argv)
 #endif
   }
 
+  // FLTK needs to be told that other threads will be using it before
+  // any such thread is started
+  if (networkThread)
+    Fl::lock();
+
   CConn *cc = new CConn(vncServerName, sock);
 
   inMainloop = true;